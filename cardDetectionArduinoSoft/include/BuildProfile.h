@@ -0,0 +1,29 @@
+#pragma once
+
+// --- BUILD PROFILES ---
+// Select a profile from platformio.ini, e.g.:
+//   build_flags = -DBUILD_PROFILE=PROFILE_LEAN
+//
+// LEAN:       production minimum - no override, no MSG: strings, no periodic
+//             telemetry. Only EVT:/ERR: verdict lines and command replies
+//             leave the device.
+// STANDARD:   current behaviour (default).
+// DIAGNOSTIC: STANDARD plus the detector cost in STATS. Loop period and
+//             stop latency are in STATS in every profile.
+//
+// Features are constexpr so disabled code and its strings are dropped by
+// the compiler instead of being skipped at runtime.
+#define PROFILE_LEAN       0
+#define PROFILE_STANDARD   1
+#define PROFILE_DIAGNOSTIC 2
+
+#ifndef BUILD_PROFILE
+#define BUILD_PROFILE PROFILE_STANDARD
+#endif
+
+constexpr bool FEATURE_OVERRIDE  = (BUILD_PROFILE != PROFILE_LEAN);       // SET_OVERRIDE / CFG_SYSTEM_OVERRIDE
+constexpr bool FEATURE_MESSAGES  = (BUILD_PROFILE != PROFILE_LEAN);       // Informational MSG: lines
+constexpr bool FEATURE_TELEMETRY = (BUILD_PROFILE != PROFILE_LEAN);       // Periodic D: lines
+constexpr bool FEATURE_INJECTION = (BUILD_PROFILE != PROFILE_LEAN);       // INJECT sample replay
+constexpr bool FEATURE_STATS     = (BUILD_PROFILE == PROFILE_DIAGNOSTIC); // Detector cost in STATS
+constexpr bool FEATURE_SHADOW    = (BUILD_PROFILE != PROFILE_LEAN);       // Shadow detector (SHADOW_* parameters)
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <stdint.h>
+
+// --- STREAMING STATISTICS ---
+// Running statistics over a sample stream: constant memory, no heap and
+// O(1) work per sample (amortised for the sliding window). Integer
+// variants are meant for the AVR; the templates taking a float type are
+// for host tools. pc_software/streaming_stats.py has the same primitives
+// with the same results for the PC side; test/host/test_streaming_stats.cpp
+// checks that on one sample stream.
+
+// Min, max and sum since the last reset (tumbling window, e.g. AGG). An
+// AGG window of 60 s holds ~300k samples, past a 16-bit count. A full
+// count stops the window instead of wrapping: later values are ignored
+// until reset(), so mean() stays the mean of what was counted.
+template <typename T, typename Sum, typename Count = unsigned long>
+struct WindowStats {
+  T min;
+  T max;
+  Sum sum;
+  Count count;
+
+  void reset() {
+    sum = 0;
+    count = 0;
+  }
+  bool full() const {
+    return count == (Count)~(Count)0;
+  }
+  void add(T value) {
+    if (full()) return;
+    if (count == 0 || value < min) min = value;
+    if (count == 0 || value > max) max = value;
+    sum += value;
+    count++;
+  }
+  Sum mean() const {
+    return count > 0 ? sum / (Sum)count : 0;
+  }
+};
+
+// Minimum (IS_MAX false) or maximum of the last N values. A monotonic
+// deque: values that can no longer become the extreme are dropped when
+// a better one arrives, so the front is always the answer.
+template <typename T, uint8_t N, bool IS_MAX>
+class MonotonicWindow {
+ public:
+  void reset() {
+    head = 0;
+    length = 0;
+    seq = 0;
+  }
+  void add(T value) {
+    if (length > 0 && (uint16_t)(seq - at[head]) >= N) {
+      head = (head + 1) % N; // Front left the window
+      length--;
+    }
+    while (length > 0 && !beats(values[(head + length - 1) % N], value)) {
+      length--;
+    }
+    uint8_t i = (head + length) % N;
+    values[i] = value;
+    at[i] = seq++;
+    length++;
+  }
+  bool empty() const {
+    return length == 0;
+  }
+  T value() const { // Only when !empty()
+    return values[head];
+  }
+
+ private:
+  static bool beats(T a, T b) {
+    return IS_MAX ? a > b : a < b;
+  }
+  T values[N];
+  uint16_t at[N];    // Sequence number of each value
+  uint8_t head = 0;
+  uint8_t length = 0;
+  uint16_t seq = 0;
+};
+
+// The Arduino min()/max() macros rule out methods of those names.
+template <typename T, uint8_t N>
+struct SlidingMinMax {
+  MonotonicWindow<T, N, false> low;
+  MonotonicWindow<T, N, true> high;
+
+  void reset() {
+    low.reset();
+    high.reset();
+  }
+  void add(T value) {
+    low.add(value);
+    high.add(value);
+  }
+  T lowest() const { // Only after add()
+    return low.value();
+  }
+  T highest() const {
+    return high.value();
+  }
+};
+
+// Exponentially weighted mean of integers with weight 1/2^SHIFT, held in
+// Q8 fixed point. Seeded by the first value.
+template <uint8_t SHIFT>
+struct EwmaQ8 {
+  long q8;
+  bool seeded = false;
+
+  void add(int value) {
+    long x = (long)value << 8;
+    if (!seeded) {
+      q8 = x;
+      seeded = true;
+    } else {
+      q8 += (x - q8) >> SHIFT;
+    }
+  }
+  int value() const {
+    return q8 >> 8;
+  }
+};
+
+// Host variant with any weight.
+template <typename F>
+struct Ewma {
+  F alpha;
+  F mean;
+  bool seeded;
+
+  explicit Ewma(F weight) : alpha(weight), mean(0), seeded(false) {}
+  void add(F value) {
+    mean = seeded ? mean + alpha * (value - mean) : value;
+    seeded = true;
+  }
+};
+
+// Mean and variance in one pass without cancellation (Welford). Float on
+// the AVR too; there it costs a division per sample.
+template <typename F>
+struct Welford {
+  unsigned long count = 0;
+  F mean = 0;
+  F m2 = 0;
+
+  void add(F value) {
+    count++;
+    F delta = value - mean;
+    mean += delta / count;
+    m2 += delta * (value - mean);
+  }
+  F variance() const { // Sample variance
+    return count > 1 ? m2 / (count - 1) : 0;
+  }
+};
+
+// Quantiles of values 0 .. (BUCKETS << SHIFT) - 1, e.g. ADC counts, from
+// a fixed histogram of buckets 2^SHIFT wide. When a count would overflow,
+// all counts are halved, so older samples slowly lose weight.
+// 64 buckets x uint16_t = 128 bytes covers 0..1023 in steps of 16.
+template <uint8_t BUCKETS, uint8_t SHIFT, typename Count = uint16_t>
+class HistogramQuantile {
+ public:
+  void reset() {
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+      counts[i] = 0;
+    }
+    total = 0;
+  }
+  void add(unsigned int value) {
+    unsigned int bucket = value >> SHIFT;
+    uint8_t i = bucket < BUCKETS ? bucket : BUCKETS - 1;
+    if (counts[i] == (Count)~(Count)0) {
+      total = 0;
+      for (uint8_t j = 0; j < BUCKETS; j++) {
+        counts[j] /= 2;
+        total += counts[j];
+      }
+    }
+    counts[i]++;
+    total++;
+  }
+  // Midpoint of the bucket holding the given percentile (0..100).
+  unsigned int quantile(uint8_t percent) const {
+    unsigned long rank = (unsigned long)total * percent / 100;
+    unsigned long seen = 0;
+    for (uint8_t i = 0; i < BUCKETS; i++) {
+      seen += counts[i];
+      if (seen > rank) {
+        return ((unsigned int)i << SHIFT) + (1u << SHIFT) / 2;
+      }
+    }
+    return ((unsigned int)(BUCKETS - 1) << SHIFT) + (1u << SHIFT) / 2;
+  }
+  unsigned long samples() const {
+    return total;
+  }
+
+ private:
+  Count counts[BUCKETS] = {};
+  unsigned long total = 0;
+};
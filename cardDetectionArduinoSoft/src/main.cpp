@@ -1,10 +1,75 @@
 #include <Arduino.h>
+#include <EEPROM.h>
+#include <util/crc16.h>
+#include "BuildProfile.h"
+#include "StreamingStats.h"
+
+const int CONFIDENCE_NONE = -32768; // Event without a verdict confidence
 
 // --- FORWARD DECLARATIONS ---
+struct PeakState;
 void validateResult();
-void triggerStop(String reason);
+byte envelopeVerdict(int peak, int threshold, int upper);
+void peakReset();
+void peakAdd(PeakState& s, byte mode, int value);
+void peakFeed(int value, int shadowValue);
+void blankAdd(unsigned long offset, int value, int shadowValue);
+void blankFinish(unsigned long duration);
+void blankFlush();
+int peakEstimate(const PeakState& s, byte mode);
+void shadowCompare();
+void shadowRestart();
+void warmSave();
+byte warmRestore();
+unsigned int configCrc();
+void triggerStop(byte code, int peak = -1, int confidence = CONFIDENCE_NONE);
+void reportEvent(byte code, int peak, int confidence);
+void noiseUpdate(int value);
+int verdictConfidence(int peak);
+void syncAutonomousEvents();
+void sendSyncLine();
+void autoLogSeal();
+void autoLogRestore(bool warm);
 void resetSystem();
 void processCommand(String cmd);
+void processSample(unsigned long currentMillis, int rawValue, int reading);
+void serviceInjection();
+void serviceRx();
+bool rxTextByte(char c);
+void remoteStop();
+void recordStopLatency();
+void sendTelemetry(unsigned long currentMillis, bool timestamped);
+void serviceStreams(unsigned long currentMillis);
+void sendEnvelopeRecord(unsigned long currentMillis);
+void endStamped(unsigned long ms);
+void thumbReset();
+void thumbAdd(int value);
+void envBegin();
+void envAdd(unsigned long offset, int value);
+void envFinish();
+void envRequest(unsigned long seq);
+void envList();
+void serviceEnvSend();
+void serviceReplies();
+long streamLoad(byte id, unsigned int period);
+bool subscribe(byte id, unsigned int period);
+void reportSubscriptions(byte only);
+long streamLoadTotal();
+long linkBudget(unsigned long baud);
+void setLinkBaud(unsigned long baud);
+int calToUm(int adc);
+int calToAdc(long um);
+bool calAddPoint(long adc, long um);
+void calApplyThresholds();
+int paramFind(const String& key);
+byte paramSize(byte type);
+bool paramSet(byte id, float value);
+void paramReport(byte id, bool full);
+void paramReject(int id);
+void paramChanged(byte id);
+void paramSave();
+bool paramLoad();
+void processParamFrame();
 
 // --- HARDWARE PIN DEFINITIONS ---
 const int PIN_SENSOR      = A0;  // Analog Height Sensor
@@ -17,21 +82,136 @@ int CFG_FLOOR_VALUE       = 100; // Floor ADC value (50-500 valid range)
 int CFG_CARD_THRESHOLD    = 150; // Below this = empty envelope (error)
 int CFG_CARD_UPPER_THRESHOLD = 800; // Above this = double card (error)
 bool CFG_REVERSE_SENSOR   = false; // Reverse sensor signal (1023 - ADC)
-bool CFG_SYSTEM_OVERRIDE  = false; // Bypass all error detection
-const long WATCHDOG_TIMEOUT = 2000; // Time in ms before stopping if no PC Ping
+bool CFG_SYSTEM_OVERRIDE  = false; // Bypass all error detection (not in LEAN builds)
+unsigned long CFG_WATCHDOG_TIMEOUT = 2000; // Time in ms before stopping if no PC Ping
+int CFG_SENSOR_MIN        = 50;   // Filtered values outside MIN..MAX stop the machine
+int CFG_SENSOR_MAX        = 1000;
+
+// --- CALIBRATION (ADC -> MICROMETRES) ---
+// Piecewise-linear table uploaded by the PC (CAL_CLEAR / CAL_ADD). Points
+// are in filtered ADC counts (after reversal) and must rise in both ADC
+// and thickness. Each segment stores its slope in Q8 fixed point, computed
+// once on upload, so conversion needs no division at runtime. Values
+// outside the table extrapolate along the first/last segment, clamped to
+// 0..CAL_MAX_UM (a steep last segment can reach far past an int).
+const int CAL_MAX_POINTS  = 16;
+const long CAL_MAX_UM     = 32767;
+const long CAL_MAX_SLOPE_Q8 = 2000000L; // Keeps slope * 1023 inside a long
+int calAdc[CAL_MAX_POINTS];
+int calUm[CAL_MAX_POINTS];
+long calSlopeQ8[CAL_MAX_POINTS - 1];
+int calCount              = 0;
+// Thresholds given in um (SET_THR_UM) are converted to ADC counts so the
+// per-sample comparison stays in raw counts; -1 = threshold set in ADC.
+long CFG_CARD_THRESHOLD_UM       = -1;
+long CFG_CARD_UPPER_THRESHOLD_UM = -1;
 
 // --- SIGNAL FILTERING ---
 // Exponential Moving Average factor (0.0 - 1.0). 
 // Lower = smoother but slower. Higher = responsive but noisier.
-const float FILTER_ALPHA  = 0.2; 
+float CFG_FILTER_ALPHA    = 0.2; 
 float filteredValue       = 0.0; 
 
 // --- DEBOUNCE VARIABLES ---
-const unsigned long DEBOUNCE_DELAY = 10; // ms to wait for stable signal
+unsigned long CFG_DEBOUNCE_DELAY = 10; // ms to wait for stable signal
 int envelopeState = HIGH;                // Current stable state (default HIGH/pullup)
 int lastFlickerableState = HIGH;         // Previous raw reading
 unsigned long lastDebounceTime = 0;
 
+// --- EVENTS & FAULT CODES ---
+// Every verdict or stop is reported through reportEvent() with one of
+// these codes: EVT:<name>[:peak[:confidence]] for passes, the same with
+// ERR: for faults. faultCode latches the fault that caused the current stop.
+enum EventCode {
+  EVENT_PASS,
+  EVENT_PASS_OVERRIDE,
+  EVENT_PASS_MARGINAL,
+  FAULT_WATCHDOG_TIMEOUT,    // First fault code
+  FAULT_SENSOR_OUT_OF_RANGE,
+  FAULT_EMPTY_ENVELOPE,
+  FAULT_DOUBLE_CARD,
+  FAULT_AUTONOMOUS_TIMEOUT,
+  FAULT_REMOTE_STOP,
+  EVENT_CODE_COUNT
+};
+const byte FAULT_NONE = EVENT_CODE_COUNT;
+const char EN_PASS[] PROGMEM          = "PASS";
+const char EN_PASS_OVERRIDE[] PROGMEM = "PASS_OVERRIDE";
+const char EN_PASS_MARGINAL[] PROGMEM = "PASS_MARGINAL";
+const char EN_WATCHDOG[] PROGMEM      = "WATCHDOG_TIMEOUT";
+const char EN_OUT_OF_RANGE[] PROGMEM  = "SENSOR_OUT_OF_RANGE";
+const char EN_EMPTY[] PROGMEM         = "EMPTY_ENVELOPE";
+const char EN_DOUBLE[] PROGMEM        = "DOUBLE_CARD";
+const char EN_AUTO_TIMEOUT[] PROGMEM  = "AUTONOMOUS_TIMEOUT";
+const char EN_REMOTE_STOP[] PROGMEM   = "REMOTE_STOP";
+const char* const EVENT_NAMES[EVENT_CODE_COUNT] PROGMEM = {
+  EN_PASS, EN_PASS_OVERRIDE, EN_PASS_MARGINAL, EN_WATCHDOG, EN_OUT_OF_RANGE,
+  EN_EMPTY, EN_DOUBLE, EN_AUTO_TIMEOUT, EN_REMOTE_STOP
+};
+byte faultCode = FAULT_NONE;
+
+inline const __FlashStringHelper* eventName(byte code) {
+  return (const __FlashStringHelper*)pgm_read_ptr(&EVENT_NAMES[code]);
+}
+
+// --- VERDICT CONFIDENCE ---
+// Envelope verdicts carry a confidence after the peak:
+//   EVT:PASS:<peak>:<confidence>
+// It is the distance from the peak to the nearest threshold in tenths of
+// the filtered floor noise (sigma), negative when the peak is outside the
+// band. Noise is estimated between envelopes as the mean absolute
+// deviation of the filtered value from a slow floor average (x1.25 for
+// sigma), both EMA with weight 1/64 in Q4 fixed point and clipped
+// against outliers; sigma is never taken below one count.
+// Passes within MARGINAL_BAND counts of either threshold are reported as
+// PASS_MARGINAL, so a drifting process shows before it stops the machine.
+const int NOISE_EMA_DIV          = 64;
+const int NOISE_CLIP             = 4;
+const int CONFIDENCE_MAX         = 9999;
+int CFG_MARGINAL_BAND            = 0;    // ADC counts, 0 = off
+long noiseFloorQ4                = -1;   // Slow floor average, -1 = not seeded
+long noiseMadQ4                  = 16;   // Mean absolute deviation, starts at 1 count
+
+// --- AUTONOMOUS MODE ---
+// With CFG_AUTONOMOUS set, losing the PC no longer stops the machine:
+// detection continues with the current configuration and verdicts are
+// buffered (newest AUTO_BUFFER_SIZE kept, counters are exact) instead of
+// printed. The next PING replays them as SYNC: lines, one per loop pass
+// (see PACED REPLIES). CFG_AUTONOMOUS_MAX_S bounds how long the machine
+// may run unattended (0 = no limit).
+// The PC reconnecting pulses DTR, which resets the board, so the buffer
+// and its counters are kept in .noinit with their own magic and CRC-16,
+// resealed on every change (not every WARM_SAVE_MS like the warm
+// snapshot). setup() keeps them after a warm restart and moves the times
+// onto the new millis() clock; the reset itself is not counted. They are
+// cleared only once SYNC:END is sent: a reset before that replays them.
+bool CFG_AUTONOMOUS             = false;
+unsigned long CFG_AUTONOMOUS_MAX_S = 0;
+const byte AUTO_BUFFER_SIZE     = 16;
+struct BufferedEvent {
+  unsigned long ms;
+  int peak;
+  byte code;
+};
+struct AutonomousLog {
+  unsigned int magic;
+  bool active;
+  bool pending;                   // Buffered since active was set, SYNC:END not sent yet
+  unsigned long since;
+  unsigned long passCount;
+  unsigned long faultCount;
+  unsigned long dropped;
+  byte head;                      // Next slot to write
+  byte count;
+  BufferedEvent events[AUTO_BUFFER_SIZE];
+  unsigned int crc;               // Over everything before it
+};
+const unsigned int AUTO_LOG_MAGIC = 0xA17C;
+AutonomousLog autoLog __attribute__((section(".noinit")));
+const byte AUTO_SYNC_IDLE       = 0xFF;
+byte autoSyncNext               = AUTO_SYNC_IDLE; // 0 = BEGIN, 1..count = EVT, count + 1 = END
+unsigned long autoSyncMs        = 0;  // millis() of the PING, SYNC:EVT ages count from it
+
 // --- STATE MACHINE ---
 enum SystemState {
   STATE_IDLE,
@@ -43,15 +223,598 @@ SystemState currentState = STATE_IDLE;
 // --- VARIABLES ---
 unsigned long lastTelemetryTime = 0;
 unsigned long lastPingReceived  = 0;
-int maxPeakInWindow             = 0;
 bool machineStopActive          = false;
 
+int lastRawValue                = 0;     // Latest raw sample (after reversal)
+int sensorValue                 = 0;     // Latest filtered value (int)
+bool isEnvelopePresent          = false; // Latest debounced envelope state
+
 // Telemetry Rate
 const int TELEMETRY_INTERVAL    = 100; // Send data every 100ms (10Hz)
 
+// --- CHANGE-DRIVEN TELEMETRY ---
+// In TELEMETRY_CHANGE mode a timestamped T: record is sent only when the
+// filtered value moves more than the deadband away from the last value
+// sent, when the envelope or stop state changes, or when the keepalive
+// interval has passed. A record that does not fit in the TX buffer is
+// deferred to a later loop instead of blocking the detector.
+// It pays off on idle machines, about 1 KB/min against 6.6 KB/min of D:
+// lines (test/host/test_telemetry_rate.cpp). Card edges are sent at loop
+// rate, though, so a busy machine costs ten times the D: stream or more;
+// a wider deadband brings that down.
+enum TelemetryMode {
+  TELEMETRY_PERIODIC,
+  TELEMETRY_CHANGE
+};
+byte CFG_TELEMETRY_MODE          = TELEMETRY_PERIODIC;
+int CFG_TELEMETRY_DEADBAND       = 2;    // ADC counts
+unsigned long CFG_TELEMETRY_KEEPALIVE = 1000; // ms
+const int TELEMETRY_RECORD_MAX   = 32;   // Worst-case T: record length
+int lastSentValue                = -1;
+bool lastSentEnvelope            = false;
+bool lastSentStop                = false;
+
+// --- TELEMETRY SUBSCRIPTIONS ---
+// Independent output streams, switched with SUBSCRIBE:<name>,<period>.
+// Period 0 turns a stream off. Its meaning depends on the stream:
+//   RAW    R:<raw>                          every Nth sample
+//   FILT   D:/T: lines (see above)          ms between D: lines
+//   AGG    A:<min>,<max>,<mean>,<samples>   ms per aggregation window
+//   EVT    EVT: verdict lines               1 = on (ERR: lines are always sent)
+//   HEALTH H:<uptime s>,<samples/s>,<ping age ms>,<state>,<stop>,<sigma x10>   ms
+//   ENV    E:<seq>,<duration ms>,<peak>,<samples>[,<thumbnail>]   every Nth envelope
+//   SHADOW SH: shadow comparison (see SHADOW DETECTOR)  every Nth envelope,
+//          disagreements always
+// A subscription is refused when the sum of all streams would exceed
+// LINK_BUDGET_PERCENT of the link, computed from the current baud rate.
+enum StreamId {
+  STREAM_RAW,
+  STREAM_FILT,
+  STREAM_AGG,
+  STREAM_EVT,
+  STREAM_HEALTH,
+  STREAM_ENV,
+  STREAM_SHADOW,
+  STREAM_COUNT
+};
+const char SN_RAW[] PROGMEM       = "RAW";
+const char SN_FILT[] PROGMEM      = "FILT";
+const char SN_AGG[] PROGMEM       = "AGG";
+const char SN_EVT[] PROGMEM       = "EVT";
+const char SN_HEALTH[] PROGMEM    = "HEALTH";
+const char SN_ENV[] PROGMEM       = "ENV";
+const char SN_SHADOW[] PROGMEM    = "SHADOW";
+const char* const STREAM_NAMES[STREAM_COUNT] PROGMEM = {
+  SN_RAW, SN_FILT, SN_AGG, SN_EVT, SN_HEALTH, SN_ENV, SN_SHADOW
+};
+const byte STREAM_RECORD_BYTES[STREAM_COUNT] = {8, 32, 28, 34, 46, 32, 56}; // Worst case per record
+const int ENVELOPE_RATE_MAX      = 10;  // Envelopes/s assumed for EVT/ENV/SHADOW budget
+const int LINK_BUDGET_PERCENT    = 80;
+unsigned long linkBaud           = 115200;
+unsigned int streamPeriod[STREAM_COUNT] = {0, TELEMETRY_INTERVAL, 0, 1, 0, 0, 0};
+unsigned long streamLast[STREAM_COUNT];
+unsigned int rawDecimation       = 0;
+WindowStats<int, long> agg      = {};
+unsigned long samplesThisSecond  = 0;
+unsigned long samplesPerSecond   = 5000; // Estimate until the first measurement
+unsigned long rateWindowStart    = 0;
+
+// --- EVENT TIMESTAMPS ---
+// With EVENT_STAMPS = 1, EVT:/ERR: lines, E: records and SYNC:BEGIN end
+// with " @<millis>", the device time of the event. TIME? answers
+// TIME:<millis>; from its round trip the PC maps device time onto its own
+// clock (pc_software/timeline.py). T: records carry millis already.
+const byte STAMP_BYTES           = 12;   // " @4294967295"
+byte CFG_EVENT_STAMPS            = 0;
+
+// --- LINK BAUD NEGOTIATION ---
+// The link always boots at 115200 (the board resets when the port opens).
+//   PC: SET_BAUD:<rate>     -> device: BAUD:SWITCH,<rate>, then switches
+//   PC switches too, sends BAUD_CHECK at the new rate -> BAUD:OK,<rate>
+// Without a BAUD_CHECK within BAUD_CONFIRM_TIMEOUT the device returns to
+// the previous rate and prints BAUD:FALLBACK,<rate> there.
+// Rates above 115200 are exact dividers of 16 MHz (0% UART error).
+const unsigned long BAUD_RATES[] = {9600, 57600, 115200, 250000, 500000, 1000000, 2000000};
+const byte BAUD_RATE_COUNT       = sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]);
+const unsigned int BAUD_CONFIRM_TIMEOUT = 1000; // ms
+unsigned long baudFallback       = 0; // Rate to return to while unconfirmed, 0 = none
+unsigned long baudSwitchSince    = 0;
+
+// --- PER-ENVELOPE TRACKING ---
+unsigned long envelopeSeq        = 0;
+unsigned long envelopeStartMs    = 0;
+unsigned long envelopeSamples    = 0;
+
+// --- ENVELOPE THUMBNAIL ---
+// With THUMB_POINTS set (16 or 32, 0 = off) the E: record ends with the
+// envelope's shape: min and max of the filtered value over equal slices
+// of the envelope, each as two hex digits of ADC/4, min first.
+// The length is unknown while the envelope passes, so samples fill
+// buckets of thumbWidth samples; when all buckets are full, neighbours
+// are merged pairwise and the width doubles. At the end N/2..N buckets
+// cover the whole envelope and are stretched to N points.
+const byte THUMB_MAX             = 32;
+byte CFG_THUMB_POINTS            = 0;
+byte thumbMin[THUMB_MAX];
+byte thumbMax[THUMB_MAX];
+byte thumbCount                  = 0;    // Completed buckets
+unsigned long thumbWidth         = 1;    // Samples per bucket
+unsigned long thumbFill          = 0;    // Samples in the open bucket
+
+// --- ENVELOPE ARCHIVE ---
+// The last few envelopes are kept in RAM so the PC can fetch the trace of
+// one it was not streaming, e.g. the envelope that caused a stop.
+// While MEASURING, samples are reduced to one point per millisecond (the
+// highest filtered value in it) and each point is stored as the zigzag
+// delta to the previous one: 1 byte for steps up to +-63, else 2 bytes
+// (7 bits each, high bit = another byte follows). Records are packed in
+// a ring of ENV_ARCHIVE_BYTES (all that is left of the 2 KB of an Uno):
+//   [seq lo][seq hi][record bytes][points][flags] deltas...
+// The oldest records are dropped to make room. An envelope that does not
+// fit on its own is cut short and flagged as truncated.
+// GET_ENV:<seq> is answered with ENV:<seq>,BEGIN,<points>,<truncated>,
+// then from loop() one line at a time, only when the TX buffer has room,
+//   ENV:<seq>,<index of first point>,<value>,...   ENV_SEND_POINTS per line
+// and ENV:<seq>,END. ENV:<seq>,NONE = not kept, ENV:<seq>,LOST = dropped
+// for a new envelope during the transfer. ENV? lists the kept envelopes.
+const byte ENV_ARCHIVE_BYTES     = 192;  // < 256, indexes are bytes
+const byte ENV_HEADER_BYTES      = 5;
+const byte ENV_TRUNCATED         = 0x01;
+const byte ENV_SEND_POINTS       = 8;
+const byte ENV_SEND_LINE_MAX     = 56;   // "ENV:65535,255" + 8 x ",1023" + CRLF
+byte envArchive[ENV_ARCHIVE_BYTES];
+byte envTail                     = 0;    // Oldest record
+byte envUsed                     = 0;    // Bytes in use, open record included
+bool envOpen                     = false;
+byte envOpenAt                   = 0;    // Record of the current envelope
+int envLastValue                 = 0;    // Previous stored point
+unsigned long envBucketMs        = 0;
+int envBucketMax                 = -1;   // -1 = no sample in this millisecond
+bool envSending                  = false;
+bool envSendLost                 = false;
+unsigned long envSendSeq         = 0;
+byte envSendRecord               = 0;    // Record being sent
+byte envSendAt                   = 0;    // Next data byte
+byte envSendLeft                 = 0;    // Data bytes still to send
+byte envSendIndex                = 0;    // Next point
+int envSendValue                 = 0;
+
+// --- PEAK ESTIMATOR ---
+// The envelope peak handed to validateResult() (PEAK_MODE parameter):
+//   MAX      highest filtered sample (original behaviour)
+//   TOPK     mean of the PEAK_TOPK highest samples
+//   PLATEAU  mean of the longest run of samples at or above
+//            PEAK_PLATEAU_PCT % of the running maximum
+// MAX follows single noise spikes; the other two need several samples
+// to move. All are computed while the envelope passes, in fixed memory.
+// PLATEAU restarts a run when the maximum rises past its lowest sample,
+// so it is exact for one dominant plateau, approximate otherwise.
+// E: records still report the plain maximum. When blanking leaves none
+// of an envelope (a short one, or lead + trail covering it), the envelope
+// is judged on its highest unblanked sample instead of on no samples.
+enum PeakMode {
+  PEAK_MAX,
+  PEAK_TOPK,
+  PEAK_PLATEAU
+};
+const byte PEAK_TOPK_MAX         = 16;
+byte CFG_PEAK_MODE               = PEAK_MAX;
+byte CFG_PEAK_TOPK               = 8;
+byte CFG_PEAK_PLATEAU_PCT        = 90;
+
+// Estimator state for one envelope; the shadow detector has its own.
+struct PeakState {
+  int maximum;                 // Highest value, also the PEAK_MAX estimate
+  int top[PEAK_TOPK_MAX];      // Highest samples, descending
+  byte topCount;
+  unsigned int runLen;         // Current plateau run
+  long runSum;
+  int runMin;
+  unsigned int bestLen;        // Longest finished run
+  long bestSum;
+  int bestMin;
+  bool fed;                    // Any value fed, after blanking
+  int unblanked;               // Highest sample, before blanking
+};
+PeakState peakMain;
+
+// --- BLANKING ---
+// Leading and trailing part of each envelope left out of the peak and its
+// features: flaps and the envelope edge itself read as height spikes.
+// BLANK_UNIT picks ms or percent of the envelope duration (max 50 %).
+// Leading percent is taken of the previous envelope, since the current
+// one's length is unknown while it starts.
+// Trailing blanking needs hindsight, so samples wait in a delay line of
+// 1 ms buckets (maximum per bucket) and are released to the estimator
+// only once they are older than the trailing window. The estimator then
+// sees one value per ms instead of every sample. The delay line limits
+// the trailing window to BLANK_DELAY_MS - 1 ms: that is the BLANK_TRAIL
+// maximum in either unit, and a percent window is still cut to it on long
+// envelopes. BLANK? reports
+// the windows the last envelope got. With no trailing blanking samples go
+// straight through.
+enum BlankUnit {
+  BLANK_MS,
+  BLANK_PERCENT
+};
+const byte BLANK_DELAY_MS        = 32;
+const byte BLANK_PERCENT_MAX     = 50;
+unsigned int CFG_BLANK_LEAD      = 0;
+unsigned int CFG_BLANK_TRAIL     = 0;
+byte CFG_BLANK_UNIT              = BLANK_MS;
+int blankSlot[BLANK_DELAY_MS];           // Bucket max by ms offset % size, -1 = empty
+unsigned long blankNext          = 0;    // Oldest ms offset not yet released
+unsigned long blankLeadMs        = 0;    // Leading window of the current envelope
+unsigned long blankTrailMs       = 0;    // Trailing window of the last finished envelope
+unsigned long lastEnvelopeMs     = 0;    // Duration of the previous envelope
+
+// --- SHADOW DETECTOR ---
+// A second detector configuration judged on the same samples, so new
+// thresholds, filter or peak mode can be tried on a running machine.
+// It shares the envelope window, debounce and blanking with the primary
+// and has its own EMA filter, thresholds and peak mode (PEAK_TOPK and
+// PEAK_PLATEAU_PCT are shared). It never drives PIN_ENABLE_OUT and
+// never reports EVT:/ERR: lines.
+// Both verdicts are reduced to PASS, EMPTY_ENVELOPE or DOUBLE_CARD (no
+// override, no marginal band) and compared once per envelope:
+//   SHADOW?  SHADOW:<envelopes>,<agree>,<disagree>,<shadow only stops>,<missed stops>
+//   stream   SH:<seq>,<verdict>,<peak>,<shadow verdict>,<shadow peak>
+// Shadow-only stops are envelopes the primary passed and the shadow would
+// have stopped on; missed stops the other way round. Changing a SHADOW_*
+// parameter restarts the counters, and an envelope already in progress
+// is not compared.
+bool CFG_SHADOW                  = false;
+int CFG_SHADOW_THR               = 150;
+int CFG_SHADOW_THR_UPPER         = 800;
+float CFG_SHADOW_ALPHA           = 0.2;
+byte CFG_SHADOW_PEAK_MODE        = PEAK_MAX;
+float shadowFiltered             = 0.0;
+PeakState peakShadow;
+int blankShadowSlot[BLANK_DELAY_MS];     // Same buckets as blankSlot, shadow values
+bool shadowEnvelope              = false; // Current envelope started with the shadow on
+unsigned long shadowEnvelopes    = 0;
+unsigned long shadowAgree        = 0;
+unsigned long shadowOnlyStops    = 0;
+unsigned long shadowMissedStops  = 0;
+
+// --- WARM RESTART ---
+// A reset that keeps the RAM powered (brown-out, watchdog, reset pin or
+// the DTR pulse of a reconnecting PC) must not clear a latched stop or
+// make the detector learn its floor again. The state below is copied to
+// a .noinit snapshot, which the C runtime leaves alone, on every state
+// change and every WARM_SAVE_MS. setup() restores it when magic and
+// CRC-16 match, before PIN_ENABLE_OUT is driven, and reports
+//   WARM:<state>,<fault name or NONE>,<envelope seq>,<RESTORED or SETTINGS_CHANGED>
+// Power-on RAM fails the check, so that is a cold start as before.
+// The detector state is only valid for the settings it was built with,
+// so the snapshot carries a CRC of them (configCrc(): the persistent
+// parameters and the calibration). setup() loads the parameters first;
+// if the CRC differs only the fault latch and envelope count come back
+// (SETTINGS_CHANGED) and the detector starts afresh as on a cold start.
+// millis() restarts at 0, so times are stored as ages (savedMs lets the
+// autonomous buffer do the same). Not kept: the blanking delay line, the
+// shadow's current envelope, subscriptions and the envelope archive.
+// Injected replays are not saved.
+struct WarmSnapshot {
+  unsigned int magic;
+  byte state;
+  byte faultCode;
+  byte envelopeState;
+  float filteredValue;
+  float shadowFiltered;
+  long noiseFloorQ4;
+  long noiseMadQ4;
+  unsigned long envelopeSeq;
+  unsigned long envelopeAgeMs;     // Since the current envelope started
+  unsigned long envelopeSamples;
+  unsigned long lastEnvelopeMs;
+  unsigned long blankNext;
+  unsigned long blankLeadMs;
+  PeakState peak;
+  unsigned long shadowEnvelopes;
+  unsigned long shadowAgree;
+  unsigned long shadowOnlyStops;
+  unsigned long shadowMissedStops;
+  unsigned int configCrc;          // Settings the state above belongs to
+  unsigned long savedMs;           // millis() when saved
+  unsigned int crc;                // Over everything before it
+};
+const unsigned int WARM_MAGIC    = 0x5A3C;
+const unsigned long WARM_SAVE_MS = 10;
+WarmSnapshot warmSnapshot __attribute__((section(".noinit")));
+unsigned long warmSavedMs        = 0;
+unsigned int warmConfigCrc       = 0; // configCrc() of the settings in effect
+enum WarmRestore {
+  WARM_COLD,                          // Nothing restored
+  WARM_LATCH,                         // Settings changed: fault latch only
+  WARM_FULL
+};
+
+// --- SAMPLE INJECTION (HARDWARE-IN-THE-LOOP) ---
+// In injection mode the sensor and envelope inputs come from the PC as
+// binary frames instead of analogRead/digitalRead. Each frame is
+// [INJECT_SYNC][lo][hi], a little-endian 16-bit word:
+//   bit 15 clear: bits 0-9 = ADC sample, bit 10 = envelope present
+//   bit 15 set:   control word (INJECT_CTRL_*)
+// Every sample frame advances a virtual clock by injectSampleMs, so the
+// debounce timing matches the recorded trace, not the link speed.
+// Verdicts still drive PIN_ENABLE_OUT - use on a bench, not a live machine.
+// Range faults latch until an INJECT_CTRL_RESUME frame arrives.
+// A sample takes longer to process than a frame takes on a fast link, so
+// the PC paces itself: every INJECT_ACK_FRAMES samples the device prints
+// INJ:<frames>, and the PC keeps at most INJECT_WINDOW_FRAMES (see
+// trace_replay.py) unacknowledged frames in flight, less than the 64-byte
+// RX buffer holds.
+const byte INJECT_SYNC          = 0xA5;
+const byte INJECT_ACK_FRAMES    = 8;
+const unsigned int INJECT_CTRL_END    = 0x8000; // Leave injection mode
+const unsigned int INJECT_CTRL_RESUME = 0x8001; // Same as RESUME command
+bool injectMode                 = false;
+bool injectAutoResume           = false; // Clear faults right after reporting them
+unsigned int injectSampleMs     = 1;
+unsigned long injectClock       = 0;
+unsigned long injectFrames      = 0;
+byte injectFrame[3];
+byte injectFramePos             = 0;
+
+// --- SERIAL RX / REMOTE STOP ---
+// Text commands are assembled byte by byte without blocking, so every
+// received byte is looked at within one loop pass. REMOTE_STOP_BYTE (ASCII
+// CAN, never part of a command, escaped in parameter frames) stops the
+// machine as soon as it is seen, even in the middle of a line. In
+// injection mode it is honoured between frames. It works with override
+// enabled and is not a heartbeat.
+// The Arduino core owns the USART RX interrupt, so this is the nearest
+// point to it: latency is bounded by one loop pass, not by a line timeout.
+const byte REMOTE_STOP_BYTE     = 0x18;
+const byte RX_LINE_MAX          = 48;    // Longest command, longer lines are dropped
+char rxLine[RX_LINE_MAX + 1];
+byte rxLineLen                  = 0;
+bool rxLineOverflow             = false;
+unsigned long rxPollUs          = 0;     // micros() of the previous RX poll
+
+// --- LOOP STATISTICS ---
+// Loop period and stop latency are kept in every profile, so the build
+// that runs the machine can be measured (STATS). Stop latency is measured
+// from the start of the sample that caused the stop (before analogRead)
+// to PIN_ENABLE_OUT going LOW.
+unsigned long statSampleUs      = 0; // micros() when the current sample started
+unsigned long statLoopStartUs   = 0;
+unsigned long statLoopCount     = 0;
+unsigned long statLoopSumUs     = 0;
+unsigned long statLoopMaxUs     = 0;
+unsigned long statStopLastUs    = 0;
+unsigned long statStopMaxUs     = 0;
+// Remote stop: from the previous RX poll (the byte arrived after it) to
+// PIN_ENABLE_OUT going LOW, an upper bound on the on-device latency.
+unsigned long statRemoteLastUs  = 0;
+unsigned long statRemoteMaxUs   = 0;
+// Detector cost (DIAGNOSTIC builds, FEATURE_STATS): time spent in
+// processSample() per sample, without the ADC read; verdict lines printed
+// from it count towards the maximum.
+// Comparing it with SHADOW=0 and 1 gives the cost of the shadow detector.
+unsigned long statDetectCount   = 0;
+unsigned long statDetectSumUs   = 0;
+unsigned long statDetectMaxUs   = 0;
+
+// Override is compiled out of LEAN builds, so this folds to false there.
+inline bool overrideActive() {
+  return FEATURE_OVERRIDE && CFG_SYSTEM_OVERRIDE;
+}
+
+inline bool shadowActive() {
+  return FEATURE_SHADOW && CFG_SHADOW;
+}
+
+// --- PARAMETER REGISTRY ---
+// Every tunable is described once in PARAMS (flash). GET/SET/LIST and the
+// binary parameter frame work on this table, so adding a parameter needs
+// no parsing code. The id is the table index, so lookups by id are O(1).
+// Parameters flagged persist are written to EEPROM by SAVE and restored
+// at boot; the PC still uploads its own configuration on connect.
+// min/max are what the firmware can honour: a SET outside them is refused
+// with ERR:REJECTED, never clamped silently.
+enum ParamType {
+  PT_BYTE,  // byte or bool
+  PT_INT,
+  PT_UINT,
+  PT_ULONG,
+  PT_FLOAT
+};
+
+enum ParamId {
+  P_THR,
+  P_THR_UPPER,
+  P_FLOOR,
+  P_REVERSE,
+  P_OVERRIDE,
+  P_FILTER_ALPHA,
+  P_DEBOUNCE_MS,
+  P_WATCHDOG_MS,
+  P_SENSOR_MIN,
+  P_SENSOR_MAX,
+  P_TELEM_MODE,
+  P_DEADBAND,
+  P_KEEPALIVE_MS,
+  P_AUTONOMOUS,
+  P_AUTONOMOUS_MAX_S,
+  P_PEAK_MODE,
+  P_PEAK_TOPK,
+  P_PEAK_PLATEAU_PCT,
+  P_BLANK_LEAD,
+  P_BLANK_TRAIL,
+  P_BLANK_UNIT,
+  P_MARGINAL_BAND,
+  P_SHADOW,
+  P_SHADOW_THR,
+  P_SHADOW_THR_UPPER,
+  P_SHADOW_ALPHA,
+  P_SHADOW_PEAK_MODE,
+  P_THUMB_POINTS,
+  P_EVENT_STAMPS,
+  PARAM_COUNT
+};
+
+struct ParamDesc {
+  const char* name;  // Flash string
+  const char* unit;  // Flash string
+  byte type;
+  bool persist;
+  float minVal;
+  float maxVal;
+  void* var;
+};
+float paramGet(const ParamDesc& d);
+
+const char PN_THR[] PROGMEM          = "THR";
+const char PN_THR_UPPER[] PROGMEM    = "THR_UPPER";
+const char PN_FLOOR[] PROGMEM        = "FLOOR";
+const char PN_REVERSE[] PROGMEM      = "REVERSE";
+const char PN_OVERRIDE[] PROGMEM     = "OVERRIDE";
+const char PN_FILTER_ALPHA[] PROGMEM = "FILTER_ALPHA";
+const char PN_DEBOUNCE_MS[] PROGMEM  = "DEBOUNCE_MS";
+const char PN_WATCHDOG_MS[] PROGMEM  = "WATCHDOG_MS";
+const char PN_SENSOR_MIN[] PROGMEM   = "SENSOR_MIN";
+const char PN_SENSOR_MAX[] PROGMEM   = "SENSOR_MAX";
+const char PN_TELEM_MODE[] PROGMEM   = "TELEM_MODE";
+const char PN_DEADBAND[] PROGMEM     = "DEADBAND";
+const char PN_KEEPALIVE_MS[] PROGMEM = "KEEPALIVE_MS";
+const char PN_AUTONOMOUS[] PROGMEM   = "AUTONOMOUS";
+const char PN_AUTO_MAX_S[] PROGMEM   = "AUTONOMOUS_MAX_S";
+const char PN_PEAK_MODE[] PROGMEM    = "PEAK_MODE";
+const char PN_PEAK_TOPK[] PROGMEM    = "PEAK_TOPK";
+const char PN_PEAK_PLAT[] PROGMEM    = "PEAK_PLATEAU_PCT";
+const char PN_BLANK_LEAD[] PROGMEM   = "BLANK_LEAD";
+const char PN_BLANK_TRAIL[] PROGMEM  = "BLANK_TRAIL";
+const char PN_BLANK_UNIT[] PROGMEM   = "BLANK_UNIT";
+const char PN_MARGINAL[] PROGMEM     = "MARGINAL_BAND";
+const char PN_SHADOW[] PROGMEM       = "SHADOW";
+const char PN_SHADOW_THR[] PROGMEM   = "SHADOW_THR";
+const char PN_SHADOW_UPPER[] PROGMEM = "SHADOW_THR_UPPER";
+const char PN_SHADOW_ALPHA[] PROGMEM = "SHADOW_ALPHA";
+const char PN_SHADOW_MODE[] PROGMEM  = "SHADOW_PEAK_MODE";
+const char PN_THUMB_POINTS[] PROGMEM = "THUMB_POINTS";
+const char PN_EVENT_STAMPS[] PROGMEM = "EVENT_STAMPS";
+const char PU_NONE[] PROGMEM         = "";
+const char PU_ADC[] PROGMEM          = "adc";
+const char PU_MS[] PROGMEM           = "ms";
+const char PU_S[] PROGMEM            = "s";
+const char PU_PCT[] PROGMEM          = "%";
+
+const ParamDesc PARAMS[PARAM_COUNT] PROGMEM = {
+  {PN_THR,          PU_ADC,  PT_INT,   true,  1,    1023,  &CFG_CARD_THRESHOLD},
+  {PN_THR_UPPER,    PU_ADC,  PT_INT,   true,  1,    1023,  &CFG_CARD_UPPER_THRESHOLD},
+  {PN_FLOOR,        PU_ADC,  PT_INT,   true,  0,    1023,  &CFG_FLOOR_VALUE},
+  {PN_REVERSE,      PU_NONE, PT_BYTE,  true,  0,    1,     &CFG_REVERSE_SENSOR},
+  {PN_OVERRIDE,     PU_NONE, PT_BYTE,  false, 0,    1,     &CFG_SYSTEM_OVERRIDE},
+  {PN_FILTER_ALPHA, PU_NONE, PT_FLOAT, true,  0.01, 1.0,   &CFG_FILTER_ALPHA},
+  {PN_DEBOUNCE_MS,  PU_MS,   PT_ULONG, true,  0,    1000,  &CFG_DEBOUNCE_DELAY},
+  {PN_WATCHDOG_MS,  PU_MS,   PT_ULONG, true,  100,  60000, &CFG_WATCHDOG_TIMEOUT},
+  {PN_SENSOR_MIN,   PU_ADC,  PT_INT,   true,  0,    1023,  &CFG_SENSOR_MIN},
+  {PN_SENSOR_MAX,   PU_ADC,  PT_INT,   true,  0,    1023,  &CFG_SENSOR_MAX},
+  {PN_TELEM_MODE,   PU_NONE, PT_BYTE,  false, 0,    1,     &CFG_TELEMETRY_MODE},
+  {PN_DEADBAND,     PU_ADC,  PT_INT,   false, 0,    1023,  &CFG_TELEMETRY_DEADBAND},
+  {PN_KEEPALIVE_MS, PU_MS,   PT_ULONG, false, TELEMETRY_INTERVAL, 60000, &CFG_TELEMETRY_KEEPALIVE},
+  {PN_AUTONOMOUS,   PU_NONE, PT_BYTE,  true,  0,    1,     &CFG_AUTONOMOUS},
+  {PN_AUTO_MAX_S,   PU_S,    PT_ULONG, true,  0,    86400, &CFG_AUTONOMOUS_MAX_S},
+  {PN_PEAK_MODE,    PU_NONE, PT_BYTE,  true,  0,    2,     &CFG_PEAK_MODE},
+  {PN_PEAK_TOPK,    PU_NONE, PT_BYTE,  true,  1,    PEAK_TOPK_MAX, &CFG_PEAK_TOPK},
+  {PN_PEAK_PLAT,    PU_PCT,  PT_BYTE,  true,  50,   100,   &CFG_PEAK_PLATEAU_PCT},
+  {PN_BLANK_LEAD,   PU_NONE, PT_UINT,  true,  0,    1000,  &CFG_BLANK_LEAD},
+  {PN_BLANK_TRAIL,  PU_NONE, PT_UINT,  true,  0,    BLANK_DELAY_MS - 1, &CFG_BLANK_TRAIL},
+  {PN_BLANK_UNIT,   PU_NONE, PT_BYTE,  true,  0,    1,     &CFG_BLANK_UNIT},
+  {PN_MARGINAL,     PU_ADC,  PT_INT,   true,  0,    500,   &CFG_MARGINAL_BAND},
+  {PN_SHADOW,       PU_NONE, PT_BYTE,  true,  0,    1,     &CFG_SHADOW},
+  {PN_SHADOW_THR,   PU_ADC,  PT_INT,   true,  1,    1023,  &CFG_SHADOW_THR},
+  {PN_SHADOW_UPPER, PU_ADC,  PT_INT,   true,  1,    1023,  &CFG_SHADOW_THR_UPPER},
+  {PN_SHADOW_ALPHA, PU_NONE, PT_FLOAT, true,  0.01, 1.0,   &CFG_SHADOW_ALPHA},
+  {PN_SHADOW_MODE,  PU_NONE, PT_BYTE,  true,  0,    2,     &CFG_SHADOW_PEAK_MODE},
+  {PN_THUMB_POINTS, PU_NONE, PT_BYTE,  true,  0,    THUMB_MAX, &CFG_THUMB_POINTS},
+  {PN_EVENT_STAMPS, PU_NONE, PT_BYTE,  false, 0,    1,     &CFG_EVENT_STAMPS},
+};
+
+// Older single-purpose commands, now thin aliases for SET. Their MSG:
+// replies are kept exactly as before for existing hosts: "<reply><value>",
+// or "<reply><on|off>" for switches, which take 1 = on, anything else = off.
+struct LegacyCommand {
+  const char* prefix;  // Flash strings
+  byte id;
+  const char* reply;
+  const char* on;      // nullptr for numeric parameters
+  const char* off;
+};
+const char LC_THR[] PROGMEM          = "SET_THR:";
+const char LC_THR_UPPER[] PROGMEM    = "SET_THR_UPPER:";
+const char LC_FLOOR[] PROGMEM        = "SET_FLOOR:";
+const char LC_REVERSE[] PROGMEM      = "SET_REVERSE:";
+const char LC_OVERRIDE[] PROGMEM     = "SET_OVERRIDE:";
+const char LC_TELEM_MODE[] PROGMEM   = "SET_TELEM_MODE:";
+const char LC_DEADBAND[] PROGMEM     = "SET_DEADBAND:";
+const char LC_KEEPALIVE[] PROGMEM    = "SET_KEEPALIVE:";
+const char LR_THR[] PROGMEM          = "MSG:Card Threshold Set to ";
+const char LR_THR_UPPER[] PROGMEM    = "MSG:Card Upper Threshold Set to ";
+const char LR_FLOOR[] PROGMEM        = "MSG:Floor Value Set to ";
+const char LR_REVERSE[] PROGMEM      = "MSG:Reverse Sensor ";
+const char LR_OVERRIDE[] PROGMEM     = "MSG:System Override ";
+const char LR_TELEM_MODE[] PROGMEM   = "MSG:Telemetry Mode ";
+const char LR_DEADBAND[] PROGMEM     = "MSG:Telemetry Deadband Set to ";
+const char LR_KEEPALIVE[] PROGMEM    = "MSG:Telemetry Keepalive Set to ";
+const char LS_ENABLED[] PROGMEM      = "Enabled";
+const char LS_DISABLED[] PROGMEM     = "Disabled";
+const char LS_BYPASSED[] PROGMEM     = "ENABLED - Safety bypassed!";
+const char LS_CHANGE[] PROGMEM       = "Change";
+const char LS_PERIODIC[] PROGMEM     = "Periodic";
+const LegacyCommand LEGACY_COMMANDS[] PROGMEM = {
+  {LC_THR,        P_THR,          LR_THR,        nullptr,     nullptr},
+  {LC_THR_UPPER,  P_THR_UPPER,    LR_THR_UPPER,  nullptr,     nullptr},
+  {LC_FLOOR,      P_FLOOR,        LR_FLOOR,      nullptr,     nullptr},
+  {LC_REVERSE,    P_REVERSE,      LR_REVERSE,    LS_ENABLED,  LS_DISABLED},
+  {LC_OVERRIDE,   P_OVERRIDE,     LR_OVERRIDE,   LS_BYPASSED, LS_DISABLED},
+  {LC_TELEM_MODE, P_TELEM_MODE,   LR_TELEM_MODE, LS_CHANGE,   LS_PERIODIC},
+  {LC_DEADBAND,   P_DEADBAND,     LR_DEADBAND,   nullptr,     nullptr},
+  {LC_KEEPALIVE,  P_KEEPALIVE_MS, LR_KEEPALIVE,  nullptr,     nullptr},
+};
+
+// Binary parameter frame: [PARAM_FRAME_SYNC][op][id][value, 4 bytes LE]
+// Value is a signed 32-bit integer, or IEEE float bits for PT_FLOAT.
+// Replies are the same PRM: lines as the text commands. Frames are
+// collected byte by byte as they arrive, so the stop byte behind a
+// truncated frame is seen at once. REMOTE_STOP_BYTE on the wire is always
+// a stop, so after the sync byte the sender escapes it and
+// PARAM_FRAME_ESC as [PARAM_FRAME_ESC][byte ^ PARAM_FRAME_ESC_XOR]; any id
+// and value can be sent (param_frame.py encodes frames this way).
+// PARAM_FRAME_LEN counts decoded bytes.
+const byte PARAM_FRAME_SYNC = 0x02;
+const byte PARAM_FRAME_ESC  = 0x1B;
+const byte PARAM_FRAME_ESC_XOR = 0x20;
+const byte PARAM_FRAME_LEN  = 7;
+const byte PARAM_OP_GET     = 0x01;
+const byte PARAM_OP_SET     = 0x02;
+const unsigned long PARAM_FRAME_TIMEOUT = 100; // ms before a partial frame is dropped
+byte paramFrame[PARAM_FRAME_LEN];
+byte paramFramePos            = 0; // Bytes of the frame received so far
+bool paramFrameEscaped        = false; // Previous frame byte was PARAM_FRAME_ESC
+unsigned long paramFrameSince = 0;
+
+// EEPROM layout: [magic:2][value slot:4 x PARAM_COUNT][checksum:1]
+const unsigned int EEPROM_PARAMS_MAGIC = 0xCA11;
+const int EEPROM_PARAMS_ADDR = 0;
+
+// --- PACED REPLIES ---
+// Multi-line replies (SYNC, LIST, SUBSCRIBE?, the SUB: lines after
+// SUBSCRIBE:) are not written in one go: once the 64-byte TX buffer is
+// full every print blocks, and LIST alone (~1 KB) would hold loop() for
+// ~90 ms at 115200 baud. The command only sets a cursor; serviceReplies()
+// sends one line per loop pass when a whole line fits, as
+// serviceEnvSend() does. Asking again restarts that reply.
+const byte REPLY_LINE_MAX     = 56;  // Longest LIST line is ~48 bytes
+byte replyListNext            = PARAM_COUNT;      // Next LIST line, PARAM_COUNT = done
+byte replySubsNext            = STREAM_COUNT + 1; // Next SUB: line, STREAM_COUNT = LOAD
+byte replySubsOnly            = STREAM_COUNT;     // Stream reported, STREAM_COUNT = all
+
 void setup() {
   // 1. Initialize Serial
-  Serial.begin(115200);
+  Serial.begin(linkBaud);
   Serial.setTimeout(10); // Short timeout for non-blocking feel
 
   // 2. Configure Pins
@@ -59,69 +822,663 @@ void setup() {
 
   pinMode(PIN_ENABLE_OUT, OUTPUT);
 
-  // Initial Output States
-  digitalWrite(PIN_ENABLE_OUT, HIGH);  // High = Enabled, Low = Disabled
+  // Initial Output States (a stop latched before a warm restart stays latched)
+  // The snapshot is checked against the stored settings, so load them first
+  bool paramsRestored = paramLoad();
+  warmConfigCrc = configCrc();
+  byte warm = warmRestore();
+  autoLogRestore(warm != WARM_COLD);
+  digitalWrite(PIN_ENABLE_OUT, machineStopActive ? LOW : HIGH);  // High = Enabled, Low = Disabled
 
   // 3. Init State
   lastPingReceived = millis();
-  filteredValue = analogRead(PIN_SENSOR); // Seed filter
-  if (CFG_REVERSE_SENSOR) {
-    filteredValue = 1023 - filteredValue;
+  rxPollUs = micros();
+  if (warm != WARM_FULL) {
+    filteredValue = analogRead(PIN_SENSOR); // Seed filter
+    if (CFG_REVERSE_SENSOR) {
+      filteredValue = 1023 - filteredValue;
+    }
+    shadowFiltered = filteredValue;
+    envelopeState = digitalRead(PIN_ENVELOPE); // Seed debounce
   }
-  envelopeState = digitalRead(PIN_ENVELOPE); // Seed debounce
   lastFlickerableState = envelopeState;
 
-  Serial.println("MSG:System Booted");
+  if (FEATURE_MESSAGES) {
+    Serial.println(F("MSG:System Booted"));
+    if (paramsRestored) {
+      Serial.println(F("MSG:Parameters Restored"));
+    }
+  }
+  if (warm != WARM_COLD) {
+    Serial.print(F("WARM:"));
+    Serial.print((int)currentState);
+    Serial.print(F(","));
+    if (faultCode == FAULT_NONE) {
+      Serial.print(F("NONE"));
+    } else {
+      Serial.print(eventName(faultCode));
+    }
+    Serial.print(F(","));
+    Serial.print(envelopeSeq);
+    Serial.println(warm == WARM_FULL ? F(",RESTORED") : F(",SETTINGS_CHANGED"));
+  }
+  warmSave();
 }
 
 void loop() {
   unsigned long currentMillis = millis();
 
+  unsigned long nowUs = micros();
+  if (statLoopStartUs != 0) {
+    unsigned long periodUs = nowUs - statLoopStartUs;
+    statLoopSumUs += periodUs;
+    statLoopCount++;
+    if (periodUs > statLoopMaxUs) {
+      statLoopMaxUs = periodUs;
+    }
+  }
+  statLoopStartUs = nowUs;
+  statSampleUs = nowUs;
+
+  // ============================================================
+  // 1. READ INPUTS & RUN DETECTOR
+  // ============================================================
+  // While samples are injected from the PC the physical inputs are
+  // ignored; the detector is driven from serviceInjection() instead.
+  if (!(FEATURE_INJECTION && injectMode)) {
+    int rawValue = analogRead(PIN_SENSOR);
+    int reading = digitalRead(PIN_ENVELOPE);
+    processSample(currentMillis, rawValue, reading);
+
+    // Raw samples are dropped rather than blocking when the TX buffer is full
+    if (FEATURE_TELEMETRY && streamPeriod[STREAM_RAW] > 0 &&
+        ++rawDecimation >= streamPeriod[STREAM_RAW]) {
+      rawDecimation = 0;
+      if (Serial.availableForWrite() >= STREAM_RECORD_BYTES[STREAM_RAW]) {
+        Serial.print(F("R:"));
+        Serial.println(lastRawValue);
+      }
+    }
+  }
+
+  // ============================================================
+  // 2. PC CONNECTION WATCHDOG (skipped if system override enabled)
+  // ============================================================
+  // An injection stream is itself proof that the PC is alive.
+  if (!overrideActive() && !injectMode) {
+    if (currentMillis - lastPingReceived > CFG_WATCHDOG_TIMEOUT) {
+      if (CFG_AUTONOMOUS) {
+        if (!autoLog.active) {
+          if (autoSyncNext == AUTO_SYNC_IDLE) { // Not into a buffer still being sent
+            if (!autoLog.pending) {
+              autoLog.pending = true;
+              autoLog.since = currentMillis;
+            }
+            autoLog.active = true;
+            autoLogSeal();
+          }
+        } else if (CFG_AUTONOMOUS_MAX_S > 0 && !machineStopActive &&
+                   currentMillis - autoLog.since > CFG_AUTONOMOUS_MAX_S * 1000UL) {
+          triggerStop(FAULT_AUTONOMOUS_TIMEOUT);
+        }
+      } else if (!machineStopActive) {
+        triggerStop(FAULT_WATCHDOG_TIMEOUT);
+      }
+    }
+  }
+
+  if (currentMillis - warmSavedMs >= WARM_SAVE_MS) {
+    warmSave();
+  }
+
+  // ============================================================
+  // 3. SERIAL COMMUNICATION (RX)
+  // ============================================================
+  if (baudFallback != 0 && currentMillis - baudSwitchSince > BAUD_CONFIRM_TIMEOUT) {
+    setLinkBaud(baudFallback);
+    baudFallback = 0;
+    Serial.print(F("BAUD:FALLBACK,"));
+    Serial.println(linkBaud);
+  }
+  if (FEATURE_INJECTION && injectMode) {
+    serviceInjection();
+  } else {
+    serviceRx();
+  }
+  rxPollUs = micros();
+
+  // ============================================================
+  // 4. TELEMETRY (TX)
+  // ============================================================
+  // Suppressed during injection: the link is busy with sample frames and
+  // the values would be on the virtual clock anyway.
+  if (FEATURE_TELEMETRY && !injectMode) {
+    serviceStreams(currentMillis);
+    if (envSending) {
+      serviceEnvSend();
+    }
+  }
+  if (!injectMode) {
+    serviceReplies();
+  }
+  if (FEATURE_TELEMETRY && !injectMode && streamPeriod[STREAM_FILT] > 0) {
+    if (CFG_TELEMETRY_MODE == TELEMETRY_PERIODIC) {
+      if (currentMillis - lastTelemetryTime >= streamPeriod[STREAM_FILT]) {
+        sendTelemetry(currentMillis, false);
+      }
+    } else {
+      bool changed = lastSentValue < 0 ||
+                     abs(sensorValue - lastSentValue) > CFG_TELEMETRY_DEADBAND ||
+                     isEnvelopePresent != lastSentEnvelope ||
+                     machineStopActive != lastSentStop;
+      if ((changed || currentMillis - lastTelemetryTime >= CFG_TELEMETRY_KEEPALIVE) &&
+          Serial.availableForWrite() >= TELEMETRY_RECORD_MAX) {
+        sendTelemetry(currentMillis, true);
+      }
+    }
+  }
+}
+
+// Format: D:SensorVal,EnvelopeState,StopState[,um]
+//     or: T:Millis,SensorVal,EnvelopeState,StopState[,um]
+// We send sensorValue (filtered) to give PC a smooth graph
+void sendTelemetry(unsigned long currentMillis, bool timestamped) {
+  lastTelemetryTime = currentMillis;
+  lastSentValue = sensorValue;
+  lastSentEnvelope = isEnvelopePresent;
+  lastSentStop = machineStopActive;
+
+  if (timestamped) {
+    Serial.print(F("T:"));
+    Serial.print(currentMillis);
+    Serial.print(F(","));
+  } else {
+    Serial.print(F("D:"));
+  }
+  Serial.print(sensorValue);
+  Serial.print(F(","));
+  Serial.print(isEnvelopePresent ? 1 : 0);
+  Serial.print(F(","));
+  Serial.print(machineStopActive ? 1 : 0);
+  // Optional last field: calibrated thickness in um
+  if (calCount >= 2) {
+    Serial.print(F(","));
+    Serial.print(calToUm(sensorValue));
+  }
+  Serial.println();
+}
+
+// Timed streams (AGG, HEALTH) and the sample rate measurement.
+void serviceStreams(unsigned long currentMillis) {
+  if (currentMillis - rateWindowStart >= 1000) {
+    samplesPerSecond = samplesThisSecond * 1000 / (currentMillis - rateWindowStart);
+    samplesThisSecond = 0;
+    rateWindowStart = currentMillis;
+  }
+
+  if (streamPeriod[STREAM_AGG] > 0 &&
+      currentMillis - streamLast[STREAM_AGG] >= streamPeriod[STREAM_AGG] && agg.count > 0) {
+    streamLast[STREAM_AGG] = currentMillis;
+    Serial.print(F("A:"));
+    Serial.print(agg.min);
+    Serial.print(F(","));
+    Serial.print(agg.max);
+    Serial.print(F(","));
+    Serial.print(agg.mean());
+    Serial.print(F(","));
+    Serial.println(agg.count);
+    agg.reset();
+  }
+
+  if (streamPeriod[STREAM_HEALTH] > 0 &&
+      currentMillis - streamLast[STREAM_HEALTH] >= streamPeriod[STREAM_HEALTH]) {
+    streamLast[STREAM_HEALTH] = currentMillis;
+    Serial.print(F("H:"));
+    Serial.print(currentMillis / 1000);
+    Serial.print(F(","));
+    Serial.print(samplesPerSecond);
+    Serial.print(F(","));
+    Serial.print(currentMillis - lastPingReceived);
+    Serial.print(F(","));
+    Serial.print((int)currentState);
+    Serial.print(F(","));
+    Serial.print(machineStopActive ? 1 : 0);
+    Serial.print(F(","));
+    Serial.println(noiseMadQ4 * 5 / 4 * 10 / 16); // Floor sigma x10
+  }
+}
+
+// Per-envelope record, sent after the verdict.
+void sendEnvelopeRecord(unsigned long currentMillis) {
+  if (streamPeriod[STREAM_ENV] == 0 || envelopeSeq % streamPeriod[STREAM_ENV] != 0) {
+    return;
+  }
+  Serial.print(F("E:"));
+  Serial.print(envelopeSeq);
+  Serial.print(F(","));
+  Serial.print(currentMillis - envelopeStartMs);
+  Serial.print(F(","));
+  Serial.print(peakMain.maximum);
+  Serial.print(F(","));
+  Serial.print(envelopeSamples);
+  if (CFG_THUMB_POINTS > 0) {
+    static const char HEX_DIGITS[] = "0123456789ABCDEF";
+    byte buckets = thumbCount + (thumbFill > 0 ? 1 : 0);
+    Serial.print(F(","));
+    for (byte i = 0; i < CFG_THUMB_POINTS; i++) {
+      byte b = (unsigned int)i * buckets / CFG_THUMB_POINTS;
+      Serial.write(HEX_DIGITS[thumbMin[b] >> 4]);
+      Serial.write(HEX_DIGITS[thumbMin[b] & 0x0F]);
+      Serial.write(HEX_DIGITS[thumbMax[b] >> 4]);
+      Serial.write(HEX_DIGITS[thumbMax[b] & 0x0F]);
+    }
+  }
+  endStamped(currentMillis);
+}
+
+// Ends an event line, with its device time when EVENT_STAMPS is on.
+void endStamped(unsigned long ms) {
+  if (CFG_EVENT_STAMPS) {
+    Serial.print(F(" @"));
+    Serial.print(ms);
+  }
+  Serial.println();
+}
+
+void thumbReset() {
+  thumbCount = 0;
+  thumbWidth = 1;
+  thumbFill = 0;
+}
+
+void thumbAdd(int value) {
+  byte v = value >> 2;
+  byte i = thumbCount;
+  if (thumbFill == 0) {
+    thumbMin[i] = v;
+    thumbMax[i] = v;
+  } else {
+    thumbMin[i] = min(thumbMin[i], v);
+    thumbMax[i] = max(thumbMax[i], v);
+  }
+  if (++thumbFill < thumbWidth) {
+    return;
+  }
+  thumbFill = 0;
+  if (++thumbCount < CFG_THUMB_POINTS) {
+    return;
+  }
+  // All buckets full: halve the resolution
+  for (byte j = 0; j < CFG_THUMB_POINTS / 2; j++) {
+    thumbMin[j] = min(thumbMin[2 * j], thumbMin[2 * j + 1]);
+    thumbMax[j] = max(thumbMax[2 * j], thumbMax[2 * j + 1]);
+  }
+  thumbCount = CFG_THUMB_POINTS / 2;
+  thumbWidth *= 2;
+}
+
+inline byte envWrap(unsigned int i) {
+  return i % ENV_ARCHIVE_BYTES;
+}
+
+// Drops the oldest record. Never called with only the open record left.
+void envEvict() {
+  byte bytes = envArchive[envWrap(envTail + 2)];
+  if (envSending && envSendRecord == envTail) {
+    envSendLost = true;
+  }
+  envTail = envWrap(envTail + bytes);
+  envUsed -= bytes;
+}
+
+// Makes room for n more bytes of the open record, false if it is the
+// only record left and the ring is full.
+bool envReserve(byte n) {
+  while (ENV_ARCHIVE_BYTES - envUsed < n) {
+    if (envUsed == 0 || (envOpen && envTail == envOpenAt)) {
+      return false;
+    }
+    envEvict();
+  }
+  return true;
+}
+
+void envPut(byte b) {
+  envArchive[envWrap(envTail + envUsed)] = b;
+  envUsed++;
+}
+
+void envBegin() {
+  envOpen = false;
+  if (!envReserve(ENV_HEADER_BYTES)) {
+    return;
+  }
+  if (envUsed == 0) {
+    envTail = 0;
+  }
+  envOpenAt = envWrap(envTail + envUsed);
+  envPut(envelopeSeq & 0xFF);
+  envPut((envelopeSeq >> 8) & 0xFF);
+  envPut(ENV_HEADER_BYTES);
+  envPut(0);
+  envPut(0);
+  envOpen = true;
+  envLastValue = 0;
+  envBucketMax = -1;
+}
+
+// Appends the pending millisecond as one point.
+void envFlush() {
+  if (envBucketMax < 0) {
+    return;
+  }
+  byte* flags = &envArchive[envWrap(envOpenAt + 4)];
+  int delta = envBucketMax - envLastValue;
+  unsigned int zigzag = ((unsigned int)delta << 1) ^ (unsigned int)(delta >> 15);
+  byte n = zigzag < 0x80 ? 1 : 2;
+  envBucketMax = -1;
+  if (*flags & ENV_TRUNCATED) {
+    return;
+  }
+  if (!envReserve(n)) {
+    *flags |= ENV_TRUNCATED;
+    return;
+  }
+  if (n == 1) {
+    envPut(zigzag);
+  } else {
+    envPut((zigzag & 0x7F) | 0x80);
+    envPut(zigzag >> 7);
+  }
+  envLastValue += delta;
+  envArchive[envWrap(envOpenAt + 2)] += n;
+  envArchive[envWrap(envOpenAt + 3)]++;
+}
+
+void envAdd(unsigned long offset, int value) {
+  if (!envOpen) {
+    return;
+  }
+  if (envBucketMax >= 0 && offset != envBucketMs) {
+    envFlush();
+  }
+  envBucketMs = offset;
+  envBucketMax = max(envBucketMax, value);
+}
+
+void envFinish() {
+  if (envOpen) {
+    envFlush();
+    envOpen = false;
+  }
+}
+
+// Full sequence number of the most recent envelope with these low 16 bits.
+unsigned long envFullSeq(byte at) {
+  unsigned int low = envArchive[at] | ((unsigned int)envArchive[envWrap(at + 1)] << 8);
+  return envelopeSeq - (unsigned int)((unsigned int)envelopeSeq - low);
+}
+
+// Start of the completed record of an envelope, -1 if it is not kept.
+int envFind(unsigned long seq) {
+  for (unsigned int offset = 0; offset < envUsed;) {
+    byte at = envWrap(envTail + offset);
+    if (envOpen && at == envOpenAt) {
+      break;
+    }
+    if (envFullSeq(at) == seq) {
+      return at;
+    }
+    offset += envArchive[envWrap(at + 2)];
+  }
+  return -1;
+}
+
+// GET_ENV: replaces a transfer still in progress.
+void envRequest(unsigned long seq) {
+  int at = envFind(seq);
+  Serial.print(F("ENV:"));
+  Serial.print(seq);
+  if (at < 0) {
+    envSending = false;
+    Serial.println(F(",NONE"));
+    return;
+  }
+  envSending = true;
+  envSendLost = false;
+  envSendSeq = seq;
+  envSendRecord = at;
+  envSendAt = envWrap(at + ENV_HEADER_BYTES);
+  envSendLeft = envArchive[envWrap(at + 2)] - ENV_HEADER_BYTES;
+  envSendIndex = 0;
+  envSendValue = 0;
+  Serial.print(F(",BEGIN,"));
+  Serial.print(envArchive[envWrap(at + 3)]);
+  Serial.print(F(","));
+  Serial.println(envArchive[envWrap(at + 4)] & ENV_TRUNCATED ? 1 : 0);
+}
+
+// ENV:LIST,<bytes used>,<capacity>[,<seq>...] oldest first
+void envList() {
+  Serial.print(F("ENV:LIST,"));
+  Serial.print(envUsed);
+  Serial.print(F(","));
+  Serial.print(ENV_ARCHIVE_BYTES);
+  for (unsigned int offset = 0; offset < envUsed;) {
+    byte at = envWrap(envTail + offset);
+    if (envOpen && at == envOpenAt) {
+      break;
+    }
+    Serial.print(F(","));
+    Serial.print(envFullSeq(at));
+    offset += envArchive[envWrap(at + 2)];
+  }
+  Serial.println();
+}
+
+// One line of the transfer in progress, if the TX buffer can take it.
+void serviceEnvSend() {
+  if (Serial.availableForWrite() < ENV_SEND_LINE_MAX) {
+    return;
+  }
+  Serial.print(F("ENV:"));
+  Serial.print(envSendSeq);
+  if (envSendLost) {
+    envSending = false;
+    Serial.println(F(",LOST"));
+    return;
+  }
+  if (envSendLeft == 0) {
+    envSending = false;
+    Serial.println(F(",END"));
+    return;
+  }
+  Serial.print(F(","));
+  Serial.print(envSendIndex);
+  for (byte i = 0; i < ENV_SEND_POINTS && envSendLeft > 0; i++) {
+    byte b = envArchive[envSendAt];
+    unsigned int zigzag = b & 0x7F;
+    envSendAt = envWrap(envSendAt + 1);
+    envSendLeft--;
+    if (b & 0x80) {
+      zigzag |= (unsigned int)envArchive[envSendAt] << 7;
+      envSendAt = envWrap(envSendAt + 1);
+      envSendLeft--;
+    }
+    envSendValue += (int)(zigzag >> 1) ^ -(int)(zigzag & 1);
+    envSendIndex++;
+    Serial.print(F(","));
+    Serial.print(envSendValue);
+  }
+  Serial.println();
+}
+
+// Estimated bytes/s a stream produces at the given period.
+long streamLoad(byte id, unsigned int period) {
+  if (period == 0) {
+    return 0;
+  }
+  long bytes = STREAM_RECORD_BYTES[id];
+  if (id == STREAM_ENV && CFG_THUMB_POINTS > 0) {
+    bytes += 1 + CFG_THUMB_POINTS * 4;
+  }
+  if ((id == STREAM_EVT || id == STREAM_ENV) && CFG_EVENT_STAMPS) {
+    bytes += STAMP_BYTES;
+  }
+  switch (id) {
+    case STREAM_RAW:
+      return (long)(samplesPerSecond / period) * bytes;
+    case STREAM_EVT:
+    case STREAM_ENV:
+    case STREAM_SHADOW:
+      return ENVELOPE_RATE_MAX * bytes / period;
+    default:
+      return 1000L * bytes / period;
+  }
+}
+
+// Usable bytes/s on a link at the given rate (10 bits per byte on the wire).
+long linkBudget(unsigned long baud) {
+  return (long)(baud / 10) * LINK_BUDGET_PERCENT / 100;
+}
+
+long streamLoadTotal() {
+  long load = 0;
+  for (byte i = 0; i < STREAM_COUNT; i++) {
+    load += streamLoad(i, streamPeriod[i]);
+  }
+  return load;
+}
+
+// Drains pending output at the old rate first, so the confirmation line
+// is not cut in half by the switch. end() also discards unread input.
+void setLinkBaud(unsigned long baud) {
+  Serial.flush();
+  Serial.end();
+  linkBaud = baud;
+  Serial.begin(linkBaud);
+}
+
+bool subscribe(byte id, unsigned int period) {
+  long load = streamLoad(id, period);
+  for (byte i = 0; i < STREAM_COUNT; i++) {
+    if (i != id) {
+      load += streamLoad(i, streamPeriod[i]);
+    }
+  }
+  if (load > linkBudget(linkBaud)) {
+    Serial.print(F("SUB:REJECTED,"));
+    Serial.print((const __FlashStringHelper*)pgm_read_ptr(&STREAM_NAMES[id]));
+    Serial.print(F(","));
+    Serial.print(load);
+    Serial.print(F(","));
+    Serial.println(linkBudget(linkBaud));
+    return false;
+  }
+  streamPeriod[id] = period;
+  streamLast[id] = millis();
+  rawDecimation = 0;
+  return true;
+}
+
+// Format: SUB:<name>,<period> per stream, then SUB:LOAD,<bytes/s>,<budget>
+// Pass STREAM_COUNT to list every stream, or a stream id to list just one.
+// Queues SUB:<stream>,<period> for one stream (STREAM_COUNT = all of
+// them) and SUB:LOAD,<bytes/s>,<budget>, sent by serviceReplies().
+void reportSubscriptions(byte only) {
+  replySubsOnly = only;
+  replySubsNext = (only == STREAM_COUNT) ? 0 : only;
+}
+
+// Sends the next line of a pending multi-line reply, see PACED REPLIES.
+void serviceReplies() {
+  if (Serial.availableForWrite() < REPLY_LINE_MAX) {
+    return;
+  }
+  if (autoSyncNext != AUTO_SYNC_IDLE) {
+    sendSyncLine();
+    return;
+  }
+  if (replyListNext < PARAM_COUNT) {
+    paramReport(replyListNext++, true);
+    return;
+  }
+  if (replySubsNext < STREAM_COUNT) {
+    Serial.print(F("SUB:"));
+    Serial.print((const __FlashStringHelper*)pgm_read_ptr(&STREAM_NAMES[replySubsNext]));
+    Serial.print(F(","));
+    Serial.println(streamPeriod[replySubsNext]);
+    replySubsNext = (replySubsOnly == STREAM_COUNT) ? replySubsNext + 1 : STREAM_COUNT;
+    return;
+  }
+  if (replySubsNext == STREAM_COUNT) {
+    Serial.print(F("SUB:LOAD,"));
+    Serial.print(streamLoadTotal());
+    Serial.print(F(","));
+    Serial.println(linkBudget(linkBaud));
+    replySubsNext++;
+  }
+}
+
+// ------------------------------------------------------------
+// DETECTOR
+// ------------------------------------------------------------
+
+// Runs one sample through the filter, safety check, debounce and state
+// machine. Shared by live sampling and sample injection so both exercise
+// exactly the same detection path.
+void processSample(unsigned long currentMillis, int rawValue, int reading) {
+  unsigned long detectStartUs = FEATURE_STATS ? micros() : 0;
+
   // ============================================================
-  // 1. READ & FILTER SENSOR
+  // A. FILTER SENSOR
   // ============================================================
-  int rawValue = analogRead(PIN_SENSOR);
   // Apply reversal if configured (for upside-down sensor installation)
   if (CFG_REVERSE_SENSOR) {
     rawValue = 1023 - rawValue;
   }
+  lastRawValue = rawValue;
   // EMA Filter: New = (Alpha * Raw) + ((1-Alpha) * Old)
-  filteredValue = (FILTER_ALPHA * rawValue) + ((1.0 - FILTER_ALPHA) * filteredValue);
-  int sensorValue = (int)filteredValue;
+  filteredValue = (CFG_FILTER_ALPHA * rawValue) + ((1.0 - CFG_FILTER_ALPHA) * filteredValue);
+  sensorValue = (int)filteredValue;
+  int shadowValue = 0;
+  if (shadowActive()) {
+    shadowFiltered = (CFG_SHADOW_ALPHA * rawValue) + ((1.0 - CFG_SHADOW_ALPHA) * shadowFiltered);
+    shadowValue = (int)shadowFiltered;
+  }
+  samplesThisSecond++;
+  if (currentState == STATE_IDLE && !isEnvelopePresent) {
+    noiseUpdate(sensorValue);
+  }
+
+  if (streamPeriod[STREAM_AGG] > 0) {
+    agg.add(sensorValue);
+  }
 
   // ============================================================
-  // 2. WATCHDOG & SAFETY CHECK (skipped if system override enabled)
+  // B. SAFETY CHECK (skipped if system override enabled)
   // ============================================================
-  if (!CFG_SYSTEM_OVERRIDE) {
-    // A. PC Connection Watchdog
-    if (currentMillis - lastPingReceived > WATCHDOG_TIMEOUT) {
-      if (!machineStopActive) {
-        triggerStop("ERR:WATCHDOG_TIMEOUT");
-      }
-    }
-
-    // B. Sensor Range Check (50-1000 absolute valid range)
-    if (sensorValue < 50 || sensorValue > 1000) {
+  if (!overrideActive()) {
+    // Sensor Range Check (50-1000 absolute valid range by default)
+    if (sensorValue < CFG_SENSOR_MIN || sensorValue > CFG_SENSOR_MAX) {
       if (!machineStopActive) {
-        triggerStop("ERR:SENSOR_OUT_OF_RANGE");
+        triggerStop(FAULT_SENSOR_OUT_OF_RANGE);
       }
     }
   }
 
   // ============================================================
-  // 3. LOGIC STATE MACHINE (Envelope Window)
+  // C. LOGIC STATE MACHINE (Envelope Window)
   // ============================================================
-  
+
   // --- DEBOUNCE INPUT ---
-  int reading = digitalRead(PIN_ENVELOPE);
-  
   // If the switch changed, due to noise or pressing:
   if (reading != lastFlickerableState) {
     lastDebounceTime = currentMillis; // reset the debouncing timer
     lastFlickerableState = reading;
   }
 
-  if ((currentMillis - lastDebounceTime) > DEBOUNCE_DELAY) {
+  if ((currentMillis - lastDebounceTime) > CFG_DEBOUNCE_DELAY) {
     // Whatever the reading is at, it's been there for longer than the debounce
     // delay, so take it as the actual current state:
 
@@ -129,28 +1486,76 @@ void loop() {
       envelopeState = reading;
     }
   }
-  
-  bool isEnvelopePresent = (envelopeState == LOW); // Assuming Active LOW
+
+  isEnvelopePresent = (envelopeState == LOW); // Assuming Active LOW
 
   switch (currentState) {
     case STATE_IDLE:
       if (isEnvelopePresent) {
         // TRANSITION: IDLE -> MEASURING
         currentState = STATE_MEASURING;
-        maxPeakInWindow = 0; // Reset peak for new envelope
+        peakReset(); // Reset peak for new envelope
+        shadowEnvelope = shadowActive();
+        if (CFG_BLANK_UNIT == BLANK_PERCENT) {
+          blankLeadMs = lastEnvelopeMs * min(CFG_BLANK_LEAD, BLANK_PERCENT_MAX) / 100;
+        } else {
+          blankLeadMs = CFG_BLANK_LEAD;
+        }
+        blankNext = blankLeadMs;
+        envelopeSeq++;
+        envelopeStartMs = currentMillis;
+        envelopeSamples = 0;
+        thumbReset();
+        if (FEATURE_TELEMETRY) {
+          envBegin();
+        }
+        warmSave();
       }
       break;
 
     case STATE_MEASURING:
       // Track the highest value seen while envelope is passing
-      if (sensorValue > maxPeakInWindow) {
-        maxPeakInWindow = sensorValue;
+      peakMain.unblanked = max(peakMain.unblanked, sensorValue);
+      peakShadow.unblanked = max(peakShadow.unblanked, shadowValue);
+      if (CFG_BLANK_TRAIL > 0) {
+        blankAdd(currentMillis - envelopeStartMs, sensorValue, shadowValue);
+      } else if (currentMillis - envelopeStartMs >= blankLeadMs) {
+        peakFeed(sensorValue, shadowValue);
+      }
+      envelopeSamples++;
+      if (FEATURE_TELEMETRY && CFG_THUMB_POINTS > 0 && streamPeriod[STREAM_ENV] > 0) {
+        thumbAdd(sensorValue);
+      }
+      if (FEATURE_TELEMETRY) {
+        envAdd(currentMillis - envelopeStartMs, sensorValue);
       }
 
       if (!isEnvelopePresent) {
         // TRANSITION: MEASURING -> IDLE (Envelope finished passing)
+        lastEnvelopeMs = currentMillis - envelopeStartMs;
+        if (CFG_BLANK_TRAIL > 0) {
+          blankFinish(lastEnvelopeMs);
+        }
+        if (!peakMain.fed) {
+          peakFeed(peakMain.unblanked, peakShadow.unblanked); // Blanking covered it all
+        }
+        if (FEATURE_TELEMETRY) {
+          envFinish(); // Complete before the verdict, so a stop's trace can be fetched
+        }
         validateResult(); 
+        if (shadowEnvelope && shadowActive()) {
+          shadowCompare();
+        }
+        if (FEATURE_TELEMETRY) {
+          sendEnvelopeRecord(currentMillis);
+        }
         currentState = STATE_IDLE;
+        warmSave();
+        // Injected replays keep running through verdict faults so a whole
+        // trace can be compared verdict by verdict.
+        if (injectMode && injectAutoResume && machineStopActive) {
+          resetSystem();
+        }
       }
       break;
 
@@ -159,28 +1564,68 @@ void loop() {
       break;
   }
 
-  // ============================================================
-  // 4. SERIAL COMMUNICATION (RX)
-  // ============================================================
-  if (Serial.available() > 0) {
-    String command = Serial.readStringUntil('\n');
-    command.trim();
-    processCommand(command);
+  if (FEATURE_STATS) {
+    unsigned long detectUs = micros() - detectStartUs;
+    statDetectSumUs += detectUs;
+    statDetectCount++;
+    if (detectUs > statDetectMaxUs) {
+      statDetectMaxUs = detectUs;
+    }
   }
+}
 
-  // ============================================================
-  // 5. TELEMETRY (TX)
-  // ============================================================
-  if (currentMillis - lastTelemetryTime >= TELEMETRY_INTERVAL) {
-    lastTelemetryTime = currentMillis;
-    // Format: D:SensorVal,EnvelopeState,StopState
-    // We send sensorValue (filtered) to give PC a smooth graph
-    Serial.print("D:");
-    Serial.print(sensorValue);
-    Serial.print(",");
-    Serial.print(isEnvelopePresent ? 1 : 0);
-    Serial.print(",");
-    Serial.println(machineStopActive ? 1 : 0);
+// Consumes every complete injection frame waiting in the RX buffer and
+// acknowledges them in steps of INJECT_ACK_FRAMES.
+void serviceInjection() {
+  while (Serial.available() > 0) {
+    byte b = Serial.read();
+    if (injectFramePos == 0 && b != INJECT_SYNC) {
+      if (b == REMOTE_STOP_BYTE) {
+        remoteStop();
+      }
+      continue; // Resynchronise on the next sync byte
+    }
+    injectFrame[injectFramePos++] = b;
+    if (injectFramePos < sizeof(injectFrame)) {
+      continue;
+    }
+    injectFramePos = 0;
+
+    unsigned int frameWord = injectFrame[1] | ((unsigned int)injectFrame[2] << 8);
+    if (frameWord == INJECT_CTRL_END) {
+      injectMode = false;
+      lastPingReceived = millis();
+      lastTelemetryTime = millis();
+      Serial.print(F("MSG:INJECT_END:"));
+      Serial.println(injectFrames);
+      return;
+    }
+    if (frameWord == INJECT_CTRL_RESUME) {
+      resetSystem();
+      continue;
+    }
+    if (frameWord & 0x8000) {
+      continue; // Unknown control word
+    }
+
+    injectClock += injectSampleMs;
+    injectFrames++;
+    statSampleUs = micros();
+    int rawValue = frameWord & 0x03FF;
+    int reading = (frameWord & 0x0400) ? LOW : HIGH; // Envelope input is active LOW
+    if (injectFrames == 1) {
+      // Seed filter and debounce from the first injected sample
+      filteredValue = CFG_REVERSE_SENSOR ? 1023 - rawValue : rawValue;
+      shadowFiltered = filteredValue;
+      envelopeState = reading;
+      lastFlickerableState = reading;
+      lastDebounceTime = injectClock;
+    }
+    processSample(injectClock, rawValue, reading);
+    if (injectFrames % INJECT_ACK_FRAMES == 0) {
+      Serial.print(F("INJ:"));
+      Serial.println(injectFrames);
+    }
   }
 }
 
@@ -192,55 +1637,649 @@ void validateResult() {
   // Logic: Check if peak is within valid range
   // Below lower threshold = empty envelope (no card)
   // Above upper threshold = double card
+  int peak = peakEstimate(peakMain, CFG_PEAK_MODE);
+  int confidence = verdictConfidence(peak);
+  byte verdict = envelopeVerdict(peak, CFG_CARD_THRESHOLD, CFG_CARD_UPPER_THRESHOLD);
 
-  if (maxPeakInWindow >= CFG_CARD_THRESHOLD && maxPeakInWindow <= CFG_CARD_UPPER_THRESHOLD) {
-    // PASS: Card detected within valid range
-    Serial.print("EVT:PASS:");
-    Serial.println(maxPeakInWindow);
-  } else if (maxPeakInWindow < CFG_CARD_THRESHOLD) {
-    // FAIL: Peak was below threshold (Empty Envelope)
-    if (CFG_SYSTEM_OVERRIDE) {
-      Serial.print("EVT:PASS_OVERRIDE:");
-      Serial.println(maxPeakInWindow);
-    } else {
-      Serial.print("ERR:EMPTY_ENVELOPE:");
-      Serial.println(maxPeakInWindow);
-      machineStopActive = true;
-      currentState = STATE_FAULT;
-      digitalWrite(PIN_ENABLE_OUT, LOW);
-    }
+  if (verdict == EVENT_PASS) {
+    // PASS: Card detected within valid range, possibly close to a limit
+    bool marginal = CFG_MARGINAL_BAND > 0 &&
+                    (peak < CFG_CARD_THRESHOLD + CFG_MARGINAL_BAND ||
+                     peak > CFG_CARD_UPPER_THRESHOLD - CFG_MARGINAL_BAND);
+    reportEvent(marginal ? EVENT_PASS_MARGINAL : EVENT_PASS, peak, confidence);
+  } else if (overrideActive()) {
+    // FAIL, but error detection is bypassed
+    reportEvent(EVENT_PASS_OVERRIDE, peak, confidence);
   } else {
-    // FAIL: Peak was above upper threshold (Double Card)
-    if (CFG_SYSTEM_OVERRIDE) {
-      Serial.print("EVT:PASS_OVERRIDE:");
-      Serial.println(maxPeakInWindow);
-    } else {
-      Serial.print("ERR:DOUBLE_CARD:");
-      Serial.println(maxPeakInWindow);
-      machineStopActive = true;
-      currentState = STATE_FAULT;
-      digitalWrite(PIN_ENABLE_OUT, LOW);
+    // FAIL: Empty Envelope or Double Card
+    triggerStop(verdict, peak, confidence);
+  }
+}
+
+// Plain threshold verdict: EVENT_PASS, FAULT_EMPTY_ENVELOPE or FAULT_DOUBLE_CARD.
+byte envelopeVerdict(int peak, int threshold, int upper) {
+  if (peak < threshold) {
+    return FAULT_EMPTY_ENVELOPE; // Below lower threshold = no card
+  }
+  if (peak > upper) {
+    return FAULT_DOUBLE_CARD;
+  }
+  return EVENT_PASS;
+}
+
+// Deviations are clipped to NOISE_CLIP x the current MAD, so the tail of
+// an envelope settling through the filter barely moves either average.
+void noiseUpdate(int value) {
+  long valueQ4 = (long)value * 16;
+  if (noiseFloorQ4 < 0) {
+    noiseFloorQ4 = valueQ4;
+  }
+  long limit = noiseMadQ4 * NOISE_CLIP;
+  long deviation = constrain(valueQ4 - noiseFloorQ4, -limit, limit);
+  noiseMadQ4 += (abs(deviation) - noiseMadQ4) / NOISE_EMA_DIV;
+  noiseFloorQ4 += deviation / NOISE_EMA_DIV;
+}
+
+// Distance to the nearest threshold in tenths of sigma (see VERDICT CONFIDENCE).
+int verdictConfidence(int peak) {
+  long sigmaQ4 = max(noiseMadQ4 * 5 / 4, 16L);
+  long margin = min(peak - CFG_CARD_THRESHOLD, CFG_CARD_UPPER_THRESHOLD - peak);
+  long confidence = margin * 160 / sigmaQ4;
+  return constrain(confidence, -CONFIDENCE_MAX, CONFIDENCE_MAX);
+}
+
+void peakReset() {
+  memset(&peakMain, 0, sizeof(peakMain));
+  memset(&peakShadow, 0, sizeof(peakShadow));
+  for (byte i = 0; i < BLANK_DELAY_MS; i++) {
+    blankSlot[i] = -1;
+    blankShadowSlot[i] = -1;
+  }
+}
+
+// One in-window value (a sample, or a released blanking bucket), with the
+// shadow detector's value for the same sample or bucket.
+void peakFeed(int value, int shadowValue) {
+  peakAdd(peakMain, CFG_PEAK_MODE, value);
+  if (shadowActive()) {
+    peakAdd(peakShadow, CFG_SHADOW_PEAK_MODE, shadowValue);
+  }
+}
+
+// Releases buckets older than the trailing window, then files the sample
+// under its ms offset from the envelope start.
+void blankAdd(unsigned long offset, int value, int shadowValue) {
+  if (offset < blankLeadMs) {
+    return;
+  }
+  unsigned long delay = BLANK_DELAY_MS - 1;
+  if (CFG_BLANK_UNIT == BLANK_MS) {
+    delay = min((unsigned long)CFG_BLANK_TRAIL, delay);
+  }
+  byte released = 0;
+  while (blankNext + delay < offset) {
+    if (released == BLANK_DELAY_MS) {
+      blankNext = offset - delay; // Gap in the samples, every slot is empty now
+      break;
+    }
+    byte i = blankNext % BLANK_DELAY_MS;
+    if (blankSlot[i] >= 0) {
+      peakFeed(blankSlot[i], blankShadowSlot[i]);
+      blankSlot[i] = -1;
+      blankShadowSlot[i] = -1;
+    }
+    blankNext++;
+    released++;
+  }
+  byte i = offset % BLANK_DELAY_MS;
+  if (value > blankSlot[i]) {
+    blankSlot[i] = value;
+  }
+  if (shadowValue > blankShadowSlot[i]) {
+    blankShadowSlot[i] = shadowValue;
+  }
+}
+
+// Releases every held bucket, when trailing blanking is turned off in the
+// middle of an envelope and blankFinish() will not run for it.
+void blankFlush() {
+  for (byte k = 0; k < BLANK_DELAY_MS; k++) {
+    byte i = (blankNext + k) % BLANK_DELAY_MS;
+    if (blankSlot[i] >= 0) {
+      peakFeed(blankSlot[i], blankShadowSlot[i]);
+      blankSlot[i] = -1;
+      blankShadowSlot[i] = -1;
+    }
+  }
+}
+
+// Envelope ended: release what lies before the trailing window, drop the rest.
+void blankFinish(unsigned long duration) {
+  unsigned long trail = CFG_BLANK_TRAIL;
+  if (CFG_BLANK_UNIT == BLANK_PERCENT) {
+    trail = duration * min(CFG_BLANK_TRAIL, BLANK_PERCENT_MAX) / 100;
+  }
+  trail = min(trail, (unsigned long)BLANK_DELAY_MS - 1);
+  blankTrailMs = trail;
+  unsigned long end = duration > trail ? duration - trail : 0;
+  for (; blankNext < end; blankNext++) {
+    byte i = blankNext % BLANK_DELAY_MS;
+    if (blankSlot[i] >= 0) {
+      peakFeed(blankSlot[i], blankShadowSlot[i]);
+      blankSlot[i] = -1;
+      blankShadowSlot[i] = -1;
     }
   }
 }
 
-void triggerStop(String reason) {
+// Called for every sample inside the envelope. Only the selected
+// estimator does any work beyond tracking the maximum.
+void peakAdd(PeakState& s, byte mode, int value) {
+  s.fed = true;
+  if (value > s.maximum) {
+    s.maximum = value;
+  }
+  if (mode == PEAK_TOPK) {
+    if (s.topCount == CFG_PEAK_TOPK && value <= s.top[s.topCount - 1]) {
+      return;
+    }
+    byte i = (s.topCount < CFG_PEAK_TOPK) ? s.topCount++ : s.topCount - 1;
+    while (i > 0 && s.top[i - 1] < value) {
+      s.top[i] = s.top[i - 1];
+      i--;
+    }
+    s.top[i] = value;
+  } else if (mode == PEAK_PLATEAU) {
+    int level = (long)s.maximum * CFG_PEAK_PLATEAU_PCT / 100;
+    if (value >= level) {
+      if (s.runLen > 0 && s.runMin < level) {
+        s.runLen = 0; // Maximum rose past this run, it no longer qualifies
+      }
+      if (s.runLen == 0) {
+        s.runSum = 0;
+        s.runMin = value;
+      }
+      s.runLen++;
+      s.runSum += value;
+      s.runMin = min(s.runMin, value);
+    } else if (s.runLen > 0) {
+      if (s.runLen > s.bestLen) {
+        s.bestLen = s.runLen;
+        s.bestSum = s.runSum;
+        s.bestMin = s.runMin;
+      }
+      s.runLen = 0;
+    }
+  }
+}
+
+int peakEstimate(const PeakState& s, byte mode) {
+  if (mode == PEAK_TOPK && s.topCount > 0) {
+    long sum = 0;
+    for (byte i = 0; i < s.topCount; i++) {
+      sum += s.top[i];
+    }
+    return sum / s.topCount;
+  }
+  if (mode == PEAK_PLATEAU) {
+    int level = (long)s.maximum * CFG_PEAK_PLATEAU_PCT / 100;
+    bool bestValid = s.bestLen > 0 && s.bestMin >= level;
+    if (s.runLen > 0 && s.runMin >= level && (!bestValid || s.runLen > s.bestLen)) {
+      return s.runSum / s.runLen;
+    }
+    if (bestValid) {
+      return s.bestSum / s.bestLen;
+    }
+  }
+  return s.maximum;
+}
+
+// Judges the finished envelope with the shadow configuration, counts the
+// outcome against the primary verdict and sends the SH: record.
+void shadowCompare() {
+  int peak = peakEstimate(peakMain, CFG_PEAK_MODE);
+  int shadowPeak = peakEstimate(peakShadow, CFG_SHADOW_PEAK_MODE);
+  byte verdict = envelopeVerdict(peak, CFG_CARD_THRESHOLD, CFG_CARD_UPPER_THRESHOLD);
+  byte shadowVerdict = envelopeVerdict(shadowPeak, CFG_SHADOW_THR, CFG_SHADOW_THR_UPPER);
+  shadowEnvelopes++;
+  if (verdict == shadowVerdict) {
+    shadowAgree++;
+  } else if (verdict == EVENT_PASS) {
+    shadowOnlyStops++;
+  } else if (shadowVerdict == EVENT_PASS) {
+    shadowMissedStops++;
+  }
+
+  if (!FEATURE_TELEMETRY || streamPeriod[STREAM_SHADOW] == 0 ||
+      (verdict == shadowVerdict && envelopeSeq % streamPeriod[STREAM_SHADOW] != 0)) {
+    return;
+  }
+  Serial.print(F("SH:"));
+  Serial.print(envelopeSeq);
+  Serial.print(F(","));
+  Serial.print(eventName(verdict));
+  Serial.print(F(","));
+  Serial.print(peak);
+  Serial.print(F(","));
+  Serial.print(eventName(shadowVerdict));
+  Serial.print(F(","));
+  Serial.println(shadowPeak);
+}
+
+// New shadow configuration: reseed its filter and start counting afresh.
+void shadowRestart() {
+  shadowFiltered = filteredValue;
+  shadowEnvelope = false;
+  shadowEnvelopes = 0;
+  shadowAgree = 0;
+  shadowOnlyStops = 0;
+  shadowMissedStops = 0;
+}
+
+// Stops the machine first, then reports: the report may block on a full
+// TX buffer.
+void triggerStop(byte code, int peak, int confidence) {
   machineStopActive = true;
   currentState = STATE_FAULT;
   digitalWrite(PIN_ENABLE_OUT, LOW); // Disable machine
-  Serial.println(reason);  // Send the error (already has ERR: prefix)
+  recordStopLatency();
+  faultCode = code;
+  warmSave();
+  reportEvent(code, peak, confidence);
+}
+
+// Prints a verdict/fault line, or buffers it while running autonomously.
+// Pass lines follow the EVT subscription; faults are always reported.
+void reportEvent(byte code, int peak, int confidence) {
+  bool isFault = (code >= FAULT_WATCHDOG_TIMEOUT);
+  if (autoLog.active) {
+    if (isFault) {
+      autoLog.faultCount++;
+    } else {
+      autoLog.passCount++;
+    }
+    if (autoLog.count == AUTO_BUFFER_SIZE) {
+      autoLog.dropped++; // Overwrite the oldest entry
+    } else {
+      autoLog.count++;
+    }
+    BufferedEvent& e = autoLog.events[autoLog.head];
+    e.ms = millis();
+    e.peak = peak;
+    e.code = code;
+    autoLog.head = (autoLog.head + 1) % AUTO_BUFFER_SIZE;
+    autoLogSeal();
+    return;
+  }
+  if (!isFault && streamPeriod[STREAM_EVT] == 0) {
+    return;
+  }
+  Serial.print(isFault ? F("ERR:") : F("EVT:"));
+  Serial.print(eventName(code));
+  if (peak >= 0) {
+    Serial.print(F(":"));
+    Serial.print(peak);
+  }
+  if (confidence != CONFIDENCE_NONE) {
+    Serial.print(F(":"));
+    Serial.print(confidence);
+  }
+  endStamped(millis());
+}
+
+// Replays what happened while the PC was away, oldest first. Verdicts
+// from now on are printed live; the buffer is sent by serviceReplies().
+// Format: SYNC:BEGIN,<passes>,<faults>,<dropped>,<duration ms>[ @<millis>]
+//         SYNC:EVT,<age ms>,<event name>,<peak>   (peak -1 = none)
+//         SYNC:END
+void syncAutonomousEvents() {
+  autoSyncMs = millis();
+  autoLog.active = false;
+  autoLogSeal();
+  autoSyncNext = 0;
+}
+
+// Sends line autoSyncNext of the SYNC reply and clears the buffer after
+// SYNC:END.
+void sendSyncLine() {
+  byte line = autoSyncNext++;
+  if (line == 0) {
+    Serial.print(F("SYNC:BEGIN,"));
+    Serial.print(autoLog.passCount);
+    Serial.print(F(","));
+    Serial.print(autoLog.faultCount);
+    Serial.print(F(","));
+    Serial.print(autoLog.dropped);
+    Serial.print(F(","));
+    Serial.print(autoSyncMs - autoLog.since);
+    endStamped(autoSyncMs); // Event times are autoSyncMs - age
+  } else if (line <= autoLog.count) {
+    byte index = (autoLog.head + AUTO_BUFFER_SIZE - autoLog.count + line - 1) % AUTO_BUFFER_SIZE;
+    const BufferedEvent& e = autoLog.events[index];
+    Serial.print(F("SYNC:EVT,"));
+    Serial.print(autoSyncMs - e.ms);
+    Serial.print(F(","));
+    Serial.print(eventName(e.code));
+    Serial.print(F(","));
+    Serial.println(e.peak);
+  } else {
+    Serial.println(F("SYNC:END"));
+    autoSyncNext = AUTO_SYNC_IDLE;
+    autoLog.pending = false;
+    autoLog.count = 0;
+    autoLog.passCount = 0;
+    autoLog.faultCount = 0;
+    autoLog.dropped = 0;
+    autoLogSeal();
+  }
+}
+
+unsigned int autoLogCrc() {
+  const byte* data = (const byte*)&autoLog;
+  unsigned int crc = 0xFFFF;
+  for (unsigned int i = 0; i < offsetof(AutonomousLog, crc); i++) {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+void autoLogSeal() {
+  autoLog.magic = AUTO_LOG_MAGIC;
+  autoLog.crc = autoLogCrc();
+}
+
+// Keeps the buffer across a warm restart, rebased onto the new millis()
+// through the snapshot's save time; anything else starts it empty.
+void autoLogRestore(bool warm) {
+  if (warm && autoLog.magic == AUTO_LOG_MAGIC && autoLog.crc == autoLogCrc() &&
+      autoLog.count <= AUTO_BUFFER_SIZE && autoLog.head < AUTO_BUFFER_SIZE) {
+    unsigned long shift = millis() - warmSnapshot.savedMs;
+    autoLog.since += shift;
+    for (byte i = 0; i < AUTO_BUFFER_SIZE; i++) {
+      autoLog.events[i].ms += shift;
+    }
+  } else {
+    memset(&autoLog, 0, sizeof(autoLog));
+  }
+  autoLogSeal();
+}
+
+void recordStopLatency() {
+  statStopLastUs = micros() - statSampleUs;
+  if (statStopLastUs > statStopMaxUs) {
+    statStopMaxUs = statStopLastUs;
+  }
 }
 
 void resetSystem() {
   machineStopActive = false;
+  faultCode = FAULT_NONE;
   currentState = STATE_IDLE;
   digitalWrite(PIN_ENABLE_OUT, HIGH); // Enable machine
   // Reset filter to avoid instant re-trigger
-  filteredValue = analogRead(PIN_SENSOR);
-  if (CFG_REVERSE_SENSOR) {
-    filteredValue = 1023 - filteredValue;
+  if (injectMode) {
+    filteredValue = sensorValue; // No live input to reseed from
+  } else {
+    filteredValue = analogRead(PIN_SENSOR);
+    if (CFG_REVERSE_SENSOR) {
+      filteredValue = 1023 - filteredValue;
+    }
+  }
+  shadowFiltered = filteredValue;
+  warmSave();
+  if (FEATURE_MESSAGES) {
+    Serial.println(F("MSG:System Resumed"));
+  }
+}
+
+// CRC-16 of the settings that judge an envelope: every persistent
+// parameter, the calibration table and the um thresholds. Kept in
+// warmConfigCrc, refreshed whenever one of them changes.
+unsigned int configCrc() {
+  unsigned int crc = 0xFFFF;
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    ParamDesc d;
+    memcpy_P(&d, &PARAMS[i], sizeof(d));
+    if (!d.persist) {
+      continue;
+    }
+    const byte* v = (const byte*)d.var;
+    for (byte b = 0; b < paramSize(d.type); b++) {
+      crc = _crc16_update(crc, v[b]);
+    }
+  }
+  const byte* um = (const byte*)&CFG_CARD_THRESHOLD_UM;
+  const byte* upperUm = (const byte*)&CFG_CARD_UPPER_THRESHOLD_UM;
+  for (byte b = 0; b < sizeof(long); b++) {
+    crc = _crc16_update(crc, um[b]);
+    crc = _crc16_update(crc, upperUm[b]);
+  }
+  crc = _crc16_update(crc, calCount);
+  for (int i = 0; i < calCount; i++) {
+    crc = _crc16_update(crc, calAdc[i] & 0xFF);
+    crc = _crc16_update(crc, calAdc[i] >> 8);
+    crc = _crc16_update(crc, calUm[i] & 0xFF);
+    crc = _crc16_update(crc, calUm[i] >> 8);
+  }
+  return crc;
+}
+
+unsigned int warmCrc() {
+  const byte* data = (const byte*)&warmSnapshot;
+  unsigned int crc = 0xFFFF;
+  for (byte i = 0; i < offsetof(WarmSnapshot, crc); i++) {
+    crc = _crc16_update(crc, data[i]);
+  }
+  return crc;
+}
+
+void warmSave() {
+  warmSavedMs = millis();
+  if (injectMode) {
+    return;
+  }
+  WarmSnapshot& w = warmSnapshot;
+  w.magic = WARM_MAGIC;
+  w.state = currentState;
+  w.faultCode = faultCode;
+  w.envelopeState = envelopeState;
+  w.filteredValue = filteredValue;
+  w.shadowFiltered = shadowFiltered;
+  w.noiseFloorQ4 = noiseFloorQ4;
+  w.noiseMadQ4 = noiseMadQ4;
+  w.envelopeSeq = envelopeSeq;
+  w.envelopeAgeMs = warmSavedMs - envelopeStartMs;
+  w.envelopeSamples = envelopeSamples;
+  w.lastEnvelopeMs = lastEnvelopeMs;
+  w.blankNext = blankNext;
+  w.blankLeadMs = blankLeadMs;
+  w.peak = peakMain;
+  w.shadowEnvelopes = shadowEnvelopes;
+  w.shadowAgree = shadowAgree;
+  w.shadowOnlyStops = shadowOnlyStops;
+  w.shadowMissedStops = shadowMissedStops;
+  w.configCrc = warmConfigCrc;
+  w.savedMs = warmSavedMs;
+  w.crc = warmCrc();
+}
+
+// Returns WARM_COLD unless the snapshot survived the reset intact, and
+// WARM_LATCH if it was taken with other settings than the ones loaded.
+byte warmRestore() {
+  const WarmSnapshot& w = warmSnapshot;
+  if (w.magic != WARM_MAGIC || w.crc != warmCrc() || w.state > STATE_FAULT) {
+    return WARM_COLD;
+  }
+  faultCode = w.faultCode;
+  machineStopActive = (faultCode != FAULT_NONE);
+  envelopeSeq = w.envelopeSeq;
+  if (w.configCrc != warmConfigCrc) {
+    currentState = machineStopActive ? STATE_FAULT : STATE_IDLE;
+    return WARM_LATCH;
+  }
+  currentState = (SystemState)w.state;
+  envelopeState = w.envelopeState;
+  filteredValue = w.filteredValue;
+  shadowFiltered = w.shadowFiltered;
+  noiseFloorQ4 = w.noiseFloorQ4;
+  noiseMadQ4 = w.noiseMadQ4;
+  envelopeStartMs = millis() - w.envelopeAgeMs;
+  envelopeSamples = w.envelopeSamples;
+  lastEnvelopeMs = w.lastEnvelopeMs;
+  blankNext = w.blankNext;
+  blankLeadMs = w.blankLeadMs;
+  for (byte i = 0; i < BLANK_DELAY_MS; i++) {
+    blankSlot[i] = -1;
+    blankShadowSlot[i] = -1;
+  }
+  peakMain = w.peak;
+  shadowEnvelopes = w.shadowEnvelopes;
+  shadowAgree = w.shadowAgree;
+  shadowOnlyStops = w.shadowOnlyStops;
+  shadowMissedStops = w.shadowMissedStops;
+  sensorValue = (int)filteredValue;
+  isEnvelopePresent = (envelopeState == LOW);
+  return WARM_FULL;
+}
+
+// ------------------------------------------------------------
+// CALIBRATION
+// ------------------------------------------------------------
+
+// Converts a filtered ADC value to micrometres using the uploaded table.
+int calToUm(int adc) {
+  int seg = 0;
+  while (seg < calCount - 2 && adc >= calAdc[seg + 1]) {
+    seg++;
+  }
+  long um = calUm[seg] + (((long)(adc - calAdc[seg]) * calSlopeQ8[seg]) >> 8);
+  return (int)constrain(um, 0L, CAL_MAX_UM);
+}
+
+// Inverse of calToUm(), only used when a threshold is set in um.
+int calToAdc(long um) {
+  int seg = 0;
+  while (seg < calCount - 2 && um >= calUm[seg + 1]) {
+    seg++;
+  }
+  long adc = calAdc[seg] + (um - calUm[seg]) * 256 / calSlopeQ8[seg];
+  return constrain(adc, 0, 1023);
+}
+
+// Appends a point; rejects points outside 0..1023 / 0..CAL_MAX_UM and
+// points that break monotonicity or are too steep.
+bool calAddPoint(long adc, long um) {
+  if (calCount >= CAL_MAX_POINTS || adc < 0 || adc > 1023 || um < 0 || um > CAL_MAX_UM) {
+    return false;
+  }
+  if (calCount > 0) {
+    int prev = calCount - 1;
+    if (adc <= calAdc[prev] || um <= calUm[prev]) {
+      return false;
+    }
+    long slope = ((long)(um - calUm[prev]) << 8) / (adc - calAdc[prev]);
+    if (slope < 1 || slope > CAL_MAX_SLOPE_Q8) {
+      return false;
+    }
+    calSlopeQ8[prev] = slope;
+  }
+  calAdc[calCount] = adc;
+  calUm[calCount] = um;
+  calCount++;
+  return true;
+}
+
+// Re-derives ADC thresholds from um thresholds after the table changed.
+void calApplyThresholds() {
+  if (calCount < 2) {
+    return;
+  }
+  if (CFG_CARD_THRESHOLD_UM >= 0) {
+    CFG_CARD_THRESHOLD = calToAdc(CFG_CARD_THRESHOLD_UM);
+  }
+  if (CFG_CARD_UPPER_THRESHOLD_UM >= 0) {
+    CFG_CARD_UPPER_THRESHOLD = calToAdc(CFG_CARD_UPPER_THRESHOLD_UM);
+  }
+}
+
+// ------------------------------------------------------------
+// SERIAL RX
+// ------------------------------------------------------------
+
+// Drains the RX buffer: the remote stop byte anywhere, binary parameter
+// frames at a line start, everything else into the line buffer.
+void serviceRx() {
+  if (paramFramePos > 0 && millis() - paramFrameSince > PARAM_FRAME_TIMEOUT) {
+    // A stray sync byte must not swallow the text command behind it
+    byte pending = paramFramePos;
+    paramFramePos = 0;
+    paramFrameEscaped = false;
+    for (byte i = 1; i < pending; i++) {
+      if (rxTextByte(paramFrame[i])) {
+        return;
+      }
+    }
+  }
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+    if (c == REMOTE_STOP_BYTE) {
+      paramFramePos = 0;
+      paramFrameEscaped = false;
+      remoteStop();
+    } else if (paramFramePos > 0 || (rxLineLen == 0 && !rxLineOverflow && c == PARAM_FRAME_SYNC)) {
+      if (paramFramePos == 0) {
+        paramFrameSince = millis();
+      } else if (paramFrameEscaped) {
+        c ^= PARAM_FRAME_ESC_XOR;
+        paramFrameEscaped = false;
+      } else if (c == PARAM_FRAME_ESC) {
+        paramFrameEscaped = true;
+        continue;
+      }
+      paramFrame[paramFramePos++] = c;
+      if (paramFramePos == PARAM_FRAME_LEN) {
+        paramFramePos = 0;
+        processParamFrame();
+      }
+    } else if (rxTextByte(c)) {
+      return; // Following bytes are sample frames for serviceInjection()
+    }
+  }
+}
+
+// Adds a byte to the line buffer and runs the command at a newline.
+// Returns true when that command entered injection mode.
+bool rxTextByte(char c) {
+  if (c == '\n') {
+    if (!rxLineOverflow) {
+      rxLine[rxLineLen] = '\0';
+      String command(rxLine);
+      command.trim();
+      processCommand(command);
+    }
+    rxLineLen = 0;
+    rxLineOverflow = false;
+    return injectMode;
+  }
+  if (rxLineLen < RX_LINE_MAX) {
+    rxLine[rxLineLen++] = c;
+  } else {
+    rxLineOverflow = true;
+  }
+  return false;
+}
+
+void remoteStop() {
+  if (machineStopActive) {
+    digitalWrite(PIN_ENABLE_OUT, LOW);
+    return;
+  }
+  statSampleUs = rxPollUs; // Latency is counted from the poll before the byte
+  triggerStop(FAULT_REMOTE_STOP);
+  statRemoteLastUs = statStopLastUs;
+  if (statRemoteLastUs > statRemoteMaxUs) {
+    statRemoteMaxUs = statRemoteLastUs;
   }
-  Serial.println("MSG:System Resumed");
 }
 
 // ------------------------------------------------------------
@@ -250,59 +2289,525 @@ void processCommand(String cmd) {
   // Heartbeat
   if (cmd == "PING") {
     lastPingReceived = millis();
+    if (autoLog.pending && autoSyncNext == AUTO_SYNC_IDLE) {
+      syncAutonomousEvents();
+    }
     // Ready LED stays solid ON; no toggling
     return;
   }
 
+  // Clock sync probe, see EVENT TIMESTAMPS
+  if (cmd == "TIME?") {
+    Serial.print(F("TIME:"));
+    Serial.println(millis());
+    return;
+  }
+
+  // Same as REMOTE_STOP_BYTE, for terminals
+  if (cmd == "STOP") {
+    remoteStop();
+    return;
+  }
+
   // Resume after fault
   if (cmd == "RESUME") {
     resetSystem();
     return;
   }
 
-  // Configuration: Set Lower Threshold (e.g., "SET_THR:150")
-  if (cmd.startsWith("SET_THR:")) {
-    int val = cmd.substring(8).toInt();
-    if (val > 0 && val <= 1023) {
-      CFG_CARD_THRESHOLD = val;
-      Serial.print("MSG:Card Threshold Set to ");
-      Serial.println(CFG_CARD_THRESHOLD);
+  // Link speed change (e.g., "SET_BAUD:1000000"), see LINK BAUD NEGOTIATION
+  // Refused when the rate is unsupported or too slow for the subscribed streams.
+  if (cmd.startsWith("SET_BAUD:")) {
+    unsigned long baud = cmd.substring(9).toInt();
+    bool supported = false;
+    for (byte i = 0; i < BAUD_RATE_COUNT; i++) {
+      if (BAUD_RATES[i] == baud) {
+        supported = true;
+      }
+    }
+    if (!supported || streamLoadTotal() > linkBudget(baud)) {
+      Serial.print(F("BAUD:REJECTED,"));
+      Serial.println(baud);
+      return;
+    }
+    Serial.print(F("BAUD:SWITCH,"));
+    Serial.println(baud);
+    // Keep the original rate as the fallback across repeated requests
+    if (baudFallback == 0) {
+      baudFallback = linkBaud;
+    }
+    setLinkBaud(baud);
+    baudSwitchSince = millis();
+    lastPingReceived = baudSwitchSince; // The PC is busy switching, not gone
+    return;
+  }
+
+  // Verification ping after SET_BAUD; also answers when no switch is pending
+  if (cmd == "BAUD_CHECK") {
+    baudFallback = 0;
+    lastPingReceived = millis();
+    Serial.print(F("BAUD:OK,"));
+    Serial.println(linkBaud);
+    return;
+  }
+
+  // Loop statistics, see LOOP STATISTICS
+  // Format: STAT:Profile,Loops,AvgLoopUs,MaxLoopUs,LastStopUs,MaxStopUs,
+  //              LastRemoteStopUs,MaxRemoteStopUs[,AvgDetectUs,MaxDetectUs]
+  // The detector fields are only in DIAGNOSTIC builds. Loop and detector
+  // counters restart after each report.
+  if (cmd == "STATS") {
+    Serial.print(F("STAT:"));
+    Serial.print(BUILD_PROFILE);
+    Serial.print(F(","));
+    Serial.print(statLoopCount);
+    Serial.print(F(","));
+    Serial.print(statLoopCount > 0 ? statLoopSumUs / statLoopCount : 0);
+    Serial.print(F(","));
+    Serial.print(statLoopMaxUs);
+    Serial.print(F(","));
+    Serial.print(statStopLastUs);
+    Serial.print(F(","));
+    Serial.print(statStopMaxUs);
+    Serial.print(F(","));
+    Serial.print(statRemoteLastUs);
+    Serial.print(F(","));
+    Serial.print(statRemoteMaxUs);
+    if (FEATURE_STATS) {
+      Serial.print(F(","));
+      Serial.print(statDetectCount > 0 ? (float)statDetectSumUs / statDetectCount : 0.0, 1);
+      Serial.print(F(","));
+      Serial.print(statDetectMaxUs);
+    }
+    Serial.println();
+    statLoopCount = 0;
+    statLoopSumUs = 0;
+    statLoopMaxUs = 0;
+    statDetectCount = 0;
+    statDetectSumUs = 0;
+    statDetectMaxUs = 0;
+    return;
+  }
+
+  // Enter sample injection mode (e.g., "INJECT:1" or "INJECT:1,1")
+  // Argument is the sample period in ms; ",1" enables auto-resume after faults.
+  if (FEATURE_INJECTION && cmd.startsWith("INJECT:")) {
+    int comma = cmd.indexOf(',');
+    int period = (comma > 0 ? cmd.substring(7, comma) : cmd.substring(7)).toInt();
+    if (period > 0 && period <= 1000) {
+      injectSampleMs = period;
+      injectAutoResume = (comma > 0 && cmd.substring(comma + 1).toInt() == 1);
+      injectClock = 0;
+      injectFrames = 0;
+      injectFramePos = 0;
+      resetSystem(); // Every replay starts from a cleared fault latch
+      peakReset();
+      injectMode = true;
+      Serial.println(F("MSG:INJECT_READY"));
+    }
+    return;
+  }
+
+  // Shadow detector counters (e.g., "SHADOW?"), see SHADOW DETECTOR
+  // "SHADOW_RESET" restarts them.
+  if (FEATURE_SHADOW && cmd == "SHADOW?") {
+    Serial.print(F("SHADOW:"));
+    Serial.print(shadowEnvelopes);
+    Serial.print(F(","));
+    Serial.print(shadowAgree);
+    Serial.print(F(","));
+    Serial.print(shadowEnvelopes - shadowAgree);
+    Serial.print(F(","));
+    Serial.print(shadowOnlyStops);
+    Serial.print(F(","));
+    Serial.println(shadowMissedStops);
+    return;
+  }
+  if (FEATURE_SHADOW && cmd == "SHADOW_RESET") {
+    shadowRestart();
+    return;
+  }
+
+  // Blanking windows the last envelope got, in ms (e.g., "BLANK?"),
+  // see BLANKING. Format: BLANK:<lead ms>,<trail ms>
+  if (cmd == "BLANK?") {
+    Serial.print(F("BLANK:"));
+    Serial.print(blankLeadMs);
+    Serial.print(F(","));
+    Serial.println(blankTrailMs);
+    return;
+  }
+
+  // Envelope archive (e.g., "GET_ENV:1234", "ENV?"), see ENVELOPE ARCHIVE
+  if (FEATURE_TELEMETRY && cmd.startsWith("GET_ENV:")) {
+    envRequest(cmd.substring(8).toInt());
+    return;
+  }
+  if (FEATURE_TELEMETRY && cmd == "ENV?") {
+    envList();
+    return;
+  }
+
+  // Calibration: Clear table (e.g., "CAL_CLEAR")
+  // Thresholds set in um go with it; the ADC thresholds they last gave stay.
+  if (cmd == "CAL_CLEAR") {
+    calCount = 0;
+    CFG_CARD_THRESHOLD_UM = -1;
+    CFG_CARD_UPPER_THRESHOLD_UM = -1;
+    warmConfigCrc = configCrc();
+    if (FEATURE_MESSAGES) {
+      Serial.println(F("MSG:Calibration Cleared"));
+    }
+    return;
+  }
+
+  // Calibration: Append point ADC,um (e.g., "CAL_ADD:120,0")
+  // A point calAddPoint() refuses is answered with ERR:REJECTED.
+  if (cmd.startsWith("CAL_ADD:")) {
+    int comma = cmd.indexOf(',');
+    if (comma > 0 && calAddPoint(cmd.substring(8, comma).toInt(), cmd.substring(comma + 1).toInt())) {
+      calApplyThresholds();
+      warmConfigCrc = configCrc();
+      if (FEATURE_MESSAGES) {
+        Serial.print(F("MSG:Calibration Points "));
+        Serial.println(calCount);
+      }
+    } else {
+      paramReject(-1);
+    }
+    return;
+  }
+
+  // Configuration: Thresholds in um, needs a calibration table
+  // (e.g., "SET_THR_UM:500", "SET_THR_UPPER_UM:1800"). Values outside
+  // 0..CAL_MAX_UM, or no table, are answered with ERR:REJECTED.
+  if (cmd.startsWith("SET_THR_UM:") || cmd.startsWith("SET_THR_UPPER_UM:")) {
+    bool upper = cmd.startsWith("SET_THR_UPPER_UM:");
+    long um = cmd.substring(upper ? 17 : 11).toInt();
+    if (calCount < 2 || um < 0 || um > CAL_MAX_UM) {
+      paramReject(-1);
+    } else {
+      if (upper) {
+        CFG_CARD_UPPER_THRESHOLD_UM = um;
+      } else {
+        CFG_CARD_THRESHOLD_UM = um;
+      }
+      calApplyThresholds();
+      warmConfigCrc = configCrc();
+      if (FEATURE_MESSAGES) {
+        Serial.print(upper ? F("MSG:Card Upper Threshold Set to ") : F("MSG:Card Threshold Set to "));
+        Serial.println(upper ? CFG_CARD_UPPER_THRESHOLD : CFG_CARD_THRESHOLD);
+      }
+    }
+    return;
+  }
+
+  // Telemetry subscriptions (e.g., "SUBSCRIBE:RAW,10", "SUBSCRIBE:AGG,0")
+  // "SUBSCRIBE?" lists all streams and the current link load.
+  if (FEATURE_TELEMETRY && cmd.startsWith("SUBSCRIBE")) {
+    int comma = cmd.indexOf(',');
+    if (cmd.startsWith("SUBSCRIBE:") && comma > 0) {
+      String name = cmd.substring(10, comma);
+      long period = cmd.substring(comma + 1).toInt();
+      for (byte i = 0; i < STREAM_COUNT; i++) {
+        const char* streamName = (const char*)pgm_read_ptr(&STREAM_NAMES[i]);
+        if (strcmp_P(name.c_str(), streamName) == 0 && period >= 0 && period <= 60000) {
+          if (subscribe(i, period)) {
+            reportSubscriptions(i);
+          }
+        }
+      }
+    } else {
+      reportSubscriptions(STREAM_COUNT);
+    }
+    return;
+  }
+
+  // Parameter registry (e.g., "GET:THR", "SET:THR=150", "SET:0=150", "LIST")
+  // Replies: PRM:<id>,<name>,<value>; LIST adds type, range, unit and persist.
+  // A refused SET replies ERR:REJECTED with the allowed range, see paramReject.
+  if (cmd == "LIST") {
+    replyListNext = 0; // Sent by serviceReplies()
+    return;
+  }
+  if (cmd.startsWith("GET:")) {
+    int id = paramFind(cmd.substring(4));
+    if (id >= 0) {
+      paramReport(id, false);
+    } else {
+      Serial.println(F("PRM:UNKNOWN"));
+    }
+    return;
+  }
+  if (cmd.startsWith("SET:")) {
+    int eq = cmd.indexOf('=');
+    int id = eq > 0 ? paramFind(cmd.substring(4, eq)) : -1;
+    if (id >= 0 && paramSet(id, cmd.substring(eq + 1).toFloat())) {
+      paramReport(id, false);
+    } else {
+      paramReject(id);
+    }
+    return;
+  }
+  // Store persist-flagged parameters in EEPROM (e.g., "SAVE")
+  if (cmd == "SAVE") {
+    paramSave();
+    if (FEATURE_MESSAGES) {
+      Serial.println(F("MSG:Parameters Saved"));
+    }
+    return;
+  }
+
+  // Legacy configuration commands (e.g., "SET_THR:150", "SET_REVERSE:1")
+  for (byte i = 0; i < sizeof(LEGACY_COMMANDS) / sizeof(LEGACY_COMMANDS[0]); i++) {
+    LegacyCommand legacy;
+    memcpy_P(&legacy, &LEGACY_COMMANDS[i], sizeof(legacy));
+    byte prefixLen = strlen_P(legacy.prefix);
+    if (strncmp_P(cmd.c_str(), legacy.prefix, prefixLen) == 0) {
+      long value = cmd.substring(prefixLen).toInt();
+      if (legacy.on != nullptr) {
+        value = (value == 1);
+      }
+      if (paramSet(legacy.id, value) && FEATURE_MESSAGES) {
+        Serial.print((const __FlashStringHelper*)legacy.reply);
+        if (legacy.on != nullptr) {
+          Serial.println((const __FlashStringHelper*)(value ? legacy.on : legacy.off));
+        } else {
+          ParamDesc d;
+          memcpy_P(&d, &PARAMS[legacy.id], sizeof(d));
+          Serial.println((long)paramGet(d));
+        }
+      }
+      return;
     }
   }
+}
 
-  // Configuration: Set Upper Threshold (e.g., "SET_THR_UPPER:800")
-  if (cmd.startsWith("SET_THR_UPPER:")) {
-    int val = cmd.substring(14).toInt();
-    if (val > 0 && val <= 1023) {
-      CFG_CARD_UPPER_THRESHOLD = val;
-      Serial.print("MSG:Card Upper Threshold Set to ");
-      Serial.println(CFG_CARD_UPPER_THRESHOLD);
+// ------------------------------------------------------------
+// PARAMETER REGISTRY
+// ------------------------------------------------------------
+
+// Accepts a parameter name or a numeric id; returns -1 if unknown.
+int paramFind(const String& key) {
+  if (key.length() > 0 && isDigit(key.charAt(0))) {
+    long id = key.toInt();
+    return (id >= 0 && id < PARAM_COUNT) ? (int)id : -1;
+  }
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    const char* name = (const char*)pgm_read_ptr(&PARAMS[i].name);
+    if (strcmp_P(key.c_str(), name) == 0) {
+      return i;
     }
   }
+  return -1;
+}
+
+float paramGet(const ParamDesc& d) {
+  switch (d.type) {
+    case PT_BYTE:  return *(byte*)d.var;
+    case PT_INT:   return *(int*)d.var;
+    case PT_UINT:  return *(unsigned int*)d.var;
+    case PT_ULONG: return *(unsigned long*)d.var;
+    default:       return *(float*)d.var;
+  }
+}
+
+byte paramSize(byte type) {
+  switch (type) {
+    case PT_BYTE:  return sizeof(byte);
+    case PT_INT:   return sizeof(int);
+    case PT_UINT:  return sizeof(unsigned int);
+    case PT_ULONG: return sizeof(unsigned long);
+    default:       return sizeof(float);
+  }
+}
+
+// Range-checks and stores a value. Returns false if it was rejected.
+bool paramSet(byte id, float value) {
+  if (id >= PARAM_COUNT || (id == P_OVERRIDE && !FEATURE_OVERRIDE)) {
+    return false;
+  }
+  ParamDesc d;
+  memcpy_P(&d, &PARAMS[id], sizeof(d));
+  if (value < d.minVal || value > d.maxVal) {
+    return false;
+  }
+  switch (d.type) {
+    case PT_BYTE:  *(byte*)d.var = (byte)value; break;
+    case PT_INT:   *(int*)d.var = (int)value; break;
+    case PT_UINT:  *(unsigned int*)d.var = (unsigned int)value; break;
+    case PT_ULONG: *(unsigned long*)d.var = (unsigned long)value; break;
+    default:       *(float*)d.var = value; break;
+  }
+  paramChanged(id);
+  return true;
+}
+
+// Side effects of parameters that other state depends on.
+void paramChanged(byte id) {
+  switch (id) {
+    case P_THR:
+      CFG_CARD_THRESHOLD_UM = -1; // ADC threshold now takes precedence
+      break;
+    case P_THR_UPPER:
+      CFG_CARD_UPPER_THRESHOLD_UM = -1;
+      break;
+    case P_TELEM_MODE:
+      lastSentValue = -1; // Start the new mode with a full record
+      break;
+    case P_BLANK_TRAIL:
+      if (CFG_BLANK_TRAIL == 0 && currentState == STATE_MEASURING) {
+        blankFlush(); // Samples held back so far still count
+      }
+      break;
+    case P_PEAK_MODE:
+    case P_PEAK_TOPK:
+      peakReset(); // An envelope in progress is judged on its remaining samples
+      break;
+    case P_SHADOW:
+    case P_SHADOW_THR:
+    case P_SHADOW_THR_UPPER:
+    case P_SHADOW_ALPHA:
+    case P_SHADOW_PEAK_MODE:
+      shadowRestart();
+      break;
+    case P_THUMB_POINTS:
+      // Pairwise merging needs an even count; 16 and 32 are the intended sizes
+      if (CFG_THUMB_POINTS > 0) {
+        CFG_THUMB_POINTS = (CFG_THUMB_POINTS <= 16) ? 16 : THUMB_MAX;
+      }
+      thumbReset(); // An envelope in progress gets a partial thumbnail
+      break;
+  }
+  warmConfigCrc = configCrc();
+}
+
+// Format: PRM:<id>,<name>,<value>
+//    full: PRM:<id>,<name>,<type>,<min>,<max>,<unit>,<persist>,<value>
+void paramReport(byte id, bool full) {
+  ParamDesc d;
+  memcpy_P(&d, &PARAMS[id], sizeof(d));
+  byte decimals = (d.type == PT_FLOAT) ? 3 : 0;
+  Serial.print(F("PRM:"));
+  Serial.print(id);
+  Serial.print(F(","));
+  Serial.print((const __FlashStringHelper*)d.name);
+  Serial.print(F(","));
+  if (full) {
+    Serial.print("BIULF"[d.type]);
+    Serial.print(F(","));
+    Serial.print(d.minVal, decimals);
+    Serial.print(F(","));
+    Serial.print(d.maxVal, decimals);
+    Serial.print(F(","));
+    Serial.print((const __FlashStringHelper*)d.unit);
+    Serial.print(F(","));
+    Serial.print(d.persist ? 1 : 0);
+    Serial.print(F(","));
+  }
+  Serial.println(paramGet(d), decimals);
+}
+
+// A SET the registry refused: outside the range or not in this build. An
+// id of -1 has no range to report: unknown name, or a calibration
+// command (CAL_ADD, SET_THR_UM) that was refused. Not a fault, nothing
+// stops.
+// Format: ERR:REJECTED[,<name>,<min>,<max>]
+void paramReject(int id) {
+  Serial.print(F("ERR:REJECTED"));
+  if (id >= 0) {
+    ParamDesc d;
+    memcpy_P(&d, &PARAMS[id], sizeof(d));
+    byte decimals = (d.type == PT_FLOAT) ? 3 : 0;
+    Serial.print(F(","));
+    Serial.print((const __FlashStringHelper*)d.name);
+    Serial.print(F(","));
+    Serial.print(d.minVal, decimals);
+    Serial.print(F(","));
+    Serial.print(d.maxVal, decimals);
+  }
+  Serial.println();
+}
 
-  // Configuration: Set Floor Value (e.g., "SET_FLOOR:100")
-  if (cmd.startsWith("SET_FLOOR:")) {
-    int val = cmd.substring(10).toInt();
-    if (val >= 0 && val <= 1023) {
-      CFG_FLOOR_VALUE = val;
-      Serial.print("MSG:Floor Value Set to ");
-      Serial.println(CFG_FLOOR_VALUE);
+// Runs the binary parameter frame collected in paramFrame.
+void processParamFrame() {
+  const byte* frame = paramFrame;
+  byte op = frame[1];
+  byte id = frame[2];
+  if (id >= PARAM_COUNT) {
+    Serial.println(F("PRM:UNKNOWN"));
+    return;
+  }
+  if (op == PARAM_OP_SET) {
+    ParamDesc d;
+    memcpy_P(&d, &PARAMS[id], sizeof(d));
+    unsigned long bits = (unsigned long)frame[3] | ((unsigned long)frame[4] << 8) |
+                         ((unsigned long)frame[5] << 16) | ((unsigned long)frame[6] << 24);
+    float value;
+    if (d.type == PT_FLOAT) {
+      memcpy(&value, &bits, sizeof(value));
+    } else {
+      value = (long)bits;
     }
+    if (!paramSet(id, value)) {
+      paramReject(id);
+      return;
+    }
+  }
+  paramReport(id, false);
+}
+
+byte paramChecksum(const byte* data, int len, byte sum) {
+  for (int i = 0; i < len; i++) {
+    sum = (sum << 1 | sum >> 7) ^ data[i];
   }
+  return sum;
+}
 
-  // Configuration: Set Reverse Sensor (e.g., "SET_REVERSE:1")
-  if (cmd.startsWith("SET_REVERSE:")) {
-    int val = cmd.substring(12).toInt();
-    CFG_REVERSE_SENSOR = (val == 1);
-    Serial.print("MSG:Reverse Sensor ");
-    Serial.println(CFG_REVERSE_SENSOR ? "Enabled" : "Disabled");
+void paramSave() {
+  int addr = EEPROM_PARAMS_ADDR;
+  EEPROM.put(addr, EEPROM_PARAMS_MAGIC);
+  addr += sizeof(EEPROM_PARAMS_MAGIC);
+  byte sum = PARAM_COUNT; // A table of a different size never validates
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    ParamDesc d;
+    memcpy_P(&d, &PARAMS[i], sizeof(d));
+    byte slot[4] = {0, 0, 0, 0};
+    memcpy(slot, d.var, min(paramSize(d.type), sizeof(slot)));
+    for (byte b = 0; b < sizeof(slot); b++) {
+      EEPROM.update(addr++, slot[b]);
+    }
+    sum = paramChecksum(slot, sizeof(slot), sum);
   }
+  EEPROM.update(addr, sum);
+}
 
-  // Configuration: Set System Override (e.g., "SET_OVERRIDE:1")
-  if (cmd.startsWith("SET_OVERRIDE:")) {
-    int val = cmd.substring(13).toInt();
-    CFG_SYSTEM_OVERRIDE = (val == 1);
-    Serial.print("MSG:System Override ");
-    Serial.println(CFG_SYSTEM_OVERRIDE ? "ENABLED - Safety bypassed!" : "Disabled");
+// Restores persist-flagged parameters; false if EEPROM holds no valid set.
+bool paramLoad() {
+  int addr = EEPROM_PARAMS_ADDR;
+  unsigned int magic;
+  EEPROM.get(addr, magic);
+  if (magic != EEPROM_PARAMS_MAGIC) {
+    return false;
+  }
+  addr += sizeof(magic);
+  byte slots[PARAM_COUNT][4];
+  byte sum = PARAM_COUNT; // A table of a different size never validates
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    for (byte b = 0; b < 4; b++) {
+      slots[i][b] = EEPROM.read(addr++);
+    }
+    sum = paramChecksum(slots[i], 4, sum);
   }
-}
\ No newline at end of file
+  if (EEPROM.read(addr) != sum) {
+    return false;
+  }
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    ParamDesc d;
+    memcpy_P(&d, &PARAMS[i], sizeof(d));
+    if (d.persist) {
+      memcpy(d.var, slots[i], min(paramSize(d.type), sizeof(slots[i])));
+    }
+  }
+  return true;
+}
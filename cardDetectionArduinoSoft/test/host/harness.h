@@ -0,0 +1,230 @@
+#pragma once
+
+// --- HOST TEST HARNESS ---
+// Each test is one program that includes the firmware, so its globals
+// and types are visible to the checks. run_tests.sh builds every test_*.cpp
+// once per build profile. The board is driven through the stub globals:
+//   g_adc / g_env  sensor and envelope inputs
+//   g_pin8         PIN_ENABLE_OUT as last written (-1 = never)
+//   g_txroom       what Serial.availableForWrite() reports
+// and one loop() pass is one step(). A test exits non-zero if a CHECK
+// failed.
+
+#include "../../src/main.cpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+unsigned long g_micros = 0;
+int g_txroom           = 63;
+int g_adc              = 100;
+int g_env              = HIGH;
+int g_pin8             = -1;
+HardwareSerial Serial;
+EEPROMClass EEPROM;
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      ++failures;                                                          \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ")\n";  \
+    }                                                                      \
+  } while (0)
+
+// Substring check that shows the output it searched on failure
+#define CHECK_HAS(out, text)                                               \
+  do {                                                                     \
+    const std::string& out_ = (out);                                       \
+    if (out_.find(text) == std::string::npos) {                            \
+      ++failures;                                                          \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": missing \"" << (text) \
+                << "\" in:\n" << out_ << "\n";                             \
+    }                                                                      \
+  } while (0)
+
+#define CHECK_LACKS(out, text)                                             \
+  do {                                                                     \
+    const std::string& out_ = (out);                                       \
+    if (out_.find(text) != std::string::npos) {                            \
+      ++failures;                                                          \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": unexpected \""        \
+                << (text) << "\" in:\n" << out_ << "\n";                   \
+    }                                                                      \
+  } while (0)
+
+// Returns and clears everything the firmware has written
+std::string take() {
+  std::string o = Serial.out;
+  Serial.out.clear();
+  return o;
+}
+
+// Runs n loop passes, advancing the clock by us after each
+void step(int n = 1, unsigned long us = 1000) {
+  for (int i = 0; i < n; i++) {
+    loop();
+    g_micros += us;
+  }
+}
+
+// Queues bytes for the firmware and runs loop() until they are read
+void send(const std::string& bytes, int passes = 5) {
+  Serial.feed(bytes);
+  step(passes);
+}
+
+// Lines of out that start with prefix
+std::vector<std::string> lines(const std::string& out, const std::string& prefix) {
+  std::vector<std::string> r;
+  size_t pos = 0;
+  while (pos < out.size()) {
+    size_t end = out.find('\n', pos);
+    if (end == std::string::npos) {
+      end = out.size();
+    }
+    std::string l = out.substr(pos, end - pos);
+    if (!l.empty() && l.back() == '\r') {
+      l.pop_back();
+    }
+    if (l.compare(0, prefix.size(), prefix) == 0) {
+      r.push_back(l);
+    }
+    pos = end + 1;
+  }
+  return r;
+}
+
+// Binary injection frame for one sample word (see SAMPLE INJECTION)
+std::string injectFrameBytes(unsigned int word) {
+  return std::string{(char)INJECT_SYNC, (char)(word & 0xFF), (char)(word >> 8)};
+}
+
+// Binary parameter frame, escaped the way param_frame.py sends it
+std::string paramFrameBytes(byte op, byte id, unsigned long bits) {
+  byte raw[6] = {op, id, (byte)bits, (byte)(bits >> 8), (byte)(bits >> 16), (byte)(bits >> 24)};
+  std::string f(1, (char)PARAM_FRAME_SYNC);
+  for (byte b : raw) {
+    if (b == REMOTE_STOP_BYTE || b == PARAM_FRAME_ESC) {
+      f += (char)PARAM_FRAME_ESC;
+      b ^= PARAM_FRAME_ESC_XOR;
+    }
+    f += (char)b;
+  }
+  return f;
+}
+
+// --- RESETS ---
+// A reset is modelled with fork(): the untouched parent process is the
+// board at power-on, each child is one run of the firmware. What survives
+// a reset with the RAM powered (the .noinit objects) and EEPROM is passed
+// from one run to the next as a Retained image.
+struct Retained {
+  std::vector<uint8_t> noinit;
+  std::vector<uint8_t> eeprom;
+};
+
+// The firmware's .noinit objects
+struct NoinitObject {
+  void* at;
+  size_t size;
+};
+static const NoinitObject NOINIT[] = {
+  {&warmSnapshot, sizeof warmSnapshot},
+  {&autoLog, sizeof autoLog},
+};
+
+static size_t noinitSize() {
+  size_t n = 0;
+  for (const NoinitObject& o : NOINIT) n += o.size;
+  return n;
+}
+
+static void retainedCopyOut(Retained& r) {
+  r.noinit.clear();
+  for (const NoinitObject& o : NOINIT) {
+    const uint8_t* p = (const uint8_t*)o.at;
+    r.noinit.insert(r.noinit.end(), p, p + o.size);
+  }
+  r.eeprom.assign(EEPROM.mem, EEPROM.mem + sizeof EEPROM.mem);
+}
+
+static void retainedCopyIn(const Retained& r) {
+  if (r.noinit.size() == noinitSize()) {
+    const uint8_t* p = r.noinit.data();
+    for (const NoinitObject& o : NOINIT) {
+      memcpy(o.at, p, o.size);
+      p += o.size;
+    }
+  }
+  if (r.eeprom.size() == sizeof EEPROM.mem) {
+    memcpy(EEPROM.mem, r.eeprom.data(), sizeof EEPROM.mem);
+  }
+}
+
+static bool readFull(int fd, void* buf, size_t n) {
+  uint8_t* p = (uint8_t*)buf;
+  while (n > 0) {
+    ssize_t got = read(fd, p, n);
+    if (got <= 0) {
+      return false;
+    }
+    p += got;
+    n -= got;
+  }
+  return true;
+}
+
+// Runs body on a fresh board that starts from before (an empty image is
+// power-on: .noinit as the parent has it, erased EEPROM). Returns the
+// retained image at the end of body. Check failures in the child count
+// towards the parent's.
+template <class Body> Retained runBoard(const Retained& before, Body body) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    ++failures;
+    return Retained();
+  }
+  std::cout.flush();
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(fds[0]);
+    retainedCopyIn(before);
+    body();
+    Retained after;
+    retainedCopyOut(after);
+    uint8_t failed = failures > 0;
+    std::cout.flush();
+    if (write(fds[1], &failed, 1) != 1 ||
+        write(fds[1], after.noinit.data(), after.noinit.size()) != (ssize_t)after.noinit.size() ||
+        write(fds[1], after.eeprom.data(), after.eeprom.size()) != (ssize_t)after.eeprom.size()) {
+      _exit(2);
+    }
+    _exit(0);
+  }
+  close(fds[1]);
+  Retained after;
+  after.noinit.resize(noinitSize());
+  after.eeprom.resize(sizeof EEPROM.mem);
+  uint8_t failed = 1;
+  bool complete = readFull(fds[0], &failed, 1) &&
+                  readFull(fds[0], after.noinit.data(), after.noinit.size()) &&
+                  readFull(fds[0], after.eeprom.data(), after.eeprom.size());
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  if (!complete || failed || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    ++failures;
+  }
+  return after;
+}
+
+// Exit code for main()
+int finish(const char* name) {
+  std::cout << name << ": " << (failures ? "FAIL" : "ok") << "\n";
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Builds every test_*.cpp against src/main.cpp with the host g++ and runs
+# it once per build profile (LEAN, STANDARD, DIAGNOSTIC).
+#   ./run_tests.sh              all tests
+#   ./run_tests.sh remote_stop  only test_remote_stop.cpp
+set -e
+HERE=$(cd "$(dirname "$0")" && pwd)
+OUT=${TMPDIR:-/tmp}/card_host_tests
+CXX=${CXX:-g++}
+mkdir -p "$OUT"
+
+if [ $# -gt 0 ]; then
+  TESTS=$(for t in "$@"; do echo "$HERE/test_$t.cpp"; done)
+else
+  TESTS=$(ls "$HERE"/test_*.cpp)
+fi
+
+failed=0
+for src in $TESTS; do
+  name=$(basename "$src" .cpp)
+  for profile in 0 1 2; do
+    bin="$OUT/${name}_p$profile"
+    if ! $CXX -std=gnu++11 -Wall -Wno-unused-function -DBUILD_PROFILE=$profile \
+        -I"$HERE/stub" -I"$HERE/../../include" "$src" -o "$bin"; then
+      echo "$name (profile $profile): build failed"
+      failed=1
+      continue
+    fi
+    if ! (cd "$HERE" && "$bin" > "$OUT/$name.log" 2>&1); then
+      echo "$name (profile $profile): FAIL"
+      cat "$OUT/$name.log"
+      failed=1
+    else
+      echo "$name (profile $profile): ok"
+    fi
+  done
+done
+exit $failed
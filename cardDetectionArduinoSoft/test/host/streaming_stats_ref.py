@@ -0,0 +1,65 @@
+"""Reference results for test_streaming_stats.cpp.
+
+Reads whitespace-separated integer samples from stdin and prints what
+pc_software/streaming_stats.py makes of them, in the line format the C++
+test prints for include/StreamingStats.h:
+
+    S <min> <max>                          sliding window of 50, every sample
+    E <mean>                               Ewma(0.125)          \\
+    W <count> <mean> <variance>            Welford               | every 997
+    H <q5> <q50> <q95> <q99> <total>       HistogramQuantile     | samples and
+    B <q5> <q50> <q95> <q99> <total>       same, 8-bit counts    | at the end
+    Q <mean>                               Ewma(1/8), vs EwmaQ8 /
+    A <min> <max> <sum> <count>            tumbling window of 1000 samples
+    F <min> <max> <sum> <count>            first 300 samples, 8-bit count
+
+WindowStats has no Python twin; A and F are the plain formulas.
+"""
+import os
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "..", "pc_software"))
+
+from streaming_stats import Ewma, HistogramQuantile, SlidingMinMax, Welford  # noqa: E402
+
+WINDOW = 50
+REPORT_EVERY = 997
+AGG_WINDOW = 1000
+PERCENTS = (5, 50, 95, 99)
+
+
+def quantiles(hist):
+    return " ".join(str(hist.quantile(p)) for p in PERCENTS) + f" {hist.total}"
+
+
+def main():
+    values = [int(v) for v in sys.stdin.read().split()]
+    out = []
+    sliding = SlidingMinMax(WINDOW)
+    ewma = Ewma(0.125)
+    welford = Welford()
+    hist = HistogramQuantile(64, 16, 0xFFFF)
+    hist8 = HistogramQuantile(64, 16, 0xFF)
+    for i, v in enumerate(values):
+        sliding.add(v)
+        ewma.add(v)
+        welford.add(v)
+        hist.add(v)
+        hist8.add(v)
+        out.append(f"S {sliding.min} {sliding.max}")
+        if (i + 1) % REPORT_EVERY == 0 or i + 1 == len(values):
+            out.append("E %.17g" % ewma.mean)
+            out.append("W %d %.17g %.17g" % (welford.count, welford.mean, welford.variance))
+            out.append("H " + quantiles(hist))
+            out.append("B " + quantiles(hist8))
+            out.append("Q %.17g" % ewma.mean)
+    for start in range(0, len(values) - AGG_WINDOW + 1, AGG_WINDOW):
+        chunk = values[start:start + AGG_WINDOW]
+        out.append(f"A {min(chunk)} {max(chunk)} {sum(chunk)} {len(chunk)}")
+    first = values[:255]
+    out.append(f"F {min(first)} {max(first)} {sum(first)} {len(first)}")
+    print("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,185 @@
+#pragma once
+
+// --- HOST STUB OF THE ARDUINO CORE ---
+// Just enough of the core for src/main.cpp to build with g++. Time, the
+// analog/digital inputs and the enable pin are plain globals the tests
+// drive (see harness.h); Serial records TX and is fed RX by the test.
+// PROGMEM is ordinary memory, F() is a plain string.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include <deque>
+#include <string>
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 14
+#define HEX 16
+#define DEC 10
+
+#define PROGMEM
+#define F(x) (x)
+#define PSTR(x) (x)
+#define noInterrupts()
+#define interrupts()
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+inline uint8_t pgm_read_byte(const void* p) { return *(const uint8_t*)p; }
+inline uint16_t pgm_read_word(const void* p) { return *(const uint16_t*)p; }
+inline uint32_t pgm_read_dword(const void* p) { return *(const uint32_t*)p; }
+inline float pgm_read_float(const void* p) { return *(const float*)p; }
+inline const void* pgm_read_ptr(const void* p) { return *(const void* const*)p; }
+inline void* memcpy_P(void* d, const void* s, size_t n) { return memcpy(d, s, n); }
+inline int strcmp_P(const char* a, const char* b) { return strcmp(a, b); }
+inline int strncmp_P(const char* a, const char* b, size_t n) { return strncmp(a, b, n); }
+inline int strcasecmp_P(const char* a, const char* b) { return strcasecmp(a, b); }
+inline size_t strlen_P(const char* s) { return strlen(s); }
+
+template <class T, class L, class H> T constrain(T x, L l, H h) { return x < l ? l : (x > h ? h : x); }
+template <class A, class B> auto min(A a, B b) -> decltype(a + b) { return a < b ? a : b; }
+template <class A, class B> auto max(A a, B b) -> decltype(a + b) { return a > b ? a : b; }
+inline bool isDigit(int c) { return c >= '0' && c <= '9'; }
+
+// Board state driven by the tests
+extern unsigned long g_micros; // Clock, millis() is derived from it
+extern int g_txroom;           // Serial.availableForWrite()
+extern int g_adc;              // analogRead(PIN_SENSOR)
+extern int g_env;              // digitalRead(PIN_ENVELOPE)
+extern int g_pin8;             // Last level written to PIN_ENABLE_OUT
+
+inline unsigned long millis() { return g_micros / 1000; }
+inline unsigned long micros() { return g_micros; }
+inline void delay(unsigned long ms) { g_micros += ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { g_micros += us; }
+inline int analogRead(int) { return g_adc; }
+inline int digitalRead(int) { return g_env; }
+inline void digitalWrite(int pin, int v) { if (pin == 8) g_pin8 = v; }
+inline void pinMode(int, int) {}
+
+class __FlashStringHelper;
+
+class String {
+ public:
+  std::string s;
+  String(const char* c = "") : s(c) {}
+  String(const std::string& x) : s(x) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned int v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+  bool operator==(const char* c) const { return s == c; }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator!=(const char* c) const { return s != c; }
+  bool startsWith(const char* p) const { return s.compare(0, strlen(p), p) == 0; }
+  bool startsWith(const String& p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+  String substring(unsigned a) const { return a >= s.size() ? String("") : String(s.substr(a)); }
+  String substring(unsigned a, unsigned b) const { return a >= s.size() ? String("") : String(s.substr(a, b - a)); }
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  void trim() {
+    size_t a = s.find_first_not_of(" \t\r\n");
+    size_t b = s.find_last_not_of(" \t\r\n");
+    s = a == std::string::npos ? "" : s.substr(a, b - a + 1);
+  }
+  unsigned length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  int indexOf(char c) const { return find(s.find(c)); }
+  int indexOf(char c, unsigned from) const { return find(s.find(c, from)); }
+  int indexOf(const char* c) const { return find(s.find(c)); }
+  char charAt(unsigned i) const { return i < s.size() ? s[i] : 0; }
+  char operator[](unsigned i) const { return charAt(i); }
+  String& operator+=(char c) { s += c; return *this; }
+  String& operator+=(const char* c) { s += c; return *this; }
+  String& operator+=(const String& c) { s += c.s; return *this; }
+  void toUpperCase() { for (auto& c : s) c = toupper(c); }
+  bool equalsIgnoreCase(const String& o) const { return strcasecmp(s.c_str(), o.s.c_str()) == 0; }
+  bool reserve(unsigned) { return true; }
+  void remove(unsigned i) { if (i < s.size()) s.erase(i); }
+
+ private:
+  static int find(size_t i) { return i == std::string::npos ? -1 : (int)i; }
+};
+
+class Print {
+ public:
+  std::string out; // Everything written so far, see take()
+  virtual ~Print() {}
+  size_t print(const char* c) { return emit(c); }
+  size_t print(const __FlashStringHelper* c) { return emit((const char*)c); }
+  size_t print(const String& c) { return emit(c.s); }
+  size_t print(char c) { return emit(std::string(1, c)); }
+  size_t print(long v, int base = DEC) { return number(base == HEX ? "%lX" : "%ld", v); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned long v, int base = DEC) { return number(base == HEX ? "%lX" : "%lu", v); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(double v, int digits = 2) {
+    char buf[48];
+    snprintf(buf, sizeof buf, "%.*f", digits, v);
+    return emit(buf);
+  }
+  template <class T> size_t println(T v) { return print(v) + println(); }
+  template <class T> size_t println(T v, int f) { return print(v, f) + println(); }
+  size_t println() { return emit("\r\n"); }
+  size_t write(uint8_t b) { return emit(std::string(1, (char)b)); }
+  size_t write(const uint8_t* b, size_t n) { return emit(std::string((const char*)b, n)); }
+
+ private:
+  size_t emit(const std::string& x) { out += x; return x.size(); }
+  template <class T> size_t number(const char* fmt, T v) {
+    char buf[24];
+    snprintf(buf, sizeof buf, fmt, v);
+    return emit(buf);
+  }
+};
+
+class HardwareSerial : public Print {
+ public:
+  std::deque<uint8_t> in; // Bytes not yet read by the firmware
+  void begin(unsigned long) {}
+  void end() {}
+  void flush() {}
+  void setTimeout(unsigned long) {}
+  int available() { return in.size(); }
+  int availableForWrite() { return g_txroom; }
+  int peek() { return in.empty() ? -1 : in.front(); }
+  int read() {
+    if (in.empty()) return -1;
+    int c = in.front();
+    in.pop_front();
+    return c;
+  }
+  size_t readBytes(uint8_t* b, size_t n) {
+    size_t i = 0;
+    while (i < n && !in.empty()) {
+      b[i++] = in.front();
+      in.pop_front();
+    }
+    return i;
+  }
+  size_t readBytes(char* b, size_t n) { return readBytes((uint8_t*)b, n); }
+  String readStringUntil(char t) {
+    std::string r;
+    while (!in.empty()) {
+      char c = in.front();
+      in.pop_front();
+      if (c == t) break;
+      r += c;
+    }
+    return String(r);
+  }
+  void feed(const std::string& x) { for (char c : x) in.push_back((uint8_t)c); }
+  operator bool() { return true; }
+};
+extern HardwareSerial Serial;
@@ -0,0 +1,18 @@
+#pragma once
+
+// Host stub of the EEPROM library: 1 KB of erased (0xFF) cells.
+
+#include <stdint.h>
+#include <string.h>
+
+struct EEPROMClass {
+  uint8_t mem[1024];
+  EEPROMClass() { memset(mem, 0xFF, sizeof mem); }
+  uint8_t read(int a) { return mem[a]; }
+  void write(int a, uint8_t v) { mem[a] = v; }
+  void update(int a, uint8_t v) { mem[a] = v; }
+  template <class T> T& get(int a, T& t) { memcpy(&t, mem + a, sizeof t); return t; }
+  template <class T> const T& put(int a, const T& t) { memcpy(mem + a, &t, sizeof t); return t; }
+  unsigned length() { return sizeof mem; }
+};
+extern EEPROMClass EEPROM;
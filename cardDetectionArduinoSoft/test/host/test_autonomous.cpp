@@ -0,0 +1,113 @@
+// Autonomous mode: verdicts buffered while the PC is away survive a
+// reset of the board (the HMI's DTR pulse on reconnect) and are replayed
+// by the next PING as SYNC: lines, one per loop pass.
+#include "harness.h"
+
+#include <cstdlib>
+
+static void envelope(int level) {
+  g_adc = level;
+  g_env = LOW;
+  step(60);
+  g_env = HIGH;
+  g_adc = 110;
+  step(300);
+}
+
+// PC goes away, the watchdog switches to autonomous mode, three passes and
+// an empty envelope are buffered; the last one 440 ms before the reset
+static void runUnattended() {
+  setup();
+  send("PING\nSET:DEBOUNCE_MS=0\nSET:AUTONOMOUS=1\nSAVE\n");
+  g_adc = 110;
+  step(CFG_WATCHDOG_TIMEOUT + 100);
+  CHECK(autoLog.active);
+  envelope(400);
+  envelope(400);
+  envelope(400);
+  envelope(120);
+  step(140);
+  CHECK(autoLog.count == 4);
+  take();
+}
+
+// Runs loop passes after a PING and collects the SYNC: lines, checking
+// that no pass sends more than one
+static std::vector<std::string> syncAfterPing() {
+  send("PING\n", 1);
+  std::vector<std::string> sync;
+  for (int pass = 0; pass < AUTO_BUFFER_SIZE + 4; pass++) {
+    std::vector<std::string> l = lines(take(), "SYNC:");
+    CHECK(l.size() <= 1);
+    sync.insert(sync.end(), l.begin(), l.end());
+    step(1);
+  }
+  return sync;
+}
+
+static long field(const std::string& line, int index) {
+  size_t pos = line.find(':');
+  for (int i = 0; i < index && pos != std::string::npos; i++) {
+    pos = line.find(',', pos + 1);
+  }
+  return pos == std::string::npos ? -1 : atol(line.c_str() + pos + 1);
+}
+
+int main() {
+  Retained unattended = runBoard(Retained(), runUnattended);
+
+  // Reconnect resets the board: the buffer comes back and is replayed
+  Retained synced = runBoard(unattended, [] {
+    g_adc = 110;
+    setup();
+    CHECK(autoLog.active);
+    CHECK(autoLog.count == 4);
+    take();
+    step(200);
+    std::vector<std::string> sync = syncAfterPing();
+    CHECK(sync.size() == 6);
+    if (sync.size() == 6) {
+      CHECK(sync[0].compare(0, 17, "SYNC:BEGIN,3,1,0,") == 0);
+      CHECK(sync[1].find(",PASS,") != std::string::npos);
+      CHECK(sync[4].find(",EMPTY_ENVELOPE,") != std::string::npos);
+      CHECK(sync[5] == "SYNC:END");
+      // 440 ms before the reset and 200 ms after it. Neither the reset
+      // itself nor the time since the last WARM_SAVE_MS save is counted.
+      long lastAge = field(sync[4], 1);
+      CHECK(lastAge >= 640 - (long)WARM_SAVE_MS && lastAge <= 640);
+      CHECK(field(sync[1], 1) - lastAge == 3 * 360);
+    }
+    CHECK(!autoLog.active);
+    CHECK(autoLog.count == 0);
+    CHECK(syncAfterPing().empty());
+  });
+
+  // Once sent, a later reset does not replay it again
+  runBoard(synced, [] {
+    setup();
+    take();
+    CHECK(syncAfterPing().empty());
+  });
+
+  // A reset before SYNC:END replays everything on the next PING
+  Retained cut = runBoard(unattended, [] {
+    setup();
+    send("PING\n", 2);
+    CHECK(lines(take(), "SYNC:").size() == 2);
+  });
+  runBoard(cut, [] {
+    setup();
+    take();
+    std::vector<std::string> sync = syncAfterPing();
+    CHECK(sync.size() == 6);
+  });
+
+  // Power-on: nothing to replay
+  runBoard(Retained(), [] {
+    setup();
+    CHECK(!autoLog.active);
+    CHECK(autoLog.count == 0);
+  });
+
+  return finish("autonomous");
+}
@@ -0,0 +1,64 @@
+// Trailing blanking: BLANK_TRAIL only takes values the delay line can
+// honour, anything larger is refused with ERR:REJECTED and leaves the
+// machine running; BLANK? reports the windows the last envelope got.
+#include "harness.h"
+
+static void envelope(int level, int ms) {
+  g_adc = level;
+  g_env = LOW;
+  step(ms);
+  g_env = HIGH;
+  g_adc = 110;
+  step(BLANK_DELAY_MS + 10);
+}
+
+static std::string blank() {
+  send("BLANK?\n", 2);
+  std::vector<std::string> l = lines(take(), "BLANK:");
+  return l.empty() ? "" : l[0];
+}
+
+int main() {
+  runBoard(Retained(), [] {
+    setup();
+    send("PING\n");
+    take();
+    CHECK(g_pin8 == HIGH);
+
+    // Over the delay line: refused by text and by frame, value kept
+    send("SET:BLANK_TRAIL=10\n");
+    take();
+    send("SET:BLANK_TRAIL=32\n");
+    std::string out = take();
+    CHECK_HAS(out, "ERR:REJECTED,BLANK_TRAIL,0,31\r\n");
+    CHECK_LACKS(out, "PRM:");
+    send(paramFrameBytes(PARAM_OP_SET, P_BLANK_TRAIL, 1000));
+    CHECK_HAS(take(), "ERR:REJECTED,BLANK_TRAIL,0,31\r\n");
+    CHECK(CFG_BLANK_TRAIL == 10);
+    CHECK(g_pin8 == HIGH);
+    CHECK(!machineStopActive);
+
+    send("SET:NO_SUCH_PARAM=1\n");
+    CHECK_HAS(take(), "ERR:REJECTED\r\n");
+    CHECK(g_pin8 == HIGH);
+
+    // The largest value is taken and applied as is
+    send("SET:BLANK_TRAIL=31\n");
+    CHECK_HAS(take(), ",BLANK_TRAIL,31");
+    g_adc = 110;
+    step(300);
+    envelope(400, 100);
+    CHECK(blank() == "BLANK:0,31");
+
+    // Percent of the envelope, cut to the delay line on long ones. The
+    // leading window is taken of the envelope before.
+    send("SET:BLANK_UNIT=1\nSET:BLANK_LEAD=10\n");
+    take();
+    envelope(400, 60);
+    CHECK(blank() == "BLANK:10,18");
+    envelope(400, 200);
+    CHECK(blank() == "BLANK:6,31");
+  });
+
+  return finish("blanking");
+}
@@ -0,0 +1,47 @@
+// Calibration: points and um thresholds outside 0..CAL_MAX_UM are
+// refused with ERR:REJECTED instead of wrapping into an int, and
+// CAL_CLEAR drops the um thresholds along with the table.
+#include "harness.h"
+
+int main() {
+  runBoard(Retained(), [] {
+    setup();
+    send("PING\n");
+    take();
+
+    send("SET_THR_UM:500\n");
+    CHECK_HAS(take(), "ERR:REJECTED\r\n");
+
+    // 70000 would wrap to 4464 as a 16-bit int
+    send("CAL_ADD:100,0\nCAL_ADD:500,70000\nCAL_ADD:500,-1\nCAL_ADD:65636,100\n");
+    CHECK(lines(take(), "ERR:REJECTED").size() == 3);
+    CHECK(calCount == 1);
+    send("CAL_ADD:500,2000\n");
+    CHECK_LACKS(take(), "ERR:");
+    CHECK(calCount == 2);
+
+    send("SET_THR_UM:40000\nSET_THR_UPPER_UM:-5\n");
+    CHECK(lines(take(), "ERR:REJECTED").size() == 2);
+    CHECK(CFG_CARD_THRESHOLD_UM == -1);
+    CHECK(CFG_CARD_UPPER_THRESHOLD_UM == -1);
+    CHECK(g_pin8 == HIGH);
+
+    send("SET_THR_UM:1000\nSET_THR_UPPER_UM:1800\n");
+    CHECK_LACKS(take(), "ERR:");
+    CHECK(CFG_CARD_THRESHOLD == 300);
+    CHECK(CFG_CARD_UPPER_THRESHOLD == 460);
+
+    // A new table no longer moves thresholds set against the old one
+    send("CAL_CLEAR\n");
+    CHECK(calCount == 0);
+    CHECK(CFG_CARD_THRESHOLD_UM == -1);
+    CHECK(CFG_CARD_UPPER_THRESHOLD_UM == -1);
+    send("CAL_ADD:100,0\nCAL_ADD:900,1000\n");
+    take();
+    CHECK(calCount == 2);
+    CHECK(CFG_CARD_THRESHOLD == 300);
+    CHECK(CFG_CARD_UPPER_THRESHOLD == 460);
+  });
+
+  return finish("calibration");
+}
@@ -0,0 +1,81 @@
+// LIST and the SUB: replies go out one line per loop pass, only while
+// the TX buffer has room, so they never hold up a remote stop.
+#include "harness.h"
+
+const std::string STOP(1, (char)REMOTE_STOP_BYTE);
+
+static std::string expectedList() {
+  std::string saved = take();
+  for (byte i = 0; i < PARAM_COUNT; i++) {
+    paramReport(i, true);
+  }
+  std::string list = take();
+  Serial.out = saved;
+  return list;
+}
+
+static std::string joined(const std::vector<std::string>& l) {
+  std::string r;
+  for (const std::string& s : l) r += s + "\r\n";
+  return r;
+}
+
+int main() {
+  runBoard(Retained(), [] {
+    setup();
+    send("PING\n");
+    take();
+    std::string expected = expectedList();
+
+    Serial.feed("LIST\n");
+    std::vector<std::string> got;
+    for (int pass = 0; pass < PARAM_COUNT + 2; pass++) {
+      step(1);
+      std::vector<std::string> l = lines(take(), "PRM:");
+      CHECK(l.size() <= 1);
+      got.insert(got.end(), l.begin(), l.end());
+    }
+    CHECK(got.size() == (size_t)PARAM_COUNT);
+    CHECK(joined(got) == expected);
+
+    // No room in the TX buffer: the reply waits, the stop does not
+    Serial.feed("LIST\n");
+    step(3);
+    take();
+    g_txroom = REPLY_LINE_MAX - 1;
+    Serial.feed(STOP);
+    step(1);
+    CHECK(g_pin8 == LOW);
+    step(5);
+    CHECK(lines(take(), "PRM:").empty());
+    g_txroom = 63;
+    step(PARAM_COUNT);
+    CHECK(lines(take(), "PRM:").size() == (size_t)(PARAM_COUNT - 3));
+  });
+
+  if (FEATURE_TELEMETRY) {
+    runBoard(Retained(), [] {
+      setup();
+      send("PING\n");
+      take();
+      send("SUBSCRIBE?\n", 1);
+      std::vector<std::string> sub;
+      for (int pass = 0; pass < STREAM_COUNT + 3; pass++) {
+        std::vector<std::string> l = lines(take(), "SUB:");
+        CHECK(l.size() <= 1);
+        sub.insert(sub.end(), l.begin(), l.end());
+        step(1);
+      }
+      CHECK(sub.size() == (size_t)STREAM_COUNT + 1);
+      CHECK(sub.size() > 1 && sub.front() == "SUB:RAW,0");
+      CHECK(!sub.empty() && sub.back().compare(0, 9, "SUB:LOAD,") == 0);
+
+      send("SUBSCRIBE:RAW,10\n");
+      std::vector<std::string> one = lines(take(), "SUB:");
+      CHECK(one.size() == 2);
+      CHECK(!one.empty() && one[0] == "SUB:RAW,10");
+    });
+  }
+
+  return finish("paced_replies");
+}
@@ -0,0 +1,64 @@
+// REMOTE_STOP_BYTE must stop the machine within one loop pass wherever it
+// falls in the RX stream: inside a text line or behind a binary parameter
+// frame that never completes. Escaped inside a frame it is data.
+#include "harness.h"
+
+const std::string STOP(1, (char)REMOTE_STOP_BYTE);
+
+static void boot() {
+  setup();
+  send("PING\n");
+  take();
+}
+
+int main() {
+  runBoard(Retained(), [] {
+    boot();
+    CHECK(g_pin8 == HIGH);
+    Serial.feed("SET:DEB" + STOP);
+    step(1);
+    CHECK(g_pin8 == LOW);
+    CHECK_HAS(take(), "ERR:REMOTE_STOP");
+  });
+
+  // The frame is cut off after op: the stop byte must not wait for the
+  // frame timeout, and the text command behind it still runs
+  runBoard(Retained(), [] {
+    boot();
+    Serial.feed(std::string{(char)PARAM_FRAME_SYNC, (char)PARAM_OP_GET} + STOP);
+    step(1);
+    CHECK(g_pin8 == LOW);
+    CHECK_HAS(take(), "ERR:REMOTE_STOP");
+    send("RESUME\nPING\n", 150);
+    CHECK(g_pin8 == HIGH);
+    send("GET:DEBOUNCE_MS\n");
+    CHECK_HAS(take(), ",DEBOUNCE_MS,");
+  });
+
+  // 0x18 inside a frame is escaped: a GET of parameter id 0x18 and values
+  // holding the byte are frame data, not a stop
+  runBoard(Retained(), [] {
+    boot();
+    send(paramFrameBytes(PARAM_OP_GET, P_SHADOW_THR_UPPER, 0));
+    CHECK(g_pin8 == HIGH);
+    CHECK_LACKS(take(), "ERR:REMOTE_STOP");
+    for (long value : {24L, 280L, 536L, 792L}) {
+      send(paramFrameBytes(PARAM_OP_SET, P_THR, value));
+      CHECK(CFG_CARD_THRESHOLD == value);
+    }
+    unsigned long bits = 0x3E181B18UL; // 0.1485 with both 0x18 and the escape byte
+    float alpha;
+    memcpy(&alpha, &bits, sizeof(alpha));
+    send(paramFrameBytes(PARAM_OP_SET, P_FILTER_ALPHA, bits));
+    CHECK(CFG_FILTER_ALPHA == alpha);
+    CHECK(g_pin8 == HIGH);
+    CHECK_LACKS(take(), "ERR:REMOTE_STOP");
+    // An unescaped 0x18 is still the stop byte, mid-frame too
+    Serial.feed(std::string{(char)PARAM_FRAME_SYNC, (char)PARAM_OP_GET, (char)REMOTE_STOP_BYTE});
+    step(1);
+    CHECK(g_pin8 == LOW);
+    CHECK_HAS(take(), "ERR:REMOTE_STOP");
+  });
+
+  return finish("remote_stop");
+}
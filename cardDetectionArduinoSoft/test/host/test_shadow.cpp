@@ -0,0 +1,99 @@
+// Shadow detector: configured like the primary it must agree on every
+// envelope with the same peak; configured differently its SHADOW?
+// counters must match the disagreements it reports on the SH: stream.
+#include "harness.h"
+
+#include <sstream>
+
+// Seven envelopes over a noisy floor. With the default thresholds
+// (150/800) they are: pass, pass, pass, empty, pass, double, double.
+const int LEVELS[] = {400, 170, 160, 140, 790, 900, 810};
+const int ENVELOPES = sizeof(LEVELS) / sizeof(LEVELS[0]);
+
+static std::string trace() {
+  std::string t;
+  unsigned long rng = 12345;
+  auto noisy = [&](int level) {
+    rng = rng * 1103515245UL + 12345UL;
+    return level + (int)((rng >> 16) % 11) - 5;
+  };
+  for (int level : LEVELS) {
+    for (int i = 0; i < 300; i++) t += injectFrameBytes(noisy(110));
+    for (int i = 0; i < 60; i++) t += injectFrameBytes(noisy(level) | 0x400);
+  }
+  for (int i = 0; i < 30; i++) t += injectFrameBytes(110);
+  return t + injectFrameBytes(INJECT_CTRL_END);
+}
+
+// Replays the trace, returns the SH: records split into fields
+static std::vector<std::vector<std::string>> replay(const std::string& setup) {
+  send(setup + "SUBSCRIBE:SHADOW,1\nSHADOW_RESET\nINJECT:1,1\n" + trace(), 1);
+  while (Serial.available() > 0) {
+    step(1);
+  }
+  std::vector<std::vector<std::string>> records;
+  for (const std::string& l : lines(take(), "SH:")) {
+    std::vector<std::string> f;
+    std::istringstream is(l.substr(3));
+    std::string field;
+    while (std::getline(is, field, ',')) f.push_back(field);
+    records.push_back(f);
+  }
+  return records;
+}
+
+static std::string counters() {
+  send("SHADOW?\n", 2);
+  std::vector<std::string> l = lines(take(), "SHADOW:");
+  return l.empty() ? "" : l[0];
+}
+
+int main() {
+  if (!FEATURE_SHADOW) {
+    return finish("shadow (not in this profile)");
+  }
+
+  // Same configuration as the primary, default and non-default settings
+  const char* same[] = {
+    "SET:SHADOW=1\n",
+    "SET:FILTER_ALPHA=0.5\nSET:PEAK_MODE=1\n"
+    "SET:SHADOW=1\nSET:SHADOW_ALPHA=0.5\nSET:SHADOW_PEAK_MODE=1\n",
+  };
+  for (const char* config : same) {
+    runBoard(Retained(), [config] {
+      setup();
+      send(std::string("SET:DEBOUNCE_MS=0\n") + config);
+      take();
+      std::vector<std::vector<std::string>> sh = replay("");
+      CHECK(sh.size() == (size_t)ENVELOPES);
+      for (const auto& f : sh) {
+        CHECK(f.size() == 5);
+        if (f.size() == 5) {
+          CHECK(f[1] == f[3]); // Verdict
+          CHECK(f[2] == f[4]); // Peak
+        }
+      }
+      CHECK(counters() == "SHADOW:7,7,0,0,0");
+    });
+  }
+
+  // Tighter lower and looser upper threshold: 170 and 160 become
+  // shadow-only stops, 810 a missed stop
+  runBoard(Retained(), [] {
+    setup();
+    send("SET:DEBOUNCE_MS=0\nSET:SHADOW=1\nSET:SHADOW_THR=180\nSET:SHADOW_THR_UPPER=850\n");
+    take();
+    std::vector<std::vector<std::string>> sh = replay("");
+    int disagree = 0;
+    for (const auto& f : sh) {
+      if (f.size() == 5 && f[1] != f[3]) {
+        disagree++;
+        CHECK(f[2] == f[4]); // Same filter and peak mode, only thresholds differ
+      }
+    }
+    CHECK(disagree == 3);
+    CHECK(counters() == "SHADOW:7,4,3,2,1");
+  });
+
+  return finish("shadow");
+}
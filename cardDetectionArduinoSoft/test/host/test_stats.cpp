@@ -0,0 +1,52 @@
+// STATS: loop period and stop latency are answered in every profile, the
+// detector cost only in DIAGNOSTIC builds.
+#include "harness.h"
+
+const std::string STOP(1, (char)REMOTE_STOP_BYTE);
+
+static std::vector<std::string> stats() {
+  send("STATS\n", 1);
+  std::vector<std::string> l = lines(take(), "STAT:");
+  std::vector<std::string> f;
+  if (!l.empty()) {
+    size_t pos = 5;
+    while (pos <= l[0].size()) {
+      size_t end = l[0].find(',', pos);
+      if (end == std::string::npos) end = l[0].size();
+      f.push_back(l[0].substr(pos, end - pos));
+      pos = end + 1;
+    }
+  }
+  return f;
+}
+
+int main() {
+  runBoard(Retained(), [] {
+    setup();
+    send("PING\n");
+    take();
+    stats();
+
+    step(99);
+    step(1, 5000);
+    std::vector<std::string> f = stats();
+    CHECK(f.size() == (FEATURE_STATS ? 10u : 8u));
+    if (f.size() >= 8) {
+      CHECK(f[0] == std::to_string(BUILD_PROFILE));
+      CHECK(std::stoul(f[1]) >= 100);
+      CHECK(std::stoul(f[3]) == 5000);
+    }
+
+    // Counters restart after each report, stop latencies are kept
+    send(STOP, 1);
+    CHECK(g_pin8 == LOW);
+    f = stats();
+    CHECK(f.size() == (FEATURE_STATS ? 10u : 8u));
+    if (f.size() >= 8) {
+      CHECK(std::stoul(f[3]) == 1000);
+      CHECK(f[6] == f[4]);
+    }
+  });
+
+  return finish("stats");
+}
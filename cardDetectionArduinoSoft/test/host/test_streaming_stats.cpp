@@ -0,0 +1,140 @@
+// StreamingStats.h against pc_software/streaming_stats.py: both run on
+// the same samples and must print the same results (streaming_stats_ref.py
+// has the Python side and the line format). EwmaQ8 is fixed point, so it
+// only has to stay within a count of the float mean. 70000 samples take
+// the sliding window's 16-bit sequence number past a wrap.
+#include "harness.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+const int SAMPLES = 70000;
+const int WINDOW = 50;
+const int REPORT_EVERY = 997;
+const int AGG_WINDOW = 1000;
+const uint8_t PERCENTS[] = {5, 50, 95, 99};
+
+// ADC-like samples: a drifting floor, cards and a few values past 1023
+static std::vector<int> samples() {
+  std::vector<int> v;
+  unsigned long rng = 4242;
+  for (int i = 0; i < SAMPLES; i++) {
+    rng = rng * 1103515245UL + 12345UL;
+    int noise = (int)((rng >> 16) % 21) - 10;
+    int level = (i % 360) >= 300 ? 400 + (i / 360) % 7 * 60 : 110 + (i / 5000) * 3;
+    if ((rng >> 8) % 1000 == 0) {
+      level = 1100;
+    }
+    v.push_back(std::max(0, level + noise));
+  }
+  return v;
+}
+
+template <class H> static std::string quantiles(const H& h) {
+  std::ostringstream s;
+  for (uint8_t p : PERCENTS) s << h.quantile(p) << " ";
+  s << h.samples();
+  return s.str();
+}
+
+static std::string fmt(const char* f, double a, double b = 0, double c = 0) {
+  char buf[128];
+  snprintf(buf, sizeof buf, f, a, b, c);
+  return buf;
+}
+
+// Runs the Python side, one string per output line
+static std::vector<std::string> reference(const std::vector<int>& v) {
+  std::vector<std::string> r;
+  char path[] = "/tmp/streaming_stats_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return r;
+  }
+  std::string text;
+  for (int x : v) text += std::to_string(x) + "\n";
+  bool written = write(fd, text.data(), text.size()) == (ssize_t)text.size();
+  close(fd);
+  std::string cmd = "python3 streaming_stats_ref.py < " + std::string(path);
+  FILE* p = written ? popen(cmd.c_str(), "r") : nullptr;
+  if (p) {
+    char line[256];
+    while (fgets(line, sizeof line, p)) {
+      std::string l(line);
+      while (!l.empty() && (l.back() == '\n' || l.back() == '\r')) l.pop_back();
+      r.push_back(l);
+    }
+    if (pclose(p) != 0) {
+      r.clear();
+    }
+  }
+  unlink(path);
+  return r;
+}
+
+int main() {
+  std::vector<int> v = samples();
+  std::vector<std::string> expected = reference(v);
+  CHECK(!expected.empty());
+
+  std::vector<std::string> got;
+  std::vector<double> q8;
+  SlidingMinMax<int, WINDOW> sliding;
+  sliding.reset();
+  Ewma<double> ewma(0.125);
+  Welford<double> welford;
+  HistogramQuantile<64, 4> hist;
+  HistogramQuantile<64, 4, uint8_t> hist8;
+  EwmaQ8<3> ewmaQ8;
+  for (int i = 0; i < SAMPLES; i++) {
+    sliding.add(v[i]);
+    ewma.add(v[i]);
+    welford.add(v[i]);
+    hist.add(v[i]);
+    hist8.add(v[i]);
+    ewmaQ8.add(v[i]);
+    got.push_back("S " + std::to_string(sliding.lowest()) + " " + std::to_string(sliding.highest()));
+    if ((i + 1) % REPORT_EVERY == 0 || i + 1 == SAMPLES) {
+      got.push_back(fmt("E %.17g", ewma.mean));
+      got.push_back(fmt("W %.0f %.17g %.17g", welford.count, welford.mean, welford.variance()));
+      got.push_back("H " + quantiles(hist));
+      got.push_back("B " + quantiles(hist8));
+      got.push_back("Q");
+      q8.push_back(ewmaQ8.value());
+    }
+  }
+  WindowStats<int, long> agg;
+  for (int start = 0; start + AGG_WINDOW <= SAMPLES; start += AGG_WINDOW) {
+    agg.reset();
+    for (int i = start; i < start + AGG_WINDOW; i++) agg.add(v[i]);
+    got.push_back(fmt("A %.0f %.0f %.0f", agg.min, agg.max, agg.sum) + " " + std::to_string(agg.count));
+  }
+  WindowStats<int, long, uint8_t> first;
+  first.reset();
+  for (int i = 0; i < 300; i++) first.add(v[i]);
+  CHECK(first.full());
+  got.push_back(fmt("F %.0f %.0f %.0f", first.min, first.max, first.sum) + " " + std::to_string(first.count));
+
+  CHECK(got.size() == expected.size());
+  size_t q = 0;
+  int shown = 0;
+  for (size_t i = 0; i < std::min(got.size(), expected.size()); i++) {
+    bool same = got[i] == expected[i];
+    if (got[i] == "Q" && expected[i].compare(0, 2, "Q ") == 0 && q < q8.size()) {
+      // q8 >> 8 floors, the truncation in each step adds a little more
+      double diff = atof(expected[i].c_str() + 2) - q8[q++];
+      same = diff > -0.1 && diff < 1.1;
+    }
+    if (!same) {
+      ++failures;
+      if (shown++ < 5) {
+        std::cerr << "line " << i + 1 << ": C++ \"" << got[i] << "\", Python \"" << expected[i] << "\"\n";
+      }
+    }
+  }
+  CHECK(q == q8.size());
+
+  return finish("streaming_stats");
+}
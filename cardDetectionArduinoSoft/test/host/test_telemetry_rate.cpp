@@ -0,0 +1,138 @@
+// Telemetry link load: bytes per minute of the 10 Hz D: stream against
+// change-driven T: records (TELEM_MODE=1) at a few deadbands, on an idle
+// machine and on a production-like run. Prints the figures; set
+// CARD_TRACE to a trace file ("adc,envelope" per line, 1 ms per sample,
+// the trace_replay.py format) to measure a recorded trace as well.
+#include "harness.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+struct Sample {
+  int adc;
+  bool envelope;
+};
+
+static std::vector<Sample> idle() {
+  return std::vector<Sample>(60000, Sample{110, false});
+}
+
+// 300 ms of floor and a 60 ms card at 400, +-noise counts of noise
+static std::vector<Sample> production(int noise) {
+  std::vector<Sample> t;
+  unsigned long rng = 12345;
+  while (t.size() < 60000) {
+    for (int i = 0; i < 360; i++) {
+      rng = rng * 1103515245UL + 12345UL;
+      int n = (int)((rng >> 16) % (2 * noise + 1)) - noise;
+      bool card = i >= 300;
+      t.push_back(Sample{(card ? 400 : 110) + n, card});
+    }
+  }
+  t.resize(60000);
+  return t;
+}
+
+static std::vector<Sample> load(const char* path) {
+  std::vector<Sample> t;
+  std::ifstream f(path);
+  std::string line;
+  while (std::getline(f, line)) {
+    int adc = 0;
+    int env = 0;
+    if (sscanf(line.c_str(), "%d,%d", &adc, &env) >= 1) {
+      t.push_back(Sample{adc, env == 1});
+    }
+  }
+  return t;
+}
+
+// Telemetry bytes per minute with the given setup, from a fresh board.
+// The synthetic runs hold only good cards; a recorded trace may stop.
+static long bytesPerMinute(const std::vector<Sample>& trace, const std::string& config,
+                           bool recorded) {
+  long bytes = 0;
+  Retained none;
+  std::string setupCmds = config;
+  int fds[2];
+  if (trace.empty() || pipe(fds) != 0) {
+    return -1;
+  }
+  runBoard(none, [&] {
+    setup();
+    send("PING\n" + setupCmds);
+    take();
+    long total = 0;
+    for (size_t i = 0; i < trace.size(); i++) {
+      if (i % 500 == 0) {
+        Serial.feed("PING\n");
+      }
+      g_adc = trace[i].adc;
+      g_env = trace[i].envelope ? LOW : HIGH;
+      step(1);
+      for (const char* prefix : {"D:", "T:"}) {
+        for (const std::string& l : lines(Serial.out, prefix)) {
+          total += l.size() + 2;
+        }
+      }
+      Serial.out.clear();
+    }
+    CHECK(recorded || !machineStopActive);
+    total = total * 60000 / (long)trace.size();
+    if (write(fds[1], &total, sizeof total) != (ssize_t)sizeof total) {
+      ++failures;
+    }
+  });
+  close(fds[1]);
+  if (read(fds[0], &bytes, sizeof bytes) != (ssize_t)sizeof bytes) {
+    bytes = -1;
+  }
+  close(fds[0]);
+  return bytes;
+}
+
+struct Rates {
+  long periodic;
+  long change[3];
+};
+const int DEADBANDS[] = {2, 5, 10};
+
+static Rates measure(const char* name, const std::vector<Sample>& trace, bool recorded = false) {
+  Rates r;
+  r.periodic = bytesPerMinute(trace, "", recorded);
+  std::cout << name << ": D: " << r.periodic << " B/min";
+  for (int i = 0; i < 3; i++) {
+    r.change[i] = bytesPerMinute(trace, "SET:TELEM_MODE=1\nSET:DEADBAND=" +
+                                            std::to_string(DEADBANDS[i]) + "\n", recorded);
+    std::cout << ", T: (deadband " << DEADBANDS[i] << ") " << r.change[i] << " B/min";
+  }
+  std::cout << "\n";
+  return r;
+}
+
+int main() {
+  if (!FEATURE_TELEMETRY) {
+    return finish("telemetry_rate (not in this profile)");
+  }
+
+  // D:110,0,0 ten times a second, T:<millis>,110,0,0 once per keepalive
+  Rates r = measure("idle", idle());
+  CHECK(r.periodic == 600 * 11);
+  CHECK(r.change[0] > 60 * 16 && r.change[0] < 60 * 20);
+
+  // Every card edge goes out at loop rate: a busy machine costs more than
+  // the D: stream, less the wider the deadband
+  for (int noise : {2, 8}) {
+    Rates p = measure(("production, noise +-" + std::to_string(noise)).c_str(), production(noise));
+    CHECK(p.periodic == 600 * 11);
+    CHECK(p.change[1] <= p.change[0]);
+    CHECK(p.change[2] <= p.change[1]);
+  }
+
+  if (const char* path = getenv("CARD_TRACE")) {
+    measure(path, load(path), true);
+  }
+
+  return finish("telemetry_rate");
+}
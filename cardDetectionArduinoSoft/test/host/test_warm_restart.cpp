@@ -0,0 +1,133 @@
+// Warm restart: a reset with the RAM powered restores the detector and
+// keeps a latched stop; a snapshot that fails its magic or CRC-16 check
+// (power-on RAM, a flipped bit) is a cold start. A snapshot taken with
+// other settings than the ones loaded after the reset keeps only the
+// latch.
+#include "harness.h"
+
+static void envelope(int level, int ms = 60) {
+  g_adc = level;
+  g_env = LOW;
+  step(ms);
+  g_env = HIGH;
+}
+
+// Three passes, then an empty envelope latches EMPTY_ENVELOPE. The
+// settings are saved to EEPROM, so they are back after the reset.
+static void runToFault() {
+  setup();
+  send("SET:DEBOUNCE_MS=0\nSAVE\n");
+  for (int i = 0; i < 3; i++) {
+    g_adc = 110;
+    step(300);
+    envelope(400);
+  }
+  g_adc = 110;
+  step(300);
+  envelope(120);
+  step(5);
+  CHECK(machineStopActive);
+  CHECK(envelopeSeq == 4);
+  take();
+}
+
+static WarmSnapshot snapshotOf(const Retained& r) {
+  WarmSnapshot w;
+  memcpy(&w, r.noinit.data(), sizeof(w));
+  return w;
+}
+
+int main() {
+  Retained faulted = runBoard(Retained(), runToFault);
+  const WarmSnapshot saved = snapshotOf(faulted);
+  CHECK(saved.magic == WARM_MAGIC);
+
+  // Intact snapshot: the stop stays latched from the first pin write on
+  runBoard(faulted, [&saved] {
+    g_adc = 110;
+    setup();
+    CHECK(g_pin8 == LOW);
+    CHECK(machineStopActive);
+    CHECK(faultCode == FAULT_EMPTY_ENVELOPE);
+    CHECK(envelopeSeq == saved.envelopeSeq);
+    CHECK(filteredValue == saved.filteredValue);
+    CHECK(noiseMadQ4 == saved.noiseMadQ4);
+    std::string out = take();
+    CHECK_HAS(out, "WARM:");
+    CHECK_HAS(out, ",EMPTY_ENVELOPE,4,RESTORED");
+    // The restored detector carries on: a cleared fault, then a pass
+    send("PING\nSET:DEBOUNCE_MS=0\nRESUME\n");
+    CHECK(g_pin8 == HIGH);
+    envelope(400);
+    step(5);
+    CHECK(g_pin8 == HIGH);
+    CHECK(envelopeSeq == saved.envelopeSeq + 1);
+  });
+
+  // Any corrupted byte, the CRC itself included, fails the check (the
+  // host struct has tail padding after the 16-bit CRC the AVR does not)
+  for (size_t i = 0; i < offsetof(WarmSnapshot, crc) + 2; i += 7) {
+    Retained corrupt = faulted;
+    corrupt.noinit[i] ^= 0x01;
+    runBoard(corrupt, [] {
+      g_adc = 110;
+      setup();
+      CHECK(g_pin8 == HIGH);
+      CHECK(!machineStopActive);
+      CHECK(envelopeSeq == 0);
+      CHECK_LACKS(take(), "WARM:");
+    });
+  }
+  Retained crcOnly = faulted;
+  crcOnly.noinit[offsetof(WarmSnapshot, crc)] ^= 0x80;
+  runBoard(crcOnly, [] {
+    setup();
+    CHECK(!machineStopActive);
+    CHECK_LACKS(take(), "WARM:");
+  });
+
+  // Settings changed after the snapshot's were saved (not saved
+  // themselves), or a calibration that is lost with the RAM: the envelope
+  // count and the stop come back, the detector state does not
+  const char* changes[] = {"SET:THR=170\n", "SET:BLANK_TRAIL=5\n", "CAL_ADD:100,0\nCAL_ADD:900,2000\n"};
+  for (const char* change : changes) {
+    Retained changed = runBoard(Retained(), [change] {
+      runToFault();
+      send(change, 15);
+      take();
+    });
+    runBoard(changed, [] {
+      g_adc = 110;
+      setup();
+      CHECK(g_pin8 == LOW);
+      CHECK(machineStopActive);
+      CHECK(faultCode == FAULT_EMPTY_ENVELOPE);
+      CHECK(envelopeSeq == 4);
+      CHECK(filteredValue == 110);
+      CHECK(noiseFloorQ4 == -1);
+      CHECK_HAS(take(), "WARM:2,EMPTY_ENVELOPE,4,SETTINGS_CHANGED");
+      send("PING\nRESUME\n");
+      CHECK(g_pin8 == HIGH);
+    });
+  }
+
+  // Saved settings come back with the snapshot
+  Retained saved200 = runBoard(Retained(), [] {
+    runToFault();
+    send("SET:THR=200\nSAVE\n", 15);
+  });
+  runBoard(saved200, [] {
+    setup();
+    CHECK(CFG_CARD_THRESHOLD == 200);
+    CHECK_HAS(take(), ",RESTORED");
+  });
+
+  // Power-on: nothing retained
+  runBoard(Retained(), [] {
+    setup();
+    CHECK(g_pin8 == HIGH);
+    CHECK_LACKS(take(), "WARM:");
+  });
+
+  return finish("warm_restart");
+}
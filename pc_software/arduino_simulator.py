@@ -23,6 +23,19 @@ class ArduinoSimulator:
         self.manual_adc = 100
         self.envelope_present = False
 
+        # Sample injection (binary frames from trace_replay.py)
+        self.inject_mode = False
+        self.inject_auto_resume = False
+        self.inject_frames = 0
+        self.inject_buffer = bytearray()
+
+        # Partial command line
+        self.rx_buffer = bytearray()
+
+        # Baud negotiation (SET_BAUD / BAUD_CHECK)
+        self.baud_fallback = None
+        self.baud_switch_time = 0
+
         # Virtual serial port (using com0com or similar)
         self.port = None
         self.port_name = ""
@@ -59,6 +72,28 @@ class ArduinoSimulator:
         if cmd == "PING":
             return
 
+        if cmd.startswith("SET_BAUD:"):
+            rate = int(cmd.split(":")[1])
+            if rate not in (9600, 57600, 115200, 250000, 500000, 1000000, 2000000):
+                self.send_message(f"BAUD:REJECTED,{rate}")
+                return
+            self.send_message(f"BAUD:SWITCH,{rate}")
+            self.port.flush()
+            if self.baud_fallback is None:
+                self.baud_fallback = self.port.baudrate
+            self.port.baudrate = rate
+            self.baud_switch_time = time.time()
+            return
+
+        if cmd == "BAUD_CHECK":
+            self.baud_fallback = None
+            self.send_message(f"BAUD:OK,{self.port.baudrate}")
+            return
+
+        if cmd == "STOP":
+            self.remote_stop()
+            return
+
         if cmd == "RESUME":
             self.machine_stop_active = False
             self.state_idle = True
@@ -66,6 +101,17 @@ class ArduinoSimulator:
             self.send_message("MSG:System Resumed")
             return
 
+        if cmd.startswith("INJECT:"):
+            args = cmd.split(":")[1].split(",")
+            self.inject_auto_resume = len(args) > 1 and args[1] == "1"
+            self.inject_frames = 0
+            self.inject_buffer.clear()
+            self.machine_stop_active = False
+            self.state_idle = True
+            self.inject_mode = True
+            self.send_message("MSG:INJECT_READY")
+            return
+
         if cmd.startswith("SET_THR:"):
             val = int(cmd.split(":")[1])
             if 0 < val <= 1023:
@@ -90,29 +136,67 @@ class ArduinoSimulator:
             status = "ENABLED - Safety bypassed!" if self.cfg_system_override else "Disabled"
             self.send_message(f"MSG:System Override {status}")
 
-    def simulate_logic(self):
+    def remote_stop(self):
+        """Stop requested by the PC (0x18 byte or STOP command)"""
+        if not self.machine_stop_active:
+            self.machine_stop_active = True
+            self.send_message("ERR:REMOTE_STOP")
+
+    def process_injection(self, data):
+        """Consume binary injection frames: 0xA5, then a little-endian word"""
+        self.inject_buffer.extend(data)
+        while len(self.inject_buffer) >= 3:
+            if self.inject_buffer[0] != 0xA5:
+                if self.inject_buffer[0] == 0x18:
+                    self.remote_stop()
+                del self.inject_buffer[0]
+                continue
+            word = self.inject_buffer[1] | (self.inject_buffer[2] << 8)
+            del self.inject_buffer[:3]
+            if word == 0x8000:
+                self.inject_mode = False
+                self.send_message(f"MSG:INJECT_END:{self.inject_frames}")
+                return
+            if word == 0x8001:
+                self.process_command("RESUME")
+                continue
+            if word & 0x8000:
+                continue
+            self.inject_frames += 1
+            self.simulate_logic(word & 0x03FF, bool(word & 0x0400))
+            if self.inject_frames % 8 == 0:
+                self.send_message(f"INJ:{self.inject_frames}")
+            if self.inject_auto_resume and self.machine_stop_active and self.state_idle:
+                self.machine_stop_active = False
+
+    def simulate_logic(self, adc_value=None, envelope_present=None):
         """Simulate Arduino state machine logic"""
+        if adc_value is None:
+            adc_value = self.manual_adc
+        if envelope_present is None:
+            envelope_present = self.envelope_present
+
         # Check sensor range (50-1000 absolute range, only trigger once)
         # Skip if system override is enabled
         if not self.cfg_system_override:
-            if self.manual_adc < 50 or self.manual_adc > 1000:
+            if adc_value < 50 or adc_value > 1000:
                 if not self.machine_stop_active:
                     self.machine_stop_active = True
                     self.send_message("ERR:SENSOR_OUT_OF_RANGE")
                 return
 
         # State machine
-        if self.state_idle and self.envelope_present:
+        if self.state_idle and envelope_present:
             # Transition to measuring
             self.state_idle = False
             self.max_peak_in_window = 0
 
-        if not self.state_idle and self.envelope_present:
+        if not self.state_idle and envelope_present:
             # Track peak
-            if self.manual_adc > self.max_peak_in_window:
-                self.max_peak_in_window = self.manual_adc
+            if adc_value > self.max_peak_in_window:
+                self.max_peak_in_window = adc_value
 
-        if not self.state_idle and not self.envelope_present:
+        if not self.state_idle and not envelope_present:
             # Envelope finished, validate
             if self.max_peak_in_window >= self.cfg_card_threshold:
                 # PASS: Card detected - include max value
@@ -138,12 +222,29 @@ class ArduinoSimulator:
         while self.running:
             current_time = time.time()
 
-            # Read commands from serial
+            # Read commands (or injection frames) from serial
             if self.port and self.port.is_open:
                 try:
-                    if self.port.in_waiting:
-                        line = self.port.readline().decode('utf-8', errors='ignore')
-                        self.process_command(line)
+                    if self.inject_mode:
+                        if self.port.in_waiting:
+                            self.process_injection(self.port.read(self.port.in_waiting))
+                    elif self.port.in_waiting:
+                        # Assemble lines without blocking, like the firmware;
+                        # the remote stop byte counts wherever it appears
+                        data = self.port.read(self.port.in_waiting)
+                        if b"\x18" in data:
+                            self.remote_stop()
+                            data = data.replace(b"\x18", b"")
+                        self.rx_buffer.extend(data)
+                        while b"\n" in self.rx_buffer:
+                            line, _, rest = bytes(self.rx_buffer).partition(b"\n")
+                            self.rx_buffer = bytearray(rest)
+                            self.process_command(line.decode('utf-8', errors='ignore'))
+                            if self.inject_mode:
+                                # Anything after INJECT: is already sample frames
+                                self.process_injection(bytes(self.rx_buffer))
+                                self.rx_buffer.clear()
+                                break
                 except Exception as e:
                     print(f"Read error: {e}")
                     status_callback("Disconnected")
@@ -151,6 +252,18 @@ class ArduinoSimulator:
                         self.port.close()
                     self.port = None
 
+            # Unconfirmed baud switch: return to the previous rate after 1s
+            if self.baud_fallback is not None and current_time - self.baud_switch_time > 1.0:
+                if self.port and self.port.is_open:
+                    self.port.baudrate = self.baud_fallback
+                    self.send_message(f"BAUD:FALLBACK,{self.baud_fallback}")
+                self.baud_fallback = None
+
+            # Injected samples replace both the telemetry and the manual controls
+            if self.inject_mode:
+                time.sleep(0.01)
+                continue
+
             # Send telemetry every 100ms (10Hz like Arduino)
             if current_time - last_telemetry >= 0.1:
                 self.send_telemetry()
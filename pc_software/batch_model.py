@@ -0,0 +1,255 @@
+"""Many detector configurations over one trace at once, with numpy.
+
+Every configuration is a lane. Each sample is one pass of array
+operations over all lanes (structure of arrays: one array per state
+variable), covering what Detector does per sample: filter, range check,
+debounce, state machine, noise floor, leading/trailing blanking, the
+maximum peak, verdict and confidence. The lines per lane are the same as
+Detector.run gives for that configuration; --verify checks every lane.
+
+Only PEAK_MODE MAX and BLANK_UNIT ms are batched; sweeps over the other
+estimators or percent blanking need Detector. With MAX, the delay line
+reduces to "the maximum of the values at least the trailing window older
+than the newest", kept with a ring of the last BLANK_DELAY_MS + 1 samples.
+The ring is indexed by sample, so lag and lead are counted in samples
+(rounded up from ms, as the 1 ms buckets release them).
+
+The cost per sample hardly depends on the number of lanes, so this pays
+off from a few dozen configurations on.
+
+Usage:
+    python batch_model.py trace.csv --sweep THR=130:200:10 BLANK_TRAIL=0:16:4 --verify
+    python batch_model.py trace.csv --sweep FILTER_ALPHA=0.1,0.2,0.3 --config DEBOUNCE_MS=5
+"""
+import argparse
+import itertools
+import sys
+import time
+
+import numpy as np
+
+from detector_model import (BLANK_DELAY_MS, BLANK_MS, CONFIDENCE_MAX, NOISE_CLIP, NOISE_EMA_DIV,
+                            PEAK_MAX, STATE_FAULT, STATE_IDLE, STATE_MEASURING, Detector, f32, verdict)
+from parallel_replay import parse_config
+from trace_replay import load_trace
+
+RING = BLANK_DELAY_MS + 1
+
+
+def ctrunc(a, b):
+    """C division of an int64 array by a positive int (array), towards zero"""
+    return np.sign(a) * (np.abs(a) // b)
+
+
+class BatchDetector:
+    """Detector for a list of configurations side by side"""
+
+    def __init__(self, configs, sample_ms=1, auto_resume=True):
+        configs = [dict(Detector.DEFAULTS, **c) for c in configs]
+        for c in configs:
+            if c["peak_mode"] != PEAK_MAX or c["blank_unit"] != BLANK_MS:
+                raise ValueError("only PEAK_MODE MAX and BLANK_UNIT ms are batched, use Detector")
+        self.configs = configs
+        self.sample_ms = sample_ms
+        self.auto_resume = auto_resume
+        lanes = len(configs)
+
+        def column(name, dtype=np.int64):
+            return np.array([c[name] for c in configs], dtype=dtype)
+
+        # Same float32 constants as Filter
+        self.alpha = np.array([f32(c["filter_alpha"]) for c in configs], dtype=np.float32)
+        self.one_minus = np.array([f32(1.0 - f32(c["filter_alpha"])) for c in configs], dtype=np.float32)
+        self.thr = column("thr")
+        self.upper = column("thr_upper")
+        self.debounce = column("debounce_ms")
+        self.sensor_min = column("sensor_min")
+        self.sensor_max = column("sensor_max")
+        self.band = column("marginal_band")
+        # Samples are at offsets sample_ms, 2 * sample_ms, ...; count them
+        self.lead = np.maximum(-(-column("blank_lead") // sample_ms), 1)
+        trail = np.minimum(column("blank_trail"), BLANK_DELAY_MS - 1)
+        self.lag = np.where(trail > 0, -(-(trail + 1) // sample_ms), 0)  # Samples still held back
+
+        self.clock = 0
+        self.frames = 0
+        self.value = np.zeros(lanes, dtype=np.float32)
+        self.state = np.full(lanes, STATE_IDLE, dtype=np.int8)
+        self.stop = np.zeros(lanes, dtype=bool)
+        self.envelope_state = np.zeros(lanes, dtype=bool)
+        self.last_flickerable = np.zeros(lanes, dtype=bool)
+        self.last_debounce = np.zeros(lanes, dtype=np.int64)
+        self.present = np.zeros(lanes, dtype=bool)
+        self.start = np.zeros(lanes, dtype=np.int64)
+        self.noise_floor_q4 = np.full(lanes, -1, dtype=np.int64)
+        self.noise_mad_q4 = np.full(lanes, 16, dtype=np.int64)
+        self.peak = np.zeros(lanes, dtype=np.int64)
+        self.fed = np.zeros(lanes, dtype=bool)  # Any value past the blanking
+        self.unblanked = np.zeros(lanes, dtype=np.int64)  # Peak when blanking took the whole envelope
+        self.ring = np.zeros((lanes, RING), dtype=np.int64)
+        self.lanes = np.arange(lanes)
+        self.lines = [[] for _ in configs]
+
+    def feed(self, adc, envelope):
+        """One sample for every lane (adc and envelope scalars or per-lane arrays)"""
+        self.clock += self.sample_ms
+        self.frames += 1
+        if self.frames == 1:
+            self.value[:] = adc
+            self.envelope_state[:] = envelope
+            self.last_flickerable[:] = envelope
+            self.last_debounce[:] = self.clock
+        self.value = self.alpha * np.float32(adc) + self.one_minus * self.value
+        value = self.value.astype(np.int64)
+
+        quiet = (self.state == STATE_IDLE) & ~self.present
+        if quiet.any():
+            value_q4 = value * 16
+            floor = np.where(self.noise_floor_q4 < 0, value_q4, self.noise_floor_q4)
+            limit = self.noise_mad_q4 * NOISE_CLIP
+            deviation = np.clip(value_q4 - floor, -limit, limit)
+            mad = self.noise_mad_q4 + ctrunc(np.abs(deviation) - self.noise_mad_q4, NOISE_EMA_DIV)
+            self.noise_mad_q4 = np.where(quiet, mad, self.noise_mad_q4)
+            self.noise_floor_q4 = np.where(quiet, floor + ctrunc(deviation, NOISE_EMA_DIV),
+                                           self.noise_floor_q4)
+
+        out_of_range = ((value < self.sensor_min) | (value > self.sensor_max)) & ~self.stop
+        if out_of_range.any():
+            self.stop |= out_of_range
+            self.state[out_of_range] = STATE_FAULT
+            for lane in np.flatnonzero(out_of_range):
+                self.lines[lane].append("ERR:SENSOR_OUT_OF_RANGE")
+
+        changed = self.last_flickerable != envelope
+        self.last_debounce = np.where(changed, self.clock, self.last_debounce)
+        self.last_flickerable = np.where(changed, envelope, self.last_flickerable)
+        stable = self.clock - self.last_debounce > self.debounce
+        self.envelope_state = np.where(stable, envelope, self.envelope_state)
+        self.present = self.envelope_state
+
+        measuring = self.state == STATE_MEASURING
+        begin = (self.state == STATE_IDLE) & self.present
+        if begin.any():
+            self.state[begin] = STATE_MEASURING
+            self.peak[begin] = 0
+            self.fed[begin] = False
+            self.unblanked[begin] = 0
+            self.start[begin] = self.clock
+        if not measuring.any():
+            return
+
+        index = (self.clock - self.start) // self.sample_ms
+        self.ring[self.lanes, index % RING] = value
+        released = index - self.lag
+        take = measuring & (released >= self.lead)
+        self.peak = np.where(take, np.maximum(self.peak, self.ring[self.lanes, released % RING]), self.peak)
+        self.fed |= take
+        self.unblanked = np.where(measuring, np.maximum(self.unblanked, value), self.unblanked)
+
+        end = measuring & ~self.present
+        if end.any():
+            self.peak = np.where(end & ~self.fed, self.unblanked, self.peak)
+            self._verdicts(end)
+
+    def _verdicts(self, end):
+        sigma_q4 = np.maximum(self.noise_mad_q4 * 5 // 4, 16)
+        margin = np.minimum(self.peak - self.thr, self.upper - self.peak)
+        confidence = np.clip(ctrunc(margin * 160, sigma_q4), -CONFIDENCE_MAX, CONFIDENCE_MAX)
+        for lane in np.flatnonzero(end):
+            peak = int(self.peak[lane])
+            name = verdict(peak, self.thr[lane], self.upper[lane])
+            if name == "PASS":
+                band = self.band[lane]
+                if band > 0 and (peak < self.thr[lane] + band or peak > self.upper[lane] - band):
+                    name = "PASS_MARGINAL"
+                self.lines[lane].append(f"EVT:{name}:{peak}:{confidence[lane]}")
+            else:
+                self.lines[lane].append(f"ERR:{name}:{peak}:{confidence[lane]}")
+                self.stop[lane] = True
+        self.state[end] = STATE_IDLE
+        if self.auto_resume:
+            resume = end & self.stop
+            self.stop[resume] = False
+            self.value[resume] = self.value[resume].astype(np.int64)  # filteredValue = sensorValue
+
+    def run(self, samples):
+        """Feed (adc, envelope) samples, return the lines of every lane"""
+        for adc, envelope in samples:
+            self.feed(adc, envelope)
+        return self.lines
+
+
+def parse_sweep(items):
+    """NAME=start:stop:step (stop included) or NAME=v1,v2,... -> {name: [values]}"""
+    sweep = {}
+    for item in items:
+        name, spec = item.split("=", 1)
+        number = float if "." in spec else int
+        if ":" in spec:
+            start, stop, step = (number(x) for x in spec.split(":"))
+            values = []
+            while values == [] or values[-1] + step <= stop:
+                values.append(start if not values else values[-1] + step)
+        else:
+            values = [number(x) for x in spec.split(",")]
+        sweep[name.lower()] = values
+    return sweep
+
+
+def summarize(lines):
+    counts = {}
+    for line in lines:
+        name = line.split(":")[1]
+        counts[name] = counts.get(name, 0) + 1
+    return counts
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Sweep detector parameters over a trace with numpy")
+    parser.add_argument("trace", help="Trace file with adc,envelope lines")
+    parser.add_argument("--sweep", nargs="+", required=True,
+                        help="Parameters to sweep, NAME=start:stop:step or NAME=v1,v2,...")
+    parser.add_argument("--config", nargs="*", default=[], help="Fixed parameters as NAME=VALUE")
+    parser.add_argument("--sample-ms", type=int, default=1, help="Trace sample period in ms")
+    parser.add_argument("--no-auto-resume", action="store_true",
+                        help="Stop at the first fault like the real machine")
+    parser.add_argument("--verify", action="store_true",
+                        help="Replay every configuration with Detector and compare")
+    args = parser.parse_args()
+
+    samples = load_trace(args.trace)
+    if not samples:
+        print("Trace is empty")
+        return 2
+    base = parse_config(args.config)
+    sweep = parse_sweep(args.sweep)
+    configs = [dict(base, **dict(zip(sweep, values))) for values in itertools.product(*sweep.values())]
+
+    start = time.time()
+    batch = BatchDetector(configs, args.sample_ms, not args.no_auto_resume)
+    results = batch.run(samples)
+    elapsed = time.time() - start
+    print(f"{len(configs)} configurations x {len(samples)} samples in {elapsed:.2f}s")
+
+    names = ["PASS", "PASS_MARGINAL", "EMPTY_ENVELOPE", "DOUBLE_CARD", "SENSOR_OUT_OF_RANGE"]
+    print("".join(f"{n.upper():>14}" for n in sweep) + "".join(f"{n:>{len(n) + 2}}" for n in names))
+    for config, lines in zip(configs, results):
+        counts = summarize(lines)
+        print("".join(f"{config[n]:>14}" for n in sweep) +
+              "".join(f"{counts.get(n, 0):>{len(n) + 2}}" for n in names))
+
+    status = 0
+    if args.verify:
+        start = time.time()
+        mismatched = [i for i, config in enumerate(configs)
+                      if Detector(config, args.sample_ms, not args.no_auto_resume).run(samples) != results[i]]
+        print(f"Scalar replay {time.time() - start:.2f}s: "
+              f"{len(configs) - len(mismatched)}/{len(configs)} configurations identical")
+        for i in mismatched:
+            print(f"  DIFFERENT: {configs[i]}")
+        status = 1 if mismatched else 0
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
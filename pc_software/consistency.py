@@ -0,0 +1,158 @@
+"""Flag machines whose sensor disagrees with the others on the same recipe.
+
+Each inserter's HMI keeps peak and baseline sketches (peak_sketches.py).
+Given the sketch files of several machines, every device is compared with
+the merge of its peers on the same recipe over the last --hours:
+
+  KS  largest gap between the two cumulative distributions (0..1), exact
+      on the sketches since they share one bucket grid
+  W1  Wasserstein distance, the mean shift between the distributions in
+      ADC counts (from the 0.5 .. 99.5 percentiles)
+
+A device is an outlier when KS exceeds both --ks and the two-sample
+critical value at --alpha, so small samples do not raise alerts, and W1
+is at least --min-shift: baselines are narrow enough for a one-count
+offset between sensors to give a large KS. With
+--watch the files are read again when their HMI has saved them and alerts
+are printed when they are raised or cleared. --metrics-file writes the
+distances as Prometheus text (node_exporter textfile collector).
+
+Usage:
+    python consistency.py line1/peak_sketches.json line2/peak_sketches.json line3/peak_sketches.json
+    python consistency.py //server/hmi/*/peak_sketches.json --watch 60 --metrics-file consistency.prom
+"""
+import argparse
+import math
+import os
+import sys
+import time
+from datetime import datetime, timedelta
+
+from peak_sketches import SketchStore, hour_key
+from streaming_stats import QuantileSketch
+
+
+def ks_distance(a, b):
+    """Two-sample Kolmogorov-Smirnov statistic of two sketches of one accuracy"""
+    fa = a.zeros / a.count
+    fb = b.zeros / b.count
+    distance = abs(fa - fb)
+    for k in sorted(set(a.buckets) | set(b.buckets)):
+        fa += a.buckets.get(k, 0) / a.count
+        fb += b.buckets.get(k, 0) / b.count
+        distance = max(distance, abs(fa - fb))
+    return distance
+
+
+def wasserstein(a, b):
+    return sum(abs(a.quantile(p + 0.5) - b.quantile(p + 0.5)) for p in range(100)) / 100
+
+
+def ks_critical(n, m, alpha):
+    return math.sqrt(-math.log(alpha / 2) / 2) * math.sqrt((n + m) / (n * m))
+
+
+def compare(store, metrics, since, until, ks, alpha, min_shift, min_count):
+    """[(recipe, device, metric, n, ks, w1, own p50, peers p50, outlier)]"""
+    windows = {}  # (recipe, metric) -> {device: merged sketch}
+    for device, recipe, hour in store.select(since=since, until=until):
+        for metric, sketch in store.sketches[(device, recipe, hour)].items():
+            if metric in metrics:
+                devices = windows.setdefault((recipe, metric), {})
+                devices.setdefault(device, QuantileSketch(store.accuracy)).merge(sketch)
+
+    rows = []
+    for (recipe, metric), devices in sorted(windows.items()):
+        for device, own in sorted(devices.items()):
+            peers = QuantileSketch(store.accuracy)
+            for other, sketch in devices.items():
+                if other != device:
+                    peers.merge(sketch)
+            if own.count < min_count or peers.count < min_count:
+                continue
+            d = ks_distance(own, peers)
+            w1 = wasserstein(own, peers)
+            outlier = d > max(ks, ks_critical(own.count, peers.count, alpha)) and w1 >= min_shift
+            rows.append((recipe, device, metric, own.count, d, w1, own.quantile(50), peers.quantile(50), outlier))
+    return rows
+
+
+def label_escape(value):
+    return str(value).replace("\\", "\\\\").replace('"', '\\"')
+
+
+def write_metrics(path, rows):
+    lines = []
+    for name, column, text in (("card_consistency_ks", 4, "KS distance to the peers on the same recipe"),
+                               ("card_consistency_wasserstein", 5, "Mean shift from the peers in ADC counts"),
+                               ("card_consistency_outlier", 8, "1 when the device is flagged")):
+        lines.append(f"# HELP {name} {text}")
+        lines.append(f"# TYPE {name} gauge")
+        for row in rows:
+            labels = f'recipe="{label_escape(row[0])}",device="{label_escape(row[1])}",metric="{row[2]}"'
+            lines.append(f"{name}{{{labels}}} {float(row[column]):g}")
+    with open(path + ".tmp", 'w') as f:
+        f.write("\n".join(lines) + "\n")
+    os.replace(path + ".tmp", path)
+
+
+def load(paths):
+    store = SketchStore(paths[0], load=False)
+    for path in paths:
+        store.absorb(SketchStore(path))
+    return store
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare each machine's distributions with its peers")
+    parser.add_argument("stores", nargs="+", help="Sketch files of the HMIs to compare")
+    parser.add_argument("--metric", nargs="+", default=["peak", "baseline"], help="Distributions to compare")
+    parser.add_argument("--hours", type=int, default=8, help="Window up to now (or --until)")
+    parser.add_argument("--until", help="End hour of the window (excluded), e.g. 2026-10-18T14")
+    parser.add_argument("--ks", type=float, default=0.2, help="Smallest KS distance flagged")
+    parser.add_argument("--alpha", type=float, default=0.001, help="Significance of the KS test")
+    parser.add_argument("--min-shift", type=float, default=5, help="Smallest W1 flagged, ADC counts")
+    parser.add_argument("--min-count", type=int, default=50, help="Fewer values are not compared")
+    parser.add_argument("--watch", type=float, default=0, help="Check again every this many seconds")
+    parser.add_argument("--metrics-file", help="Write the distances here as Prometheus text")
+    args = parser.parse_args()
+
+    flagged = set()
+    mtimes = None
+    while True:
+        current = [os.path.getmtime(p) if os.path.exists(p) else None for p in args.stores]
+        if current != mtimes:
+            mtimes = current
+            store = load([p for p, m in zip(args.stores, current) if m is not None])
+            end = datetime.strptime(args.until, "%Y-%m-%dT%H") if args.until else \
+                datetime.now() + timedelta(hours=1)
+            rows = compare(store, args.metric, hour_key(end - timedelta(hours=args.hours)),
+                           hour_key(end), args.ks, args.alpha, args.min_shift, args.min_count)
+            stamp = datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+            if not args.watch:
+                print(f"{'recipe':<12}{'device':<16}{'metric':<10}{'n':>8}{'KS':>7}{'W1':>7}"
+                      f"{'p50':>7}{'peers':>7}")
+                for recipe, device, metric, n, d, w1, p50, peers50, outlier in rows:
+                    print(f"{recipe:<12}{device:<16}{metric:<10}{n:>8}{d:>7.3f}{w1:>7.1f}"
+                          f"{p50:>7.0f}{peers50:>7.0f}{'  OUTLIER' if outlier else ''}")
+            now_flagged = set()
+            for recipe, device, metric, n, d, w1, p50, peers50, outlier in rows:
+                key = (recipe, device, metric)
+                if outlier:
+                    now_flagged.add(key)
+                    if args.watch and key not in flagged:
+                        print(f"[{stamp}] ALERT {device} {metric} on {recipe}: KS={d:.3f} "
+                              f"W1={w1:.1f} p50 {p50:.0f} vs peers {peers50:.0f}")
+            if args.watch:
+                for recipe, device, metric in sorted(flagged - now_flagged):
+                    print(f"[{stamp}] CLEAR {device} {metric} on {recipe}")
+            flagged = now_flagged
+            if args.metrics_file:
+                write_metrics(args.metrics_file, rows)
+        if not args.watch:
+            return 1 if flagged else 0
+        time.sleep(args.watch)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
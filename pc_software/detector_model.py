@@ -0,0 +1,496 @@
+"""Host-side model of the firmware detector, for offline experiments.
+
+Mirrors processSample() closely enough to compare settings on synthetic
+or recorded envelopes without a board: float32 EMA filter, peak
+estimators (PEAK_MODE), leading/trailing blanking (BLANK_*) and the
+threshold verdict of validateResult().
+
+Detector runs a whole trace the way an injected replay (INJECT) does on
+the device and prints the same EVT:/ERR: lines. Its state outside an
+envelope fits in a small snapshot (see Detector.snapshot), which
+parallel_replay.py uses to replay segments of one trace side by side.
+
+Run directly to compare how often each peak estimator changes its
+verdict under noise:
+    python detector_model.py --envelopes 2000 --spike-prob 0.01
+or how blanking handles spikes at the envelope edges:
+    python detector_model.py --edge-spikes --blank-trail 8
+"""
+import argparse
+import random
+import struct
+
+PEAK_MAX = 0
+PEAK_TOPK = 1
+PEAK_PLATEAU = 2
+PEAK_MODE_NAMES = {PEAK_MAX: "MAX", PEAK_TOPK: "TOPK", PEAK_PLATEAU: "PLATEAU"}
+PEAK_TOPK_MAX = 16
+
+BLANK_MS = 0
+BLANK_PERCENT = 1
+BLANK_DELAY_MS = 32
+BLANK_PERCENT_MAX = 50
+
+STATE_IDLE = 0
+STATE_MEASURING = 1
+STATE_FAULT = 2
+NOISE_EMA_DIV = 64
+NOISE_CLIP = 4
+CONFIDENCE_MAX = 9999
+
+
+def f32(x):
+    """Round to an IEEE single, like float arithmetic on the AVR"""
+    return struct.unpack('<f', struct.pack('<f', x))[0]
+
+
+def cdiv(a, b):
+    """Integer division truncating towards zero, like C"""
+    q = abs(a) // abs(b)
+    return q if (a >= 0) == (b >= 0) else -q
+
+
+class Filter:
+    """EMA filter as in processSample(), sensorValue = (int)filteredValue"""
+
+    def __init__(self, alpha=0.2, seed=0):
+        self.alpha = f32(alpha)
+        self.one_minus = f32(1.0 - self.alpha)
+        self.value = f32(seed)
+
+    def step(self, raw):
+        self.value = f32(f32(self.alpha * raw) + f32(self.one_minus * self.value))
+        return int(self.value)
+
+
+class PeakEstimator:
+    """Streaming peak estimate over one envelope (peakAdd/peakEstimate)"""
+
+    def __init__(self, mode=PEAK_MAX, topk=8, plateau_pct=90):
+        self.mode = mode
+        self.topk = max(1, min(PEAK_TOPK_MAX, topk))
+        self.plateau_pct = plateau_pct
+        self.reset()
+
+    def reset(self):
+        self.maximum = 0
+        self.top = []
+        self.run_len = self.run_sum = self.run_min = 0
+        self.best_len = self.best_sum = self.best_min = 0
+        self.fed = False  # Any value added, after blanking
+        self.unblanked = 0  # Highest sample before blanking, the fallback when blanking took all
+
+    def add(self, value):
+        self.fed = True
+        if value > self.maximum:
+            self.maximum = value
+        if self.mode == PEAK_TOPK:
+            if len(self.top) == self.topk and value <= self.top[-1]:
+                return
+            if len(self.top) == self.topk:
+                self.top.pop()
+            i = len(self.top)
+            while i > 0 and self.top[i - 1] < value:
+                i -= 1
+            self.top.insert(i, value)
+        elif self.mode == PEAK_PLATEAU:
+            level = self.maximum * self.plateau_pct // 100
+            if value >= level:
+                if self.run_len > 0 and self.run_min < level:
+                    self.run_len = 0
+                if self.run_len == 0:
+                    self.run_sum = 0
+                    self.run_min = value
+                self.run_len += 1
+                self.run_sum += value
+                self.run_min = min(self.run_min, value)
+            elif self.run_len > 0:
+                if self.run_len > self.best_len:
+                    self.best_len, self.best_sum, self.best_min = self.run_len, self.run_sum, self.run_min
+                self.run_len = 0
+
+    def estimate(self):
+        if self.mode == PEAK_TOPK and self.top:
+            return sum(self.top) // len(self.top)
+        if self.mode == PEAK_PLATEAU:
+            level = self.maximum * self.plateau_pct // 100
+            best_valid = self.best_len > 0 and self.best_min >= level
+            if self.run_len > 0 and self.run_min >= level and (not best_valid or self.run_len > self.best_len):
+                return self.run_sum // self.run_len
+            if best_valid:
+                return self.best_sum // self.best_len
+        return self.maximum
+
+
+class Blanking:
+    """Leading/trailing blanking with the firmware's 1 ms bucket delay line.
+
+    Values passed to add() are released to the estimator in the same order
+    and with the same bucketing as blankAdd()/blankFinish().
+    """
+
+    def __init__(self, lead=0, trail=0, unit=BLANK_MS):
+        self.lead = lead
+        self.trail = trail
+        self.unit = unit
+        self.last_ms = 0
+        self.slots = [-1] * BLANK_DELAY_MS
+        self.next = 0
+        self.lead_ms = 0
+
+    def start(self):
+        self.slots = [-1] * BLANK_DELAY_MS
+        if self.unit == BLANK_PERCENT:
+            self.lead_ms = self.last_ms * min(self.lead, BLANK_PERCENT_MAX) // 100
+        else:
+            self.lead_ms = self.lead
+        self.next = self.lead_ms
+
+    def _release(self, estimator):
+        i = self.next % BLANK_DELAY_MS
+        if self.slots[i] >= 0:
+            estimator.add(self.slots[i])
+            self.slots[i] = -1
+        self.next += 1
+
+    def add(self, offset, value, estimator):
+        if self.trail == 0:
+            if offset >= self.lead_ms:
+                estimator.add(value)
+            return
+        if offset < self.lead_ms:
+            return
+        delay = BLANK_DELAY_MS - 1
+        if self.unit == BLANK_MS:
+            delay = min(self.trail, delay)
+        released = 0
+        while self.next + delay < offset:
+            if released == BLANK_DELAY_MS:
+                self.next = offset - delay
+                break
+            self._release(estimator)
+            released += 1
+        i = offset % BLANK_DELAY_MS
+        self.slots[i] = max(self.slots[i], value)
+
+    def finish(self, duration, estimator):
+        self.last_ms = duration
+        if self.trail == 0:
+            return
+        trail = self.trail
+        if self.unit == BLANK_PERCENT:
+            trail = duration * min(self.trail, BLANK_PERCENT_MAX) // 100
+        trail = min(trail, BLANK_DELAY_MS - 1)
+        end = duration - trail if duration > trail else 0
+        while self.next < end:
+            self._release(estimator)
+
+
+EVENT_CODES = ["PASS", "PASS_OVERRIDE", "PASS_MARGINAL", "WATCHDOG_TIMEOUT", "SENSOR_OUT_OF_RANGE",
+               "EMPTY_ENVELOPE", "DOUBLE_CARD", "AUTONOMOUS_TIMEOUT", "REMOTE_STOP"]
+
+
+def verdict(peak, threshold=150, upper=800):
+    if peak < threshold:
+        return "EMPTY_ENVELOPE"
+    if peak > upper:
+        return "DOUBLE_CARD"
+    return "PASS"
+
+
+class Detector:
+    """processSample() for injected samples, with the verdict lines it prints.
+
+    Covers the filter, sensor range check, debounce, state machine, noise
+    floor and verdict confidence, peak estimator and blanking. Not
+    modelled: override, autonomous mode and the shadow detector (no
+    effect on EVT:/ERR: lines). config takes the registry names in
+    lower case (thr, thr_upper, filter_alpha, debounce_ms, sensor_min,
+    sensor_max, marginal_band, peak_mode, peak_topk, peak_plateau_pct,
+    blank_lead, blank_trail, blank_unit); missing ones use the firmware
+    defaults. auto_resume matches INJECT:<ms>,1.
+    """
+
+    SNAPSHOT = struct.Struct('<fBBBBIiiI')
+    DEFAULTS = {"thr": 150, "thr_upper": 800, "filter_alpha": 0.2, "debounce_ms": 10,
+                "sensor_min": 50, "sensor_max": 1000, "marginal_band": 0,
+                "peak_mode": PEAK_MAX, "peak_topk": 8, "peak_plateau_pct": 90,
+                "blank_lead": 0, "blank_trail": 0, "blank_unit": BLANK_MS}
+
+    def __init__(self, config=None, sample_ms=1, auto_resume=True):
+        self.config = dict(self.DEFAULTS, **(config or {}))
+        self.sample_ms = sample_ms
+        self.auto_resume = auto_resume
+        self.filter = Filter(self.config["filter_alpha"])
+        self.estimator = PeakEstimator(self.config["peak_mode"], self.config["peak_topk"],
+                                       self.config["peak_plateau_pct"])
+        self.blanking = Blanking(self.config["blank_lead"], self.config["blank_trail"],
+                                 self.config["blank_unit"])
+        self.clock = 0
+        self.frames = 0
+        self.state = STATE_IDLE
+        self.stop_active = False
+        self.fault = ""
+        self.envelope_state = False  # Debounced envelope present
+        self.last_flickerable = False
+        self.last_debounce = 0
+        self.envelope_present = False
+        self.envelope_start = 0
+        self.noise_floor_q4 = -1
+        self.noise_mad_q4 = 16
+        self.envelopes = 0
+
+    def snapshot(self):
+        """State between envelopes as bytes; config and clock are not part of it.
+
+        Times are stored as ages, the debounce age saturated past the
+        debounce delay, so two detectors that will behave the same from
+        here on produce the same bytes. The previous envelope length only
+        matters with percent blanking and is stored as 0 otherwise.
+        """
+        if self.state == STATE_MEASURING:
+            raise ValueError("no snapshot inside an envelope")
+        age = min(self.clock - self.last_debounce, self.config["debounce_ms"] + 1)
+        last_ms = self.blanking.last_ms if self.config["blank_unit"] == BLANK_PERCENT else 0
+        fault = EVENT_CODES.index(self.fault) if self.fault else 0xFF
+        return self.SNAPSHOT.pack(self.filter.value, self.state, fault, self.envelope_state,
+                                  self.last_flickerable, age, self.noise_floor_q4,
+                                  self.noise_mad_q4, last_ms)
+
+    def restore(self, data, clock):
+        """Continue from snapshot() bytes, the next sample being at clock + sample_ms"""
+        (self.filter.value, self.state, fault, envelope_state, last_flickerable, age,
+         self.noise_floor_q4, self.noise_mad_q4, self.blanking.last_ms) = self.SNAPSHOT.unpack(data)
+        self.fault = EVENT_CODES[fault] if fault != 0xFF else ""
+        self.stop_active = fault != 0xFF
+        self.envelope_state = bool(envelope_state)
+        self.envelope_present = self.envelope_state
+        self.last_flickerable = bool(last_flickerable)
+        self.clock = clock
+        self.last_debounce = clock - age
+        self.frames = max(self.frames, 1)  # Filter and debounce are seeded
+
+    def _noise_update(self, value):
+        value_q4 = value * 16
+        if self.noise_floor_q4 < 0:
+            self.noise_floor_q4 = value_q4
+        limit = self.noise_mad_q4 * NOISE_CLIP
+        deviation = max(-limit, min(limit, value_q4 - self.noise_floor_q4))
+        self.noise_mad_q4 += cdiv(abs(deviation) - self.noise_mad_q4, NOISE_EMA_DIV)
+        self.noise_floor_q4 += cdiv(deviation, NOISE_EMA_DIV)
+
+    def _confidence(self, peak):
+        sigma_q4 = max(cdiv(self.noise_mad_q4 * 5, 4), 16)
+        margin = min(peak - self.config["thr"], self.config["thr_upper"] - peak)
+        return max(-CONFIDENCE_MAX, min(CONFIDENCE_MAX, cdiv(margin * 160, sigma_q4)))
+
+    def _stop(self, name, out, detail=""):
+        self.stop_active = True
+        self.state = STATE_FAULT
+        self.fault = name
+        out.append(f"ERR:{name}{detail}")
+
+    def _verdict(self, out):
+        cfg = self.config
+        peak = self.estimator.estimate()
+        confidence = self._confidence(peak)
+        name = verdict(peak, cfg["thr"], cfg["thr_upper"])
+        if name == "PASS":
+            band = cfg["marginal_band"]
+            if band > 0 and (peak < cfg["thr"] + band or peak > cfg["thr_upper"] - band):
+                name = "PASS_MARGINAL"
+            out.append(f"EVT:{name}:{peak}:{confidence}")
+        else:
+            self._stop(name, out, f":{peak}:{confidence}")
+
+    def _resume(self):
+        self.stop_active = False
+        self.fault = ""
+        self.state = STATE_IDLE
+        self.filter.value = f32(int(self.filter.value))  # filteredValue = sensorValue
+
+    def feed(self, adc, envelope, out):
+        """One injected sample; appends the lines the device prints to out"""
+        cfg = self.config
+        self.clock += self.sample_ms
+        self.frames += 1
+        if self.frames == 1:
+            self.filter.value = f32(adc)
+            self.envelope_state = self.last_flickerable = envelope
+            self.last_debounce = self.clock
+        value = self.filter.step(adc)
+        if self.state == STATE_IDLE and not self.envelope_present:
+            self._noise_update(value)
+        if (value < cfg["sensor_min"] or value > cfg["sensor_max"]) and not self.stop_active:
+            self._stop("SENSOR_OUT_OF_RANGE", out)
+
+        if envelope != self.last_flickerable:
+            self.last_debounce = self.clock
+            self.last_flickerable = envelope
+        if self.clock - self.last_debounce > cfg["debounce_ms"]:
+            self.envelope_state = envelope
+        self.envelope_present = self.envelope_state
+
+        if self.state == STATE_IDLE:
+            if self.envelope_present:
+                self.state = STATE_MEASURING
+                self.estimator.reset()
+                self.blanking.start()
+                self.envelope_start = self.clock
+                self.envelopes += 1
+        elif self.state == STATE_MEASURING:
+            self.estimator.unblanked = max(self.estimator.unblanked, value)
+            self.blanking.add(self.clock - self.envelope_start, value, self.estimator)
+            if not self.envelope_present:
+                self.blanking.finish(self.clock - self.envelope_start, self.estimator)
+                if not self.estimator.fed:
+                    self.estimator.add(self.estimator.unblanked)
+                self._verdict(out)
+                self.state = STATE_IDLE
+                if self.auto_resume and self.stop_active:
+                    self._resume()
+
+    def run(self, samples):
+        """Feed (adc, envelope) samples, return the printed lines"""
+        out = []
+        for adc, envelope in samples:
+            self.feed(adc, envelope, out)
+        return out
+
+
+def synth_envelope(rng, floor=110, level=400, samples=60, edge=5,
+                   sigma=4.0, spike_prob=0.0, spike_height=500, lead=30, edge_spike=0, edge_spike_ms=8):
+    """Raw ADC samples for one envelope with a card of the given level.
+
+    Returns (raw, inside): the samples and, per sample, whether the
+    envelope signal is present. Gaussian noise plus optional one-sample
+    spikes (flaps, dust), and with edge_spike a bump of that height and
+    edge_spike_ms length starting in the first or last 10 % of the envelope.
+    """
+    edge_at = -1
+    if edge_spike:
+        zone = max(1, samples // 10)
+        edge_at = rng.randrange(zone) if rng.random() < 0.5 else samples - edge_spike_ms - rng.randrange(zone)
+    raw, inside = [], []
+    for i in range(lead + samples + lead):
+        in_env = lead <= i < lead + samples
+        if in_env:
+            pos = i - lead
+            ramp = min(1.0, (pos + 1) / edge, (samples - pos) / edge)
+            value = floor + (level - floor) * ramp
+        else:
+            value = floor
+        if in_env and 0 <= i - lead - edge_at < edge_spike_ms:
+            value += edge_spike
+        value += rng.gauss(0, sigma)
+        if in_env and rng.random() < spike_prob:
+            value += spike_height
+        raw.append(max(0, min(1023, int(value))))
+        inside.append(in_env)
+    return raw, inside
+
+
+def envelope_peak(raw, inside, estimator, alpha=0.2, blanking=None, sample_ms=1):
+    """Filter the samples and return the estimate for the envelope part.
+
+    inside marks the samples the firmware handles in STATE_MEASURING. The
+    sample that started the envelope is not one of them, so the first is
+    at offset sample_ms and the last one (envelope gone) ends it.
+    """
+    filt = Filter(alpha, raw[0])
+    blanking = blanking or Blanking()
+    estimator.reset()
+    offset = None
+    for value, in_env in zip(raw, inside):
+        sensor = filt.step(value)
+        if in_env:
+            if offset is None:
+                offset = 0
+                blanking.start()
+            offset += sample_ms
+            estimator.unblanked = max(estimator.unblanked, sensor)
+            blanking.add(offset, sensor, estimator)
+    if offset is not None:
+        blanking.finish(offset, estimator)
+        if not estimator.fed:
+            estimator.add(estimator.unblanked)
+    return estimator.estimate()
+
+
+def compare_blanking(args):
+    """False DOUBLE_CARD rate from edge spikes, with and without blanking"""
+    rng = random.Random(args.seed)
+    configs = {
+        "no blanking": Blanking(),
+        f"{args.blank_lead}/{args.blank_trail} {'%' if args.blank_percent else 'ms'}":
+            Blanking(args.blank_lead, args.blank_trail, BLANK_PERCENT if args.blank_percent else BLANK_MS),
+    }
+    false_stops = {name: 0 for name in configs}
+    for _ in range(args.envelopes):
+        raw, inside = synth_envelope(rng, level=400, sigma=args.sigma, edge_spike=args.edge_spike_height)
+        for name, blanking in configs.items():
+            peak = envelope_peak(raw, inside, PeakEstimator(PEAK_MAX), blanking=blanking)
+            if verdict(peak, args.threshold, args.upper) != "PASS":
+                false_stops[name] += 1
+    print(f"{args.envelopes} good envelopes (level 400) with a {args.edge_spike_height} ADC edge spike")
+    for name, count in false_stops.items():
+        print(f"{name:<16}{count:>6} false stops")
+
+
+def compare_estimators(args):
+    rng = random.Random(args.seed)
+    estimators = {
+        "MAX": PeakEstimator(PEAK_MAX),
+        f"TOPK({args.topk})": PeakEstimator(PEAK_TOPK, topk=args.topk),
+        f"PLATEAU({args.plateau_pct}%)": PeakEstimator(PEAK_PLATEAU, plateau_pct=args.plateau_pct),
+    }
+    flips = {name: 0 for name in estimators}
+    errors = {name: [] for name in estimators}
+    for _ in range(args.envelopes):
+        level = rng.choice(args.levels)
+        clean_raw, inside = synth_envelope(rng, level=level, sigma=0.0)
+        noisy_raw, _ = synth_envelope(rng, level=level, sigma=args.sigma,
+                                      spike_prob=args.spike_prob, spike_height=args.spike_height)
+        for name, est in estimators.items():
+            clean = envelope_peak(clean_raw, inside, est)
+            noisy = envelope_peak(noisy_raw, inside, est)
+            if verdict(clean, args.threshold, args.upper) != verdict(noisy, args.threshold, args.upper):
+                flips[name] += 1
+            errors[name].append(noisy - clean)
+
+    print(f"{args.envelopes} envelopes, levels {args.levels}, sigma {args.sigma}, "
+          f"spike prob {args.spike_prob} x {args.spike_height}")
+    print(f"{'estimator':<16}{'verdict flips':>15}{'mean err':>10}{'max |err|':>11}")
+    for name in estimators:
+        errs = errors[name]
+        print(f"{name:<16}{flips[name]:>15}{sum(errs) / len(errs):>10.1f}{max(abs(e) for e in errs):>11}")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare peak estimators under synthetic noise")
+    parser.add_argument("--envelopes", type=int, default=1000)
+    parser.add_argument("--levels", type=int, nargs="+", default=[140, 400, 780],
+                        help="Card plateau levels (ADC) to draw from")
+    parser.add_argument("--sigma", type=float, default=6.0, help="Gaussian noise, ADC counts")
+    parser.add_argument("--spike-prob", type=float, default=0.02, help="Per-sample spike probability")
+    parser.add_argument("--spike-height", type=int, default=300)
+    parser.add_argument("--threshold", type=int, default=150)
+    parser.add_argument("--upper", type=int, default=800)
+    parser.add_argument("--topk", type=int, default=8)
+    parser.add_argument("--plateau-pct", type=int, default=90)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--edge-spikes", action="store_true",
+                        help="Compare blanking settings instead of estimators")
+    parser.add_argument("--edge-spike-height", type=int, default=600)
+    parser.add_argument("--blank-lead", type=int, default=15)
+    parser.add_argument("--blank-trail", type=int, default=15)
+    parser.add_argument("--blank-percent", action="store_true", help="Blanking values are percent")
+    args = parser.parse_args()
+    if args.edge_spikes:
+        compare_blanking(args)
+    else:
+        compare_estimators(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+"""Switch the device link to a faster baud rate after connecting.
+
+The device always boots at 115200. Negotiation:
+    PC  -> SET_BAUD:<rate>          (old rate)
+    dev -> BAUD:SWITCH,<rate>       (old rate), then the device switches
+    PC switches, sends BAUD_CHECK   (new rate)
+    dev -> BAUD:OK,<rate>           (new rate)
+If the check is not answered the PC returns to the old rate; the device
+does the same on its own after one second and prints BAUD:FALLBACK there.
+"""
+import time
+
+# Must match BAUD_RATES in the firmware
+SUPPORTED_RATES = (9600, 57600, 115200, 250000, 500000, 1000000, 2000000)
+
+SWITCH_TIMEOUT = 1.0   # Seconds to wait for BAUD:SWITCH
+CHECK_TIMEOUT = 0.8    # Seconds of BAUD_CHECK retries, below the device's 1 s
+FALLBACK_TIMEOUT = 1.5
+
+
+def _wait_line(ser, prefixes, timeout):
+    """Read lines until one starts with any prefix; other lines are dropped"""
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        raw = ser.readline()
+        if not raw:
+            continue
+        line = raw.decode('utf-8', errors='ignore').strip()
+        for prefix in prefixes:
+            if line.startswith(prefix):
+                return line
+    return None
+
+
+def negotiate_baud(ser, rate):
+    """Move an open link to rate. Returns the rate the link ends up on."""
+    old_rate = ser.baudrate
+    if rate == old_rate:
+        return old_rate
+    if rate not in SUPPORTED_RATES:
+        raise ValueError(f"unsupported baud rate {rate}")
+
+    old_timeout = ser.timeout
+    ser.timeout = 0.1
+    try:
+        ser.write(f"SET_BAUD:{rate}\n".encode())
+        reply = _wait_line(ser, ("BAUD:SWITCH,", "BAUD:REJECTED,"), SWITCH_TIMEOUT)
+        if reply is None or reply.startswith("BAUD:REJECTED"):
+            return old_rate
+
+        ser.baudrate = rate
+        ser.reset_input_buffer()
+        deadline = time.time() + CHECK_TIMEOUT
+        while time.time() < deadline:
+            # Leading newline terminates any garbage received during the switch
+            ser.write(b"\nBAUD_CHECK\n")
+            if _wait_line(ser, ("BAUD:OK,",), 0.25) is not None:
+                return rate
+
+        ser.baudrate = old_rate
+        ser.reset_input_buffer()
+        _wait_line(ser, ("BAUD:FALLBACK,",), FALLBACK_TIMEOUT)
+        return old_rate
+    finally:
+        ser.timeout = old_timeout
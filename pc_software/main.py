@@ -6,25 +6,70 @@ import threading
 import time
 import json
 import os
-from datetime import datetime
+import argparse
+from datetime import datetime, timedelta
+
+from link_baud import SUPPORTED_RATES, negotiate_baud
+from peak_sketches import SKETCH_FILE, SketchStore, hour_key
+from session_record import RecordingSerial, ReplaySerial, SessionRecorder, load_session
+from timeline import ClockSync, split_stamp
+from streaming_stats import SlidingMinMax
 
 # --- CONFIGURATION & STATE ---
 CONFIG_FILE = "config.json"
 ERROR_LOG_FILE = "error_log.txt"
 DEFAULT_CONFIG = {
     "serial_port": "",
-    "baud_rate": 115200,
+    "baud_rate": 115200,  # Boot rate of the device
+    "link_baud_rate": 115200,  # Rate negotiated after connecting, up to 2000000
     "floor_value": 100,
     "factor": 0.01,
+    "calibration": [],  # Optional [[adc, um], ...] table, uploaded to the device
     "envelope_card_threshold": 150,
     "envelope_card_upper_threshold": 800,  # Above this = double card (error)
     "reverse_sensor": False,
     "system_override": False,
-    "log_level": "warn",  # "info" = log all, "warn" = log errors only
+    "telemetry_mode": "periodic",  # "periodic" = 10Hz D: lines, "change" = deadband T: lines
+    "telemetry_deadband": 2,  # ADC counts, change mode only
+    "telemetry_keepalive_ms": 1000,  # Change mode only
+    "subscriptions": {},  # Extra device streams, e.g. {"ENV": 1, "HEALTH": 1000}
+    "autonomous": False,  # Keep the machine running if this PC stops responding
+    "autonomous_max_s": 0,  # Limit for unattended running, 0 = no limit
+    "device_params": {},  # Any other registry parameter, e.g. {"PEAK_MODE": 1, "PEAK_TOPK": 8}
+    "envelope_thumbnails": 0,  # 16 or 32 = show each logged envelope's shape, 0 = off
+    "fetch_stop_traces": True,  # Copy the device's trace of a stopping envelope to the log
+    "device_name": "",  # Key of this machine's peak sketches, "" = the serial port
+    "recipe": "default",  # Card/job type the sketches are kept apart by
+    "sketch_keep_days": 90,  # Sketch hours older than this are dropped at the next save, 0 = keep all
+    "timeline_file": "",  # Device-stamped events (and T: telemetry) for timeline.py, "" = off
+    "session_dir": "",  # Every byte of each connection, see session_record.py, e.g. "sessions", "" = off
+    "session_keep": 50,  # Newest session files kept
+    "session_max_mb": 20,  # A session file this big is closed and recording goes on in a new one
+    "log_level": "warn",  # "info" = log all, "warn" = log errors and marginal passes
     "total_good_count": 0,  # Persistent good envelope count
     "total_error_count": 0  # Persistent error envelope count
 }
 
+SPARK_CHARS = "▁▂▃▄▅▆▇█"
+ENVELOPE_VERDICTS = ("PASS", "PASS_OVERRIDE", "PASS_MARGINAL", "EMPTY_ENVELOPE", "DOUBLE_CARD")
+SKETCH_SAVE_S = 60
+TIME_PROBE_S = 5
+LINES_PER_PASS = 200  # Lines handled before the PING/probe checks run again
+
+
+def decode_thumbnail(hex_points):
+    """E: record thumbnail -> [(min, max), ...] in ADC counts"""
+    points = []
+    for i in range(0, len(hex_points) - 3, 4):
+        points.append((int(hex_points[i:i + 2], 16) * 4, int(hex_points[i + 2:i + 4], 16) * 4))
+    return points
+
+
+def sparkline(points):
+    """One character per point, height from the point's max on the 0..1023 scale"""
+    return "".join(SPARK_CHARS[min(len(SPARK_CHARS) - 1, mx * len(SPARK_CHARS) // 1024)] for _, mx in points)
+
+
 # PubSub Topics
 TOPIC_STATUS = "status"
 TOPIC_DATA = "data"
@@ -35,8 +80,10 @@ TOPIC_COUNTERS = "counters"
 
 class AppState:
     def __init__(self):
+        self.config_warning = ""  # Config value that was replaced at load, shown at startup
         self.config = self.load_config()
         self.connected = False
+        self.link_error = ""  # Why the last connection attempt failed
         self.raw_val = 0
         self.mm_val = 0.0
         self.envelope_active = False
@@ -47,6 +94,7 @@ class AppState:
         self.max_error_history = 10
         self.graph_points = []
         self.max_graph_points = 50
+        self.graph_range = SlidingMinMax(self.max_graph_points)  # Min/max of the plotted points
         self.floor_error = False
         self.graph_min = 0
         self.graph_max = 1023
@@ -54,6 +102,14 @@ class AppState:
         self.session_good_count = 0
         self.session_error_count = 0
         self.last_max_value = 0
+        self.thumb_entry = None  # History entry of the last verdict, waiting for its E: record
+        self.trace_fetch = None  # "LIST" while asking ENV?, then (seq, points) during GET_ENV
+        self.sketches = self.load_sketches()  # Peak/duration distributions per device, recipe and hour
+        self.sketches_saved = time.time()
+        self.clock = ClockSync()  # Device millis() -> PC time, for the timeline file
+        self.time_probe = None  # PC ms the outstanding TIME? was sent at
+        self.time_probe_at = 0
+        self.sync_stamp = None  # Device time of SYNC:BEGIN, SYNC:EVT ages count back from it
 
     def load_config(self):
         if os.path.exists(CONFIG_FILE):
@@ -69,20 +125,90 @@ class AppState:
                         return new_config
                     config = DEFAULT_CONFIG.copy()
                     config.update(loaded_config)
+                    self.check_config(config)
                     return config
             except:
                 pass
         return DEFAULT_CONFIG.copy()
 
+    def check_config(self, config):
+        """Replace values the device would refuse, noting it in config_warning"""
+        link_rate = config.get("link_baud_rate")
+        if not isinstance(link_rate, int) or link_rate not in SUPPORTED_RATES:
+            config["link_baud_rate"] = config.get("baud_rate", 115200)
+            self.config_warning = (f"link_baud_rate {link_rate} is not one of "
+                                   f"{', '.join(str(r) for r in SUPPORTED_RATES)}; "
+                                   f"using {config['link_baud_rate']}")
+
     def save_config(self):
         with open(CONFIG_FILE, 'w') as f:
             json.dump(self.config, f, indent=4)
 
-    def log_error(self, error_msg, max_val=0):
-        timestamp = datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+    def load_sketches(self):
+        try:
+            return SketchStore(SKETCH_FILE)
+        except Exception:
+            # Unreadable: keep it aside and start a new file
+            try:
+                os.replace(SKETCH_FILE, SKETCH_FILE + ".bad")
+            except OSError:
+                pass
+            return SketchStore(SKETCH_FILE, load=False)
+
+    def device_name(self):
+        return self.config.get("device_name") or self.config.get("serial_port") or "unknown"
+
+    def add_to_sketch(self, metric, value, when=None):
+        self.sketches.add(self.device_name(), self.config.get("recipe", "default"),
+                          when or datetime.now(), metric, value)
+
+    def write_timeline(self, line, device_ms):
+        """Append a line at its device time, mapped to PC time, to the timeline file"""
+        path = self.config.get("timeline_file", "")
+        t = self.clock.to_pc(device_ms)
+        if not path or t is None:
+            return
+        record = {"t": round(t, 1), "device": self.device_name(), "line": line,
+                  "sync": round(self.clock.error, 1)}
+        try:
+            with open(path, 'a') as f:
+                f.write(json.dumps(record) + "\n")
+        except:
+            pass
+
+    def warm_restart(self, line):
+        """The device reset without losing RAM and restored its state
+        (WARM:state,faultName|NONE,envelopeSeq,RESTORED|SETTINGS_CHANGED).
+        SETTINGS_CHANGED: the stored settings differ from the ones the
+        detector state was built with, so only the fault latch was kept."""
+        parts = line.split(":", 1)[1].split(",")
+        fault = parts[1] if len(parts) > 1 else "NONE"
+        settings_changed = len(parts) > 3 and parts[3] == "SETTINGS_CHANGED"
+        if fault != "NONE":
+            self.last_error = f"STOP: {fault} (kept across device reset)"
+            self.last_event = self.last_error
+            self.stop_active = True
+        elif settings_changed:
+            self.last_event = "Device reset with other settings, detector restarted"
+        else:
+            self.last_event = "Device reset, state restored"
+
+    def save_sketches(self):
+        self.sketches_saved = time.time()
+        keep_days = int(self.config.get("sketch_keep_days", 0))
+        if keep_days > 0:
+            self.sketches.prune(hour_key(datetime.now() - timedelta(days=keep_days)))
+        try:
+            self.sketches.save()
+        except OSError:
+            pass
+
+    def log_error(self, error_msg, max_val=0, when=None):
+        timestamp = (when or datetime.now()).strftime("%Y-%m-%d %H:%M:%S")
         total_err = self.config.get("total_error_count", 0)
         log_msg = f"#E{total_err} {error_msg} (max={max_val})" if max_val else f"#E{total_err} {error_msg}"
         self.error_history.insert(0, (timestamp, log_msg, "error"))
+        self.thumb_entry = self.error_history[0]
         if len(self.error_history) > self.max_error_history:
             self.error_history.pop()
         try:
@@ -91,15 +217,17 @@ class AppState:
         except:
             pass
 
-    def log_pass(self, max_val, override=False):
+    def log_pass(self, max_val, override=False, when=None):
         # Only log if log_level is "info"
         if self.config.get("log_level", "warn") != "info":
+            self.thumb_entry = None
             return
-        timestamp = datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        timestamp = (when or datetime.now()).strftime("%Y-%m-%d %H:%M:%S")
         total_good = self.config.get("total_good_count", 0)
         status = "PASS_OVERRIDE" if override else "PASS"
         log_msg = f"#G{total_good} {status} (max={max_val})"
         self.error_history.insert(0, (timestamp, log_msg, "info"))
+        self.thumb_entry = self.error_history[0]
         if len(self.error_history) > self.max_error_history:
             self.error_history.pop()
         try:
@@ -108,6 +236,49 @@ class AppState:
         except:
             pass
 
+    def log_marginal(self, max_val, confidence=None, when=None):
+        # Passed, but within MARGINAL_BAND of a threshold - logged at "warn" and "info"
+        timestamp = (when or datetime.now()).strftime("%Y-%m-%d %H:%M:%S")
+        total_good = self.config.get("total_good_count", 0)
+        detail = f"max={max_val}" if confidence is None else f"max={max_val}, conf={confidence / 10:.1f}"
+        log_msg = f"#G{total_good} PASS_MARGINAL ({detail})"
+        self.error_history.insert(0, (timestamp, log_msg, "warning"))
+        self.thumb_entry = self.error_history[0]
+        if len(self.error_history) > self.max_error_history:
+            self.error_history.pop()
+        try:
+            with open(ERROR_LOG_FILE, 'a') as f:
+                f.write(f"[{timestamp}] #G{total_good} WARNING: PASS_MARGINAL ({detail})\n")
+        except:
+            pass
+
+    def attach_thumbnail(self, seq, hex_points):
+        """Add the envelope shape from its E: record to the entry its verdict logged"""
+        entry, self.thumb_entry = self.thumb_entry, None
+        if entry is None or not any(e is entry for e in self.error_history):
+            return
+        points = decode_thumbnail(hex_points)
+        spark = sparkline(points)
+        index = next(i for i, e in enumerate(self.error_history) if e is entry)
+        timestamp, log_msg, log_type = entry
+        self.error_history[index] = (timestamp, f"{log_msg} {spark}", log_type)
+        try:
+            with open(ERROR_LOG_FILE, 'a') as f:
+                f.write(f"[{timestamp}] SHAPE #{seq}: {spark} " +
+                        " ".join(f"{mn}-{mx}" for mn, mx in points) + "\n")
+        except:
+            pass
+
+    def save_trace(self, seq, values):
+        """Write a trace fetched with GET_ENV (1 ms maxima of the filtered value) to the log"""
+        timestamp = datetime.now().strftime("%Y-%m-%d %H:%M:%S")
+        try:
+            with open(ERROR_LOG_FILE, 'a') as f:
+                f.write(f"[{timestamp}] TRACE #{seq}: {sparkline([(v, v) for v in values])} " +
+                        ",".join(str(v) for v in values) + "\n")
+        except:
+            pass
+
     def increment_good_counter(self):
         self.session_good_count += 1
         self.config["total_good_count"] = self.config.get("total_good_count", 0) + 1
@@ -118,15 +289,56 @@ class AppState:
         self.config["total_error_count"] = self.config.get("total_error_count", 0) + 1
         self.save_config()
 
-    def get_mm(self, raw_adc):
+    def get_mm(self, raw_adc, device_um=None):
         if raw_adc < 50 or raw_adc > 1000:
             self.floor_error = True
             return 0.0
         else:
             self.floor_error = False
+        # Prefer the device's calibrated value when a table is loaded
+        if device_um is not None:
+            return device_um / 1000.0
         return (raw_adc - self.config["floor_value"]) * self.config["factor"]
 
 
+def start_replay(path):
+    """Run on the session's own config in <session>.replay/, so a replay
+    neither touches this HMI's counters and logs nor records itself"""
+    header, _ = load_session(path)
+    directory = os.path.splitext(path)[0] + ".replay"
+    os.makedirs(directory, exist_ok=True)
+    config = dict(header.get("config", {}), serial_port="replay:" + os.path.abspath(path), session_dir="")
+    with open(os.path.join(directory, CONFIG_FILE), 'w') as f:
+        json.dump(config, f, indent=4)
+    os.chdir(directory)
+
+
+def open_port(port, baud):
+    """The device link: a recorded session for replay: ports, else the serial
+    port, recorded to session_dir when set"""
+    if port.startswith("replay:"):
+        return ReplaySerial(port[len("replay:"):], REPLAY_SPEED)
+    link = serial.Serial(port, baud, timeout=1)
+    if state.config.get("session_dir", ""):
+        try:
+            recorder = SessionRecorder.create(state.config["session_dir"], int(state.config.get("session_keep", 50)),
+                                              {"port": port, "baud": baud, "config": state.config},
+                                              int(float(state.config.get("session_max_mb", 0)) * 1e6))
+            link = RecordingSerial(link, recorder)
+        except OSError:
+            pass
+    return link
+
+
+# python main.py --replay sessions/session_<time>.cds [--speed N] shows a recorded session
+arg_parser = argparse.ArgumentParser(description="Card Detector HMI")
+arg_parser.add_argument("--replay", help="Session file to play into the HMI instead of a device")
+arg_parser.add_argument("--speed", type=float, default=1.0, help="Replay time factor, 0 = as fast as possible")
+args, _ = arg_parser.parse_known_args()
+REPLAY_SPEED = args.speed
+if args.replay:
+    start_replay(args.replay)
+
 state = AppState()
 serial_lock = threading.Lock()
 ser = None
@@ -136,29 +348,48 @@ def serial_handler(page: ft.Page):
     global ser
     last_ping = 0
     while True:
+        busy = False
         with serial_lock:
             if state.config["serial_port"] and not state.connected:
+                ser = None
                 try:
-                    ser = serial.Serial(state.config["serial_port"], state.config["baud_rate"], timeout=1)
+                    ser = open_port(state.config["serial_port"], state.config["baud_rate"])
                     ser.dtr = False
                     time.sleep(0.1)
                     ser.dtr = True
                     time.sleep(2.0)
-                    # Aggressive buffer clearing - read and discard all pending data
-                    ser.reset_input_buffer()
+                    # Clear everything pending, but look at it first: the DTR pulse
+                    # resets the device, and a warm restart reports itself only here
                     ser.reset_output_buffer()
-                    time.sleep(0.1)
+                    boot = b""
                     while ser.in_waiting:
-                        ser.read(ser.in_waiting)
+                        boot += ser.read(ser.in_waiting)
                         time.sleep(0.05)
                     ser.reset_input_buffer()
+                    warm = [line.strip() for line in boot.decode('utf-8', errors='ignore').splitlines()
+                            if line.startswith("WARM:")]
+                    # Faster link first: the device sizes subscriptions by its baud rate
+                    link_rate = negotiate_baud(ser, int(state.config.get("link_baud_rate", ser.baudrate)))
+                    if link_rate != state.config.get("link_baud_rate", link_rate):
+                        state.last_event = f"Link stays at {link_rate} baud"
                     state.graph_points.clear()
+                    state.graph_range.reset()
                     state.graph_min = 0
                     state.graph_max = 1023
                     state.connected = True
                     page.pubsub.send_all_on_topic(TOPIC_STATUS, None)
+                    if warm:
+                        state.warm_restart(warm[-1])
+                        page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
                     ser.write(f"SET_FLOOR:{state.config['floor_value']}\n".encode())
                     time.sleep(0.1)
+                    # Calibration table goes first so thresholds in um can be converted.
+                    # The device may still hold a table from an earlier session.
+                    ser.write(b"CAL_CLEAR\n")
+                    time.sleep(0.05)
+                    for adc, um in state.config.get("calibration", []):
+                        ser.write(f"CAL_ADD:{int(adc)},{int(um)}\n".encode())
+                        time.sleep(0.05)
                     ser.write(f"SET_THR:{state.config['envelope_card_threshold']}\n".encode())
                     time.sleep(0.1)
                     ser.write(f"SET_THR_UPPER:{state.config.get('envelope_card_upper_threshold', 800)}\n".encode())
@@ -168,24 +399,83 @@ def serial_handler(page: ft.Page):
                     time.sleep(0.1)
                     override_val = 1 if state.config.get('system_override', False) else 0
                     ser.write(f"SET_OVERRIDE:{override_val}\n".encode())
-                except Exception:
+                    if state.config.get("telemetry_mode", "periodic") == "change":
+                        time.sleep(0.1)
+                        ser.write(f"SET_DEADBAND:{state.config.get('telemetry_deadband', 2)}\n".encode())
+                        time.sleep(0.1)
+                        ser.write(f"SET_KEEPALIVE:{state.config.get('telemetry_keepalive_ms', 1000)}\n".encode())
+                        time.sleep(0.1)
+                        ser.write(b"SET_TELEM_MODE:1\n")
+                    thumb_points = int(state.config.get("envelope_thumbnails", 0))
+                    if thumb_points:
+                        time.sleep(0.1)
+                        ser.write(f"SET:THUMB_POINTS={thumb_points}\n".encode())
+                        time.sleep(0.1)
+                        ser.write(b"SUBSCRIBE:ENV,1\n")
+                    for stream, period in state.config.get("subscriptions", {}).items():
+                        time.sleep(0.1)
+                        ser.write(f"SUBSCRIBE:{stream},{int(period)}\n".encode())
+                    time.sleep(0.1)
+                    ser.write(f"SET:AUTONOMOUS={1 if state.config.get('autonomous', False) else 0}\n".encode())
+                    time.sleep(0.1)
+                    ser.write(f"SET:AUTONOMOUS_MAX_S={int(state.config.get('autonomous_max_s', 0))}\n".encode())
+                    for name, value in state.config.get("device_params", {}).items():
+                        time.sleep(0.1)
+                        ser.write(f"SET:{name}={value}\n".encode())
+                    if state.config.get("timeline_file", ""):
+                        time.sleep(0.1)
+                        ser.write(b"SET:EVENT_STAMPS=1\n")
+                        state.clock = ClockSync()  # The device clock restarted with the port
+                        state.time_probe_at = 0
+                    state.link_error = ""
+                except Exception as e:
+                    state.connected = False
+                    state.link_error = str(e) or type(e).__name__
+                    page.pubsub.send_all_on_topic(TOPIC_STATUS, None)
                     time.sleep(2)
+                finally:
+                    # A failed attempt must not leave the port open for the next one
+                    if not state.connected and ser:
+                        try:
+                            ser.close()
+                        except Exception:
+                            pass
 
         if state.connected and ser and ser.is_open:
             try:
-                if ser.in_waiting:
+                lines_read = 0
+                # Drain what is waiting, so a fast stream cannot leave the HMI behind
+                while ser.in_waiting and lines_read < LINES_PER_PASS:
+                    lines_read += 1
+                    busy = True
                     line = ser.readline().decode('utf-8', errors='ignore').strip()
-                    if line.startswith("D:"):
+                    line, stamp = split_stamp(line)  # EVENT_STAMPS suffix, see timeline.py
+                    if stamp is not None:
+                        state.write_timeline(line, stamp)
+                    elif line.startswith("T:"):
+                        state.write_timeline(line, int(line[2:].split(",", 1)[0]))
+                    if line.startswith("TIME:"):
+                        # Reply to the clock probe: TIME:millis
+                        if state.time_probe is not None:
+                            state.clock.add(state.time_probe, int(line[5:]), time.time() * 1000)
+                            state.time_probe = None
+                    elif line.startswith("D:") or line.startswith("T:"):
                         parts = line.split(":")[1].split(",")
+                        if line.startswith("T:"):
+                            # Change-driven record: T:millis,value,envelope,stop[,um]
+                            parts = parts[1:]
                         if len(parts) >= 3:
                             state.raw_val = int(parts[0])
-                            state.mm_val = state.get_mm(state.raw_val)
+                            device_um = int(parts[3]) if len(parts) >= 4 else None
+                            state.mm_val = state.get_mm(state.raw_val, device_um)
                             state.envelope_active = (parts[1] == "1")
                             state.stop_active = (parts[2] == "1")
+                            if not state.envelope_active:
+                                state.add_to_sketch("baseline", state.raw_val)
+                            state.graph_range.add(state.raw_val)
                             if len(state.graph_points) > 0:
-                                raw_values = [p.y for p in state.graph_points]
-                                state.graph_min = min(raw_values + [state.raw_val])
-                                state.graph_max = max(raw_values + [state.raw_val])
+                                state.graph_min = state.graph_range.min
+                                state.graph_max = state.graph_range.max
                             state.graph_points.append(fc.LineChartDataPoint(len(state.graph_points), state.raw_val))
                             if len(state.graph_points) > state.max_graph_points:
                                 state.graph_points.pop(0)
@@ -199,10 +489,24 @@ def serial_handler(page: ft.Page):
                         state.last_max_value = max_val
                         state.last_event = f"PASS OK (max={max_val})"
                         state.increment_good_counter()
+                        state.add_to_sketch("peak", max_val)
                         state.log_pass(max_val, override=False)
                         page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
                         page.pubsub.send_all_on_topic(TOPIC_COUNTERS, None)
                         page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
+                    elif line.startswith("EVT:PASS_MARGINAL:"):
+                        # Format: EVT:PASS_MARGINAL:maxValue:confidence (sigma x10 to the nearest threshold)
+                        parts = line.split(":")
+                        max_val = int(parts[2]) if len(parts) > 2 else 0
+                        confidence = int(parts[3]) if len(parts) > 3 else None
+                        state.last_max_value = max_val
+                        state.last_event = f"PASS MARGINAL (max={max_val})"
+                        state.increment_good_counter()
+                        state.add_to_sketch("peak", max_val)
+                        state.log_marginal(max_val, confidence)
+                        page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
+                        page.pubsub.send_all_on_topic(TOPIC_COUNTERS, None)
+                        page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
                     elif line.startswith("EVT:PASS_OVERRIDE:"):
                         # Format: EVT:PASS_OVERRIDE:maxValue
                         parts = line.split(":")
@@ -210,10 +514,80 @@ def serial_handler(page: ft.Page):
                         state.last_max_value = max_val
                         state.last_event = f"PASS OVERRIDE (max={max_val})"
                         state.increment_good_counter()
+                        state.add_to_sketch("peak", max_val)
                         state.log_pass(max_val, override=True)
                         page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
                         page.pubsub.send_all_on_topic(TOPIC_COUNTERS, None)
                         page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
+                    elif line.startswith("SYNC:"):
+                        # Events the device buffered while running without this PC
+                        # Format: SYNC:BEGIN,... / SYNC:EVT,ageMs,name,peak / SYNC:END
+                        parts = line.split(":", 1)[1].split(",")
+                        if parts[0] == "BEGIN" and len(parts) >= 5:
+                            state.last_event = f"Synced {int(parts[1]) + int(parts[2])} offline events"
+                            state.sync_stamp = stamp
+                        elif parts[0] == "EVT" and len(parts) >= 4:
+                            when = datetime.now() - timedelta(milliseconds=int(parts[1]))
+                            if state.sync_stamp is not None:
+                                state.write_timeline(line, state.sync_stamp - int(parts[1]))
+                            name = parts[2]
+                            max_val = max(0, int(parts[3]))
+                            if name in ENVELOPE_VERDICTS:
+                                state.add_to_sketch("peak", max_val, when)
+                            if name == "PASS_MARGINAL":
+                                state.increment_good_counter()
+                                state.log_marginal(max_val, when=when)
+                            elif name.startswith("PASS"):
+                                state.increment_good_counter()
+                                state.log_pass(max_val, override=(name == "PASS_OVERRIDE"), when=when)
+                            else:
+                                state.increment_error_counter()
+                                state.log_error(f"{name} (offline)", max_val, when=when)
+                        elif parts[0] == "END":
+                            page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
+                            page.pubsub.send_all_on_topic(TOPIC_COUNTERS, None)
+                            page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
+                    elif line.startswith("E:"):
+                        # Per-envelope record, sent after the verdict
+                        # Format: E:seq,durationMs,peak,samples[,thumbnail]
+                        parts = line[2:].split(",")
+                        if len(parts) >= 2:
+                            state.add_to_sketch("duration_ms", int(parts[1]))
+                        if len(parts) >= 5 and parts[4]:
+                            state.attach_thumbnail(parts[0], parts[4])
+                            page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
+                    elif line.startswith("WARM:"):
+                        state.warm_restart(line)
+                        page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
+                    elif line.startswith("ENV:"):
+                        # Envelope archive replies (GET_ENV:seq / ENV?)
+                        # Format: ENV:LIST,used,capacity,seq... / ENV:seq,BEGIN,points,truncated /
+                        #         ENV:seq,index,v... / ENV:seq,END / ENV:seq,NONE / ENV:seq,LOST
+                        parts = line.split(":", 1)[1].split(",")
+                        if parts[0] == "LIST":
+                            if state.trace_fetch == "LIST" and len(parts) > 3:
+                                # The newest record is the envelope that stopped
+                                ser.write(f"GET_ENV:{parts[-1]}\n".encode())
+                                state.trace_fetch = (parts[-1], [])
+                            elif state.trace_fetch == "LIST":
+                                state.trace_fetch = None
+                        elif isinstance(state.trace_fetch, tuple) and parts[0] == state.trace_fetch[0]:
+                            seq, values = state.trace_fetch
+                            if parts[1] in ("NONE", "LOST"):
+                                state.trace_fetch = None
+                            elif parts[1] == "END":
+                                state.save_trace(seq, values)
+                                state.trace_fetch = None
+                            elif parts[1] != "BEGIN":
+                                values.extend(int(v) for v in parts[2:])
+                    elif line.startswith("ERR:REJECTED"):
+                        # A setting the device refused, not a stop
+                        # Format: ERR:REJECTED[,name,min,max]
+                        parts = line.split(",")
+                        if len(parts) >= 4:
+                            state.last_event = f"{parts[1]} rejected, allowed {parts[2]}..{parts[3]}"
+                        else:
+                            state.last_event = "Setting rejected by device"
                     elif line.startswith("ERR:"):
                         # Format: ERR:ERROR_TYPE:maxValue or ERR:ERROR_TYPE
                         parts = line.split(":")
@@ -224,7 +598,13 @@ def serial_handler(page: ft.Page):
                         state.last_event = state.last_error
                         state.stop_active = True
                         state.increment_error_counter()
+                        if error_type in ENVELOPE_VERDICTS:
+                            state.add_to_sketch("peak", max_val)
                         state.log_error(error_type, max_val)
+                        if error_type in ("EMPTY_ENVELOPE", "DOUBLE_CARD") and \
+                                state.config.get("fetch_stop_traces", True):
+                            ser.write(b"ENV?\n")
+                            state.trace_fetch = "LIST"
                         page.pubsub.send_all_on_topic(TOPIC_EVENT, None)
                         page.pubsub.send_all_on_topic(TOPIC_COUNTERS, None)
                         page.pubsub.send_all_on_topic(TOPIC_ERROR_HISTORY, None)
@@ -232,6 +612,12 @@ def serial_handler(page: ft.Page):
                 if time.time() - last_ping > 1.0:
                     ser.write(b"PING\n")
                     last_ping = time.time()
+                if state.config.get("timeline_file", "") and time.time() - state.time_probe_at > TIME_PROBE_S:
+                    state.time_probe_at = time.time()
+                    state.time_probe = state.time_probe_at * 1000
+                    ser.write(b"TIME?\n")
+                if time.time() - state.sketches_saved > SKETCH_SAVE_S:
+                    state.save_sketches()
 
             except Exception:
                 state.connected = False
@@ -239,7 +625,8 @@ def serial_handler(page: ft.Page):
                     ser.close()
                 page.pubsub.send_all_on_topic(TOPIC_STATUS, None)
 
-        time.sleep(0.05)
+        if not busy:
+            time.sleep(0.05)
 
 
 def send_command(cmd):
@@ -251,6 +638,18 @@ def send_command(cmd):
                 pass
 
 
+REMOTE_STOP_BYTE = b"\x18"
+
+
+def send_stop():
+    # Single byte, acted on by the device even in the middle of another command
+    if state.connected and ser:
+        try:
+            ser.write(REMOTE_STOP_BYTE)
+        except Exception:
+            pass
+
+
 def main(page: ft.Page):
     page.title = "Card Detector HMI"
     page.theme_mode = ft.ThemeMode.DARK
@@ -343,6 +742,19 @@ def main(page: ft.Page):
         ink=True,
     )
 
+    # Stop button (the device answers with ERR:REMOTE_STOP)
+    def on_stop_clicked(_):
+        send_stop()
+
+    btn_stop = ft.Container(
+        content=ft.Text("STOP MACHINE", color=ft.Colors.WHITE, weight=ft.FontWeight.BOLD),
+        bgcolor=ft.Colors.RED_900,
+        padding=ft.Padding.symmetric(horizontal=20, vertical=10),
+        border_radius=5,
+        on_click=on_stop_clicked,
+        ink=True,
+    )
+
     # Override warning label (shown on main screen when override active)
     lbl_override_warning = ft.Container(
         content=ft.Row([
@@ -496,9 +908,12 @@ def main(page: ft.Page):
                     timestamp, log_msg = entry
                     log_type = "error"
 
-                is_error = log_type == "error"
-                color = ft.Colors.RED_300 if is_error else ft.Colors.GREEN_300
-                bg_color = ft.Colors.RED if is_error else ft.Colors.GREEN
+                if log_type == "error":
+                    color, bg_color = ft.Colors.RED_300, ft.Colors.RED
+                elif log_type == "warning":
+                    color, bg_color = ft.Colors.AMBER_300, ft.Colors.AMBER
+                else:
+                    color, bg_color = ft.Colors.GREEN_300, ft.Colors.GREEN
 
                 error_list.controls.append(
                     ft.Container(
@@ -536,7 +951,7 @@ def main(page: ft.Page):
                     content=ft.Column([
                         ft.Text("STATUS", size=12, color=ft.Colors.GREY_400),
                         lbl_event,
-                        btn_resume
+                        ft.Row([btn_stop, btn_resume])
                     ], horizontal_alignment=ft.CrossAxisAlignment.END),
                 )
             ]),
@@ -696,10 +1111,12 @@ def main(page: ft.Page):
         ),
     )
 
-    # Keyboard shortcut: Space bar to resume
+    # Keyboard shortcuts: Space bar to resume, Escape to stop
     def on_keyboard(e: ft.KeyboardEvent):
         if e.key == " ":
             on_resume_clicked(None)
+        elif e.key == "Escape":
+            on_stop_clicked(None)
 
     page.on_keyboard_event = on_keyboard
 
@@ -711,7 +1128,10 @@ def main(page: ft.Page):
     # PubSub callbacks with topic subscriptions
     def on_status_update(topic, message):
         status_icon.color = ft.Colors.GREEN if state.connected else ft.Colors.RED
-        status_text.value = "Connected" if state.connected else "Disconnected"
+        if state.connected:
+            status_text.value = "Connected"
+        else:
+            status_text.value = f"Disconnected: {state.link_error}" if state.link_error else "Disconnected"
         status_text.color = ft.Colors.GREEN if state.connected else ft.Colors.RED
         status_icon.update()
         status_text.update()
@@ -771,7 +1191,12 @@ def main(page: ft.Page):
     page.pubsub.subscribe_topic(TOPIC_COUNTERS, on_counters_update)
 
     refresh_ports()
+    if state.config_warning:
+        snack_bar.content = ft.Text(f"config.json: {state.config_warning}")
+        snack_bar.open = True
+        page.update()
     threading.Thread(target=serial_handler, args=(page,), daemon=True).start()
 
 
 ft.run(main)
+state.save_sketches()  # Envelopes since the last periodic save
@@ -0,0 +1,171 @@
+"""Replay one long trace through the host detector model on several cores.
+
+The detector carries state from sample to sample (filter, debounce, noise
+floor, fault latch), so a trace cannot simply be cut into pieces. It is
+cut in idle gaps (envelope input off for --min-gap samples), one segment
+per job. Each job warm-starts its segment with a pre-roll: a fresh
+Detector runs over the --preroll samples before the cut and its lines
+are discarded. Jobs return the snapshot they started from and the one
+they ended with. Merging walks the segments in order; a segment whose
+start snapshot differs from the end snapshot of the one before (the
+pre-roll did not settle, or a stop was latched) is replayed again from
+that exact snapshot. The merged lines are therefore the same as a serial
+replay, which --verify checks.
+
+Trace and verdict files are the trace_replay.py formats, so --record
+output can be compared with a device replay of the same trace.
+
+Usage:
+    python parallel_replay.py trace.csv --jobs 8 --record verdicts.txt
+    python parallel_replay.py trace.csv --config PEAK_MODE=1 BLANK_TRAIL=8 --verify
+"""
+import argparse
+import multiprocessing
+import sys
+import time
+
+from detector_model import STATE_MEASURING, Detector
+from trace_replay import compare, load_trace, load_verdicts
+
+
+def settled(samples, i, min_gap):
+    """First index from i on that follows min_gap idle samples, len(samples) if none"""
+    idle = 0
+    while i < len(samples) and idle < min_gap:
+        idle = 0 if samples[i][1] else idle + 1
+        i += 1
+    return i if idle == min_gap else len(samples)
+
+
+def find_cuts(samples, segments, min_gap):
+    """Cut indices near equal shares of the trace, each after min_gap idle samples"""
+    cuts = []
+    for k in range(1, segments):
+        i = settled(samples, max(len(samples) * k // segments, cuts[-1] + 1 if cuts else 0), min_gap)
+        if i < len(samples):
+            cuts.append(i)
+    return cuts
+
+
+def preroll_start(samples, cut, preroll, min_gap):
+    """Pre-roll start: preroll samples before the cut, moved to settled idle.
+
+    A fresh detector seeds its noise floor from the first idle sample; one
+    taken from the tail of an envelope takes thousands of samples to decay.
+    """
+    start = settled(samples, max(0, cut - preroll), min_gap)
+    return start if start < cut else max(0, cut - preroll)
+
+
+def replay_segment(task):
+    """Worker: (config, sample_ms, auto_resume, preroll, samples, clock, snapshot)
+
+    Without a snapshot the detector is warmed up on the pre-roll samples
+    first. Returns (start snapshot, lines, end snapshot); snapshots are
+    None at the start of the trace and inside an envelope at its end.
+    """
+    config, sample_ms, auto_resume, preroll, samples, clock, snapshot = task
+    detector = Detector(config, sample_ms, auto_resume)
+    if snapshot is not None:
+        detector.restore(snapshot, clock)
+    elif clock > 0:
+        detector.clock = clock - len(preroll) * sample_ms
+        detector.run(preroll)
+    start = detector.snapshot() if clock > 0 else None
+    lines = detector.run(samples)
+    end = detector.snapshot() if detector.state != STATE_MEASURING else None
+    return start, lines, end
+
+
+def parallel_replay(samples, config=None, sample_ms=1, auto_resume=True, jobs=None,
+                    min_gap=50, preroll=2000):
+    """Return (lines, segments, segments replayed again)"""
+    jobs = jobs or multiprocessing.cpu_count()
+    cuts = find_cuts(samples, jobs, min_gap)
+    bounds = list(zip([0] + cuts, cuts + [len(samples)]))
+    tasks = [(config, sample_ms, auto_resume, samples[preroll_start(samples, a, preroll, min_gap):a],
+              samples[a:b], a * sample_ms, None) for a, b in bounds]
+    with multiprocessing.Pool(min(jobs, len(tasks))) as pool:
+        results = pool.map(replay_segment, tasks)
+
+    lines = list(results[0][1])
+    end = results[0][2]
+    replayed = 0
+    for task, (start, segment_lines, segment_end) in zip(tasks[1:], results[1:]):
+        if start != end:
+            replayed += 1
+            _, segment_lines, segment_end = replay_segment(task[:6] + (end,))
+        lines.extend(segment_lines)
+        end = segment_end
+    return lines, len(tasks), replayed
+
+
+def parse_config(items):
+    config = {}
+    for item in items:
+        name, value = item.split("=", 1)
+        config[name.lower()] = float(value) if "." in value else int(value)
+    return config
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay a trace through the detector model in parallel")
+    parser.add_argument("trace", help="Trace file with adc,envelope lines")
+    parser.add_argument("--config", nargs="*", default=[],
+                        help="Detector parameters as registry NAME=VALUE, e.g. PEAK_MODE=1")
+    parser.add_argument("--sample-ms", type=int, default=1, help="Trace sample period in ms")
+    parser.add_argument("--no-auto-resume", action="store_true",
+                        help="Stop at the first fault like the real machine")
+    parser.add_argument("--jobs", type=int, default=None, help="Segments / processes (default: all cores)")
+    parser.add_argument("--min-gap", type=int, default=50,
+                        help="Idle samples before a cut, must exceed the debounce delay")
+    parser.add_argument("--preroll", type=int, default=2000, help="Warm-up samples before each cut")
+    parser.add_argument("--expect", help="Expected verdict file to compare against")
+    parser.add_argument("--record", help="Write the verdicts to this file")
+    parser.add_argument("--verify", action="store_true", help="Also replay serially and compare")
+    args = parser.parse_args()
+
+    config = parse_config(args.config)
+    debounce = config.get("debounce_ms", Detector.DEFAULTS["debounce_ms"])
+    if args.min_gap * args.sample_ms <= debounce + args.sample_ms:
+        print(f"--min-gap must cover more than the debounce delay ({debounce} ms)")
+        return 2
+    samples = load_trace(args.trace)
+    if not samples:
+        print("Trace is empty")
+        return 2
+
+    start = time.time()
+    lines, segments, replayed = parallel_replay(samples, config, args.sample_ms, not args.no_auto_resume,
+                                                args.jobs, args.min_gap, args.preroll)
+    elapsed = time.time() - start
+    print(f"Replayed {len(samples)} samples in {segments} segments in {elapsed:.2f}s, "
+          f"{replayed} segments replayed again, {len(lines)} verdicts")
+    status = 0
+
+    if args.verify:
+        start = time.time()
+        serial_lines = Detector(config, args.sample_ms, not args.no_auto_resume).run(samples)
+        print(f"Serial replay {time.time() - start:.2f}s: "
+              f"{'identical' if serial_lines == lines else 'DIFFERENT'}")
+        if serial_lines != lines:
+            status = 1
+
+    if args.record:
+        with open(args.record, 'w') as f:
+            f.write("\n".join(lines) + "\n")
+
+    if args.expect:
+        problems = compare(load_verdicts(args.expect), lines)
+        if problems:
+            print(f"{len(problems)} verdict mismatches:")
+            for p in problems:
+                print("  " + p)
+            status = 1
+        else:
+            print("All verdicts match")
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
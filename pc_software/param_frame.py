@@ -0,0 +1,49 @@
+"""Binary parameter frames for the firmware's parameter registry.
+
+A frame is [PARAM_FRAME_SYNC][op][id][value, 4 bytes LE]. The value is a
+signed 32-bit integer, or the IEEE bits of a float for float parameters.
+The device answers with the same PRM: line as GET:/SET:.
+
+0x18 on the wire always stops the machine (remote stop), so after the
+sync byte the stop byte and the escape byte itself are sent as
+[PARAM_FRAME_ESC][byte ^ PARAM_FRAME_ESC_XOR]. Every id and value can be
+sent that way.
+
+Usage:
+    from param_frame import encode_get, encode_set
+    ser.write(encode_set(24, 300))
+"""
+import struct
+
+PARAM_FRAME_SYNC = 0x02
+PARAM_FRAME_ESC = 0x1B
+PARAM_FRAME_ESC_XOR = 0x20
+PARAM_OP_GET = 0x01
+PARAM_OP_SET = 0x02
+REMOTE_STOP_BYTE = 0x18  # Must match the firmware
+
+
+def escape(payload):
+    out = bytearray()
+    for b in payload:
+        if b in (REMOTE_STOP_BYTE, PARAM_FRAME_ESC):
+            out += bytes((PARAM_FRAME_ESC, b ^ PARAM_FRAME_ESC_XOR))
+        else:
+            out.append(b)
+    return bytes(out)
+
+
+def encode_frame(op, param_id, value=0, is_float=False):
+    if is_float:
+        raw = struct.pack('<f', value)
+    else:
+        raw = struct.pack('<i', int(value))
+    return bytes((PARAM_FRAME_SYNC,)) + escape(bytes((op, param_id)) + raw)
+
+
+def encode_get(param_id):
+    return encode_frame(PARAM_OP_GET, param_id)
+
+
+def encode_set(param_id, value, is_float=False):
+    return encode_frame(PARAM_OP_SET, param_id, value, is_float)
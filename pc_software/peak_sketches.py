@@ -0,0 +1,176 @@
+"""Long-term distributions of envelope peaks and durations.
+
+The HMI adds every envelope verdict's peak (EVT:/ERR:/SYNC:EVT), every
+E: record's duration and the idle telemetry values (baseline) to a
+QuantileSketch keyed by device, recipe and hour, and saves them to peak_sketches.json next to config.json. An hour holds a
+few kB whatever the number of envelopes, and any rollup - a shift, a
+week, all devices running one recipe - is the merge of its hours, so it
+is answered from the file without the logs. A save encodes only the
+hours that changed since the last one; the HMI prunes hours older than
+its sketch_keep_days, so the file stops growing.
+
+Usage:
+    python peak_sketches.py --by day
+    python peak_sketches.py --recipe thin_card --since 2026-10-01 --by shift --shifts 6,14,22
+    python peak_sketches.py --store line1/peak_sketches.json line2/peak_sketches.json --by device
+"""
+import argparse
+import json
+import os
+import sys
+import time
+from datetime import datetime, timedelta
+
+from streaming_stats import QuantileSketch
+
+SKETCH_FILE = "peak_sketches.json"
+METRICS = ("peak", "duration_ms", "baseline")
+ACCURACY = 0.01
+
+
+def hour_key(when):
+    return when.strftime("%Y-%m-%dT%H")
+
+
+class SketchStore:
+    """{(device, recipe, hour): {metric: QuantileSketch}} persisted as JSON"""
+
+    def __init__(self, path=SKETCH_FILE, accuracy=ACCURACY, load=True):
+        self.path = path
+        self.accuracy = accuracy
+        self.sketches = {}
+        self.encoded = {}  # key -> JSON of its entry as last saved, dropped when the key changes
+        self.dirty = False
+        if load and os.path.exists(path):
+            with open(path, 'r') as f:
+                data = json.load(f)
+            self.accuracy = data["accuracy"]
+            for entry in data["sketches"]:
+                key = (entry["device"], entry["recipe"], entry["hour"])
+                self.sketches[key] = {m: QuantileSketch.from_dict(s) for m, s in entry["metrics"].items()}
+                self.encoded[key] = json.dumps(entry, separators=(",", ":"))
+
+    def add(self, device, recipe, when, metric, value):
+        metrics = self.sketches.setdefault((device, recipe, hour_key(when)), {})
+        if metric not in metrics:
+            metrics[metric] = QuantileSketch(self.accuracy)
+        metrics[metric].add(value)
+        self.encoded.pop((device, recipe, hour_key(when)), None)
+        self.dirty = True
+
+    def prune(self, before):
+        """Drop the hours before an hour key; returns how many were dropped"""
+        old = [key for key in self.sketches if key[2] < before]
+        for key in old:
+            del self.sketches[key]
+            self.encoded.pop(key, None)
+        self.dirty = self.dirty or bool(old)
+        return len(old)
+
+    def _encode(self, key):
+        if key not in self.encoded:
+            d, r, h = key
+            entry = {"device": d, "recipe": r, "hour": h,
+                     "metrics": {m: s.to_dict() for m, s in self.sketches[key].items()}}
+            self.encoded[key] = json.dumps(entry, separators=(",", ":"))
+        return self.encoded[key]
+
+    def save(self):
+        """Write the file if anything was added; a crash leaves the old file whole"""
+        if not self.dirty:
+            return
+        entries = ",".join(self._encode(key) for key in sorted(self.sketches))
+        with open(self.path + ".tmp", 'w') as f:
+            f.write(f'{{"accuracy":{json.dumps(self.accuracy)},"sketches":[{entries}]}}')
+        os.replace(self.path + ".tmp", self.path)
+        self.dirty = False
+
+    def select(self, device=None, recipe=None, since=None, until=None):
+        """Keys matching the filters; since/until are hour prefixes, until excluded"""
+        return [key for key in self.sketches
+                if (device is None or key[0] == device) and (recipe is None or key[1] == recipe)
+                and (since is None or key[2] >= since) and (until is None or key[2] < until)]
+
+    def rollup(self, keys, group):
+        """Merge the sketches of keys by group(key) -> {label: {metric: sketch}}"""
+        groups = {}
+        for key in keys:
+            merged = groups.setdefault(group(key), {})
+            for metric, sketch in self.sketches[key].items():
+                merged.setdefault(metric, QuantileSketch(self.accuracy)).merge(sketch)
+        return groups
+
+    def absorb(self, other):
+        """Merge another store in, e.g. the file of another machine's HMI"""
+        for key, metrics in other.sketches.items():
+            mine = self.sketches.setdefault(key, {})
+            self.encoded.pop(key, None)
+            for metric, sketch in metrics.items():
+                mine.setdefault(metric, QuantileSketch(self.accuracy)).merge(sketch)
+
+
+def shift_of(hour, starts):
+    """'YYYY-MM-DD S<start>' of the shift holding an hour key; hours before the
+    first start belong to the previous day's last shift"""
+    when = datetime.strptime(hour, "%Y-%m-%dT%H")
+    begun = [s for s in starts if s <= when.hour]
+    if begun:
+        return f"{when:%Y-%m-%d} S{begun[-1]:02d}"
+    return f"{when - timedelta(days=1):%Y-%m-%d} S{starts[-1]:02d}"
+
+
+def grouping(by, starts):
+    return {
+        "all": lambda key: "all",
+        "device": lambda key: key[0],
+        "recipe": lambda key: key[1],
+        "hour": lambda key: key[2],
+        "day": lambda key: key[2][:10],
+        "shift": lambda key: shift_of(key[2], starts),
+    }[by]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Peak and duration percentiles from the HMI's sketches")
+    parser.add_argument("--store", nargs="+", default=[SKETCH_FILE],
+                        help="Sketch files written by the HMIs, merged")
+    parser.add_argument("--device", help="Only this device")
+    parser.add_argument("--recipe", help="Only this recipe")
+    parser.add_argument("--since", help="First hour, e.g. 2026-10-01 or 2026-10-01T06")
+    parser.add_argument("--until", help="End hour (excluded)")
+    parser.add_argument("--by", choices=["all", "device", "recipe", "hour", "day", "shift"], default="all")
+    parser.add_argument("--shifts", default="6,14,22", help="Shift start hours for --by shift")
+    parser.add_argument("--percentiles", type=float, nargs="+", default=[1, 50, 99])
+    args = parser.parse_args()
+
+    missing = [path for path in args.store if not os.path.exists(path)]
+    if missing:
+        print(f"No sketch file {missing[0]}")
+        return 2
+    store = SketchStore(args.store[0])
+    for path in args.store[1:]:
+        store.absorb(SketchStore(path))
+    starts = sorted(int(h) for h in args.shifts.split(","))
+    keys = store.select(args.device, args.recipe, args.since, args.until)
+    start = time.perf_counter()
+    groups = store.rollup(keys, grouping(args.by, starts))
+    elapsed = time.perf_counter() - start
+    print(f"{len(keys)} device-hours merged into {len(groups)} groups in {elapsed * 1e6:.0f}us "
+          f"(+-{store.accuracy:.0%} of value)")
+
+    width = max([len(label) for label in groups] + [len(m) for m in METRICS]) + 2
+    for metric in METRICS:
+        if not any(metric in merged for merged in groups.values()):
+            continue
+        print(f"\n{metric:<{width}}{'count':>9}" + "".join(f"{'p' + format(p, 'g'):>8}" for p in args.percentiles))
+        for label, merged in sorted(groups.items()):
+            sketch = merged.get(metric)
+            if sketch is None or sketch.count == 0:
+                continue
+            print(f"{label:<{width}}{sketch.count:>9}" +
+                  "".join(f"{sketch.quantile(p):>8.0f}" for p in args.percentiles))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
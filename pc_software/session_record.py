@@ -0,0 +1,338 @@
+"""Record a whole HMI serial session and play it back.
+
+With "session_dir" set (default "", off), the HMI writes every byte it
+reads from and writes to the device into one file per connection, with
+the time since the port was opened to the microsecond. A file that
+reaches "session_max_mb" is closed and the connection goes on in a new
+one (header "part": 2, 3, ..., times from when that part was opened);
+only the newest "session_keep" files are kept, parts included. An HMI restart or
+a field problem ("it stopped with no error shown") can then be looked at
+byte for byte, and replayed:
+
+  - the device side into the HMI: python main.py --replay FILE [--speed N]
+    shows the session in the GUI again, with the config it ran with
+  - the PC side into a device: play sends what the HMI sent, at the
+    recorded times, to a board, a PTY of a host build or
+    arduino_simulator.py, and diffs the device's replies against the
+    recording. Telemetry is left out, and so are verdicts (EVT:, the
+    sensor ERR: lines, SYNC: and ENV:): they follow what the sensor saw,
+    not what the PC sent. --verdicts keeps them, for a device that gets
+    the recorded sensor signal again.
+
+File: MAGIC, one JSON line (start time, port, baud, config), then records
+of [kind:1][microseconds since the previous record: varint][length:
+varint][bytes]. A line of telemetry costs 4 bytes on top of its text.
+
+Usage:
+    python session_record.py show sessions/session_20261018_141503.cds
+    python session_record.py play sessions/session_20261018_141503.cds COM6 --speed 2
+"""
+import argparse
+import difflib
+import json
+import os
+import sys
+import threading
+import time
+from datetime import datetime
+
+MAGIC = b"CDSESSION1\n"
+KIND_RX = 0    # Device -> PC
+KIND_TX = 1    # PC -> device
+KIND_BAUD = 2  # PC changed the link rate, payload is the rate as text
+KIND_NAMES = {KIND_RX: "RX", KIND_TX: "TX", KIND_BAUD: "BAUD"}
+FLUSH_S = 0.5
+TELEMETRY_PREFIXES = ("D:", "T:", "R:", "A:", "H:", "E:", "TIME:")  # Left out of the play diff
+# Also left out unless play --verdicts; ERR:REMOTE_STOP/WATCHDOG_TIMEOUT follow the PC side and stay in
+VERDICT_PREFIXES = ("EVT:", "ERR:SENSOR_OUT_OF_RANGE", "ERR:EMPTY_ENVELOPE", "ERR:DOUBLE_CARD",
+                    "SYNC:", "ENV:")
+
+
+def write_varint(f, value):
+    while value >= 0x80:
+        f.write(bytes((value & 0x7F | 0x80,)))
+        value >>= 7
+    f.write(bytes((value,)))
+
+
+def read_varint(f):
+    value = 0
+    shift = 0
+    while True:
+        b = f.read(1)
+        if not b:
+            raise EOFError
+        value |= (b[0] & 0x7F) << shift
+        if b[0] < 0x80:
+            return value
+        shift += 7
+
+
+def new_path(directory, keep, suffix=""):
+    """Name for a new session file in directory, after removing all but
+    the newest keep - 1 there"""
+    os.makedirs(directory, exist_ok=True)
+    old = sorted(n for n in os.listdir(directory) if n.startswith("session_") and n.endswith(".cds"))
+    for name in old[:max(0, len(old) - keep + 1)]:
+        try:
+            os.remove(os.path.join(directory, name))
+        except OSError:
+            pass
+    return os.path.join(directory, f"session_{datetime.now():%Y%m%d_%H%M%S}{suffix}.cds")
+
+
+class SessionRecorder:
+    """Appends records to a session file; safe to call from several threads"""
+
+    def __init__(self, path, header, directory=None, keep=0, max_bytes=0):
+        self.lock = threading.Lock()
+        self.header = header
+        self.directory = directory  # Where the next part goes, None = never rotate
+        self.keep = keep
+        self.max_bytes = max_bytes
+        self.part = 1
+        self._open(path)
+
+    def _open(self, path):
+        self.file = open(path, 'wb')
+        self.file.write(MAGIC)
+        self.file.write(json.dumps(self.header).encode() + b"\n")
+        self.file.flush()
+        self.last_ns = time.perf_counter_ns()
+        self.flushed = time.time()
+
+    @classmethod
+    def create(cls, directory, keep, header, max_bytes=0):
+        """New file in directory; only the newest keep sessions are kept.
+        With max_bytes, the session continues in a new file at that size."""
+        header = dict(header, start=time.time())
+        return cls(new_path(directory, keep), header, directory, keep, max_bytes)
+
+    def _rotate(self):
+        self.file.close()
+        self.part += 1
+        self.header = dict(self.header, start=time.time(), part=self.part)
+        self._open(new_path(self.directory, self.keep, f"_{self.part}"))
+
+    def record(self, kind, data):
+        with self.lock:
+            if self.file.closed:
+                return
+            if self.directory and self.max_bytes and self.file.tell() >= self.max_bytes:
+                self._rotate()
+            now = time.perf_counter_ns()
+            delta_us = (now - self.last_ns) // 1000
+            self.last_ns += delta_us * 1000  # No rounding drift
+            self.file.write(bytes((kind,)))
+            write_varint(self.file, delta_us)
+            write_varint(self.file, len(data))
+            self.file.write(data)
+            if time.time() - self.flushed > FLUSH_S:
+                self.file.flush()
+                self.flushed = time.time()
+
+    def close(self):
+        with self.lock:
+            self.file.close()
+
+
+class RecordingSerial:
+    """A serial.Serial that records what is read and written through it"""
+
+    def __init__(self, port, recorder):
+        object.__setattr__(self, "port", port)
+        object.__setattr__(self, "recorder", recorder)
+
+    def read(self, size=1):
+        data = self.port.read(size)
+        if data:
+            self.recorder.record(KIND_RX, data)
+        return data
+
+    def readline(self):
+        data = self.port.readline()
+        if data:
+            self.recorder.record(KIND_RX, data)
+        return data
+
+    def write(self, data):
+        self.recorder.record(KIND_TX, bytes(data))
+        return self.port.write(data)
+
+    def close(self):
+        self.port.close()
+        self.recorder.close()
+
+    def __getattr__(self, name):
+        return getattr(self.port, name)
+
+    def __setattr__(self, name, value):
+        if name == "baudrate":
+            self.recorder.record(KIND_BAUD, str(value).encode())
+        setattr(self.port, name, value)
+
+
+def load_session(path):
+    """(header, [(seconds since open, kind, bytes)])"""
+    records = []
+    with open(path, 'rb') as f:
+        if f.read(len(MAGIC)) != MAGIC:
+            raise ValueError(f"{path} is not a session file")
+        header = json.loads(f.readline())
+        t_us = 0
+        while True:
+            kind = f.read(1)
+            if not kind:
+                break
+            try:
+                t_us += read_varint(f)
+                data = f.read(read_varint(f))
+            except EOFError:
+                break  # Cut short by a crash: keep what is complete
+            records.append((t_us / 1e6, kind[0], data))
+    return header, records
+
+
+class ReplaySerial:
+    """Stands in for serial.Serial, serving the recorded device output.
+
+    Bytes become readable at their recorded time divided by speed
+    (speed 0 = at once). Writes are dropped; reset_input_buffer() keeps
+    the bytes, since the recording holds only what the HMI did read.
+    """
+
+    def __init__(self, path, speed=1.0, timeout=1):
+        self.header, records = load_session(path)
+        self.rx = [(t, data) for t, kind, data in records if kind == KIND_RX]
+        self.speed = speed
+        self.timeout = timeout
+        self.baudrate = self.header.get("baud", 115200)
+        self.dtr = True
+        self.is_open = True
+        self.buffer = b""
+        self.next = 0
+        self.start = time.time()
+
+    def _fill(self, enough):
+        """Move due records into the buffer until enough(buffer)"""
+        now = float("inf") if self.speed == 0 else (time.time() - self.start) * self.speed
+        while not enough(self.buffer) and self.next < len(self.rx) and self.rx[self.next][0] <= now:
+            self.buffer += self.rx[self.next][1]
+            self.next += 1
+        return enough(self.buffer) or self.next == len(self.rx)
+
+    @property
+    def finished(self):
+        return self.next == len(self.rx) and not self.buffer
+
+    @property
+    def in_waiting(self):
+        self._fill(len)
+        return len(self.buffer)
+
+    def read(self, size=1):
+        deadline = time.time() + (self.timeout or 0)
+        while not self._fill(lambda b: len(b) >= size) and time.time() < deadline:
+            time.sleep(0.005)
+        data, self.buffer = self.buffer[:size], self.buffer[size:]
+        return data
+
+    def readline(self):
+        deadline = time.time() + (self.timeout or 0)
+        while not self._fill(lambda b: b"\n" in b) and time.time() < deadline:
+            time.sleep(0.005)
+        end = self.buffer.find(b"\n") + 1 or len(self.buffer)
+        data, self.buffer = self.buffer[:end], self.buffer[end:]
+        return data
+
+    def write(self, data):
+        return len(data)
+
+    def reset_input_buffer(self):
+        pass
+
+    def reset_output_buffer(self):
+        pass
+
+    def flush(self):
+        pass
+
+    def close(self):
+        self.is_open = False
+
+
+def show(path, kinds):
+    header, records = load_session(path)
+    print(f"# {header.get('port')} at {header.get('baud')} baud, opened "
+          f"{datetime.fromtimestamp(header['start']):%Y-%m-%d %H:%M:%S}, {len(records)} records")
+    for t, kind, data in records:
+        if kind in kinds:
+            text = data.decode('latin-1').encode('unicode_escape').decode()
+            print(f"{t:12.6f} {KIND_NAMES.get(kind, kind):<4} {text}")
+
+
+def replies(lines, verdicts=False):
+    skip = TELEMETRY_PREFIXES if verdicts else TELEMETRY_PREFIXES + VERDICT_PREFIXES
+    return [line for line in lines if line and not line.startswith(skip)]
+
+
+def play(path, port, speed, settle, verdicts=False):
+    """Send the PC side to a device at the recorded times, diff its replies"""
+    import serial
+    from trace_replay import LineReader
+
+    header, records = load_session(path)
+    ser = serial.Serial(port, header.get("baud", 115200), timeout=0.1)
+    reader = LineReader(ser)
+    start = time.time()
+    try:
+        for t, kind, data in records:
+            if kind == KIND_RX:
+                continue
+            if speed > 0:
+                time.sleep(max(0.0, start + t / speed - time.time()))
+            if kind == KIND_TX:
+                ser.write(data)
+            elif kind == KIND_BAUD:
+                ser.flush()
+                ser.baudrate = int(data)
+        time.sleep(settle)
+    finally:
+        reader.stop()
+        ser.close()
+
+    recorded = b"".join(d for _, k, d in records if k == KIND_RX).decode('utf-8', errors='ignore')
+    expected = replies((line.strip() for line in recorded.splitlines()), verdicts)
+    got = replies(reader.lines, verdicts)
+    print(f"Sent {sum(1 for r in records if r[1] == KIND_TX)} writes in {time.time() - start:.1f}s; "
+          f"{len(got)} replies, {len(expected)} recorded")
+    diff = list(difflib.unified_diff(expected, got, "recorded", "replayed", n=1, lineterm=""))
+    for line in diff:
+        print(line)
+    return 1 if diff else 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Inspect or replay a recorded HMI session")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p_show = sub.add_parser("show", help="Print the records")
+    p_show.add_argument("session")
+    p_show.add_argument("--side", choices=["rx", "tx", "both"], default="both")
+    p_play = sub.add_parser("play", help="Send the PC side to a device or PTY and diff its replies")
+    p_play.add_argument("session")
+    p_play.add_argument("port")
+    p_play.add_argument("--speed", type=float, default=1.0, help="Time factor, 0 = as fast as possible")
+    p_play.add_argument("--settle", type=float, default=1.0, help="Seconds to collect output after the end")
+    p_play.add_argument("--verdicts", action="store_true",
+                        help="Diff EVT:/ERR: verdicts too, when the device sees the recorded sensor signal")
+    args = parser.parse_args()
+
+    if args.command == "show":
+        kinds = {"rx": {KIND_RX}, "tx": {KIND_TX, KIND_BAUD}, "both": set(KIND_NAMES)}[args.side]
+        show(args.session, kinds)
+        return 0
+    return play(args.session, args.port, args.speed, args.settle, args.verdicts)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,112 @@
+"""Measure what the shadow detector costs per sample on the device.
+
+Replays the same synthetic trace through the detector (INJECT) with the
+shadow detector off and then on in each peak mode, and reads the
+per-sample detector time back with STATS. Needs a DIAGNOSTIC build.
+
+The budget is the live loop period measured at rest before the replays:
+the shadow must fit in it without lowering the sample rate noticeably.
+
+Usage:
+    python shadow_bench.py COM6 --envelopes 200 --blank-trail 10
+"""
+import argparse
+import random
+import sys
+import time
+
+import serial
+
+from detector_model import PEAK_MAX, PEAK_MODE_NAMES, synth_envelope
+from link_baud import negotiate_baud
+from trace_replay import LineReader, open_device, replay
+
+
+def read_stats(ser):
+    """Send STATS and return (avg loop us, avg detect us, max detect us)"""
+    reader = LineReader(ser)
+    try:
+        ser.write(b"STATS\n")
+        line = reader.wait_for("STAT:", 1.0)
+    finally:
+        reader.stop()
+        time.sleep(0.2)  # Let the reader thread finish its last readline
+    if line is None:
+        raise RuntimeError("no STAT: reply (not a DIAGNOSTIC build?)")
+    # STAT:Profile,Loops,AvgLoopUs,MaxLoopUs,LastStopUs,MaxStopUs,
+    #      LastRemoteStopUs,MaxRemoteStopUs,AvgDetectUs,MaxDetectUs
+    fields = line.split(":")[1].split(",")
+    if len(fields) < 10:
+        raise RuntimeError(f"firmware has no detector statistics: {line}")
+    return float(fields[2]), float(fields[8]), int(fields[9])
+
+
+def build_trace(envelopes, seed):
+    """Envelopes of mixed levels, half of the samples inside an envelope"""
+    rng = random.Random(seed)
+    samples = []
+    for _ in range(envelopes):
+        raw, inside = synth_envelope(rng, level=rng.choice([140, 400, 780]), samples=60)
+        samples.extend(zip(raw, inside))
+    return samples
+
+
+def set_params(ser, params):
+    for name, value in params.items():
+        ser.write(f"SET:{name}={value}\n".encode())
+    ser.flush()
+    time.sleep(0.1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the shadow detector")
+    parser.add_argument("port", help="Serial port of the device")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--link-baud", type=int, default=1000000)
+    parser.add_argument("--envelopes", type=int, default=200)
+    parser.add_argument("--blank-trail", type=int, default=0,
+                        help="Trailing blanking during the runs (exercises the delay line)")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--no-reset", action="store_true",
+                        help="Do not toggle DTR on open (simulator / virtual port)")
+    args = parser.parse_args()
+
+    samples = build_trace(args.envelopes, args.seed)
+    if args.no_reset:
+        ser = serial.Serial(args.port, args.baud, timeout=0.1)
+    else:
+        ser = open_device(args.port, args.baud)
+    results = []
+    try:
+        negotiate_baud(ser, args.link_baud)
+        set_params(ser, {"SHADOW": 0, "BLANK_TRAIL": args.blank_trail})
+        read_stats(ser)
+        time.sleep(1.0)
+        loop_us, _, _ = read_stats(ser)
+
+        runs = [("off", {"SHADOW": 0})]
+        for mode, name in PEAK_MODE_NAMES.items():
+            runs.append((f"on, {name}", {"SHADOW": 1, "SHADOW_PEAK_MODE": mode,
+                                         "SHADOW_ALPHA": 0.3, "SHADOW_THR": 180}))
+        for label, params in runs:
+            set_params(ser, params)
+            read_stats(ser)
+            replay(ser, samples, 1, True, 10.0)
+            time.sleep(0.2)  # Replay's reader thread is still draining
+            _, avg_us, max_us = read_stats(ser)
+            results.append((label, avg_us, max_us))
+        set_params(ser, {"SHADOW": 0, "SHADOW_PEAK_MODE": PEAK_MAX})
+    finally:
+        ser.close()
+
+    base = results[0][1]
+    print(f"{len(samples)} samples, live loop period {loop_us:.0f} us")
+    print(f"{'shadow':<16}{'avg us':>8}{'max us':>8}{'extra us':>10}{'of loop':>9}")
+    for label, avg_us, max_us in results:
+        extra = avg_us - base
+        print(f"{label:<16}{avg_us:>8.1f}{max_us:>8}{extra:>10.1f}{100 * extra / loop_us:>8.1f}%")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
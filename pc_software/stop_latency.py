@@ -0,0 +1,81 @@
+"""Measure how fast the device acts on the remote STOP byte.
+
+Sends the stop byte (0x18) repeatedly with a RESUME in between and times
+the round trip to the ERR:REMOTE_STOP line. The round trip includes the
+USB-serial bridge latency in both directions; the on-device part
+(byte seen -> PIN_ENABLE_OUT low) is read back with STATS, which every
+build profile answers.
+
+Usage:
+    python stop_latency.py COM6 --count 50
+"""
+import argparse
+import statistics
+import sys
+import time
+
+import serial
+
+from trace_replay import LineReader, open_device
+
+REMOTE_STOP_BYTE = b"\x18"
+
+
+def measure(ser, count, interval):
+    """Return the list of round-trip times in ms (None = no answer)"""
+    reader = LineReader(ser)
+    results = []
+    try:
+        for _ in range(count):
+            ser.write(b"PING\nRESUME\n")
+            time.sleep(interval)
+            with reader.cond:
+                reader.lines.clear()
+            start = time.perf_counter()
+            ser.write(REMOTE_STOP_BYTE)
+            ser.flush()
+            line = reader.wait_for("ERR:REMOTE_STOP", 1.0)
+            results.append((time.perf_counter() - start) * 1000 if line else None)
+
+        ser.write(b"STATS\n")
+        stat = reader.wait_for("STAT:", 0.5)
+        ser.write(b"RESUME\n")
+        return results, stat
+    finally:
+        reader.stop()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure remote STOP latency")
+    parser.add_argument("port", help="Serial port of the device (or simulator)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--count", type=int, default=20)
+    parser.add_argument("--interval", type=float, default=0.1, help="Seconds between RESUME and STOP")
+    parser.add_argument("--no-reset", action="store_true",
+                        help="Do not toggle DTR on open (simulator / virtual port)")
+    args = parser.parse_args()
+
+    if args.no_reset:
+        ser = serial.Serial(args.port, args.baud, timeout=0.1)
+    else:
+        ser = open_device(args.port, args.baud)
+    try:
+        results, stat = measure(ser, args.count, args.interval)
+    finally:
+        ser.close()
+
+    answered = [r for r in results if r is not None]
+    print(f"{len(answered)}/{len(results)} stops acknowledged")
+    if answered:
+        print(f"Round trip ms: min {min(answered):.2f}  median {statistics.median(answered):.2f}  "
+              f"max {max(answered):.2f}")
+    if stat:
+        # STAT:Profile,Loops,AvgLoopUs,MaxLoopUs,LastStopUs,MaxStopUs,LastRemoteStopUs,MaxRemoteStopUs
+        fields = stat.split(":")[1].split(",")
+        if len(fields) >= 8:
+            print(f"On device us: last {fields[6]}  max {fields[7]}  (loop avg {fields[2]}, max {fields[3]})")
+    return 0 if len(answered) == len(results) else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
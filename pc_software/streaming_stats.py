@@ -0,0 +1,219 @@
+"""Running statistics over a sample stream, for the HMI and host tools.
+
+The same primitives as cardDetectionArduinoSoft/include/StreamingStats.h,
+with the same results: O(1) (amortised) work per sample and constant
+memory, so nothing has to rescan a window or a whole trace.
+QuantileSketch is host only: mergeable quantiles for long-term records.
+
+Run directly for a benchmark against recomputing over the window:
+    python streaming_stats.py --window 50 500 5000 --samples 200000
+"""
+import argparse
+import math
+import random
+import time
+from collections import deque
+
+
+class SlidingMinMax:
+    """Min and max of the last `window` values (monotonic deques)"""
+
+    def __init__(self, window):
+        self.window = window
+        self.reset()
+
+    def reset(self):
+        self.seq = 0
+        self.low = deque()  # (seq, value), values rising
+        self.high = deque()  # (seq, value), values falling
+
+    def add(self, value):
+        for queue, beats in ((self.low, lambda a, b: a < b), (self.high, lambda a, b: a > b)):
+            if queue and self.seq - queue[0][0] >= self.window:
+                queue.popleft()
+            while queue and not beats(queue[-1][1], value):
+                queue.pop()
+            queue.append((self.seq, value))
+        self.seq += 1
+
+    @property
+    def min(self):
+        return self.low[0][1]
+
+    @property
+    def max(self):
+        return self.high[0][1]
+
+
+class Ewma:
+    """Exponentially weighted mean, seeded by the first value"""
+
+    def __init__(self, alpha):
+        self.alpha = alpha
+        self.mean = None
+
+    def add(self, value):
+        self.mean = value if self.mean is None else self.mean + self.alpha * (value - self.mean)
+
+
+class Welford:
+    """Mean and sample variance in one pass"""
+
+    def __init__(self):
+        self.count = 0
+        self.mean = 0.0
+        self.m2 = 0.0
+
+    def add(self, value):
+        self.count += 1
+        delta = value - self.mean
+        self.mean += delta / self.count
+        self.m2 += delta * (value - self.mean)
+
+    @property
+    def variance(self):
+        return self.m2 / (self.count - 1) if self.count > 1 else 0.0
+
+
+class HistogramQuantile:
+    """Quantiles of 0 .. buckets * width - 1 from a fixed histogram.
+
+    Counts are halved when one reaches count_max (uint16 on the device),
+    so older samples slowly lose weight, as in the C++ version.
+    """
+
+    def __init__(self, buckets=64, width=16, count_max=0xFFFF):
+        self.width = width
+        self.count_max = count_max
+        self.counts = [0] * buckets
+        self.total = 0
+
+    def add(self, value):
+        i = min(value // self.width, len(self.counts) - 1)
+        if self.counts[i] == self.count_max:
+            self.counts = [c // 2 for c in self.counts]
+            self.total = sum(self.counts)
+        self.counts[i] += 1
+        self.total += 1
+
+    def quantile(self, percent):
+        """Midpoint of the bucket holding the percentile (0..100)"""
+        rank = self.total * percent // 100
+        seen = 0
+        for i, count in enumerate(self.counts):
+            seen += count
+            if seen > rank:
+                return i * self.width + self.width // 2
+        return (len(self.counts) - 1) * self.width + self.width // 2
+
+
+class QuantileSketch:
+    """Mergeable quantiles of non-negative values with a relative error bound.
+
+    Log-spaced buckets (as in DDSketch): value v > 0 goes to bucket
+    ceil(log(v) / log(gamma)) with gamma = (1 + accuracy) / (1 - accuracy),
+    so every quantile is within accuracy * value of the exact one. Merging
+    adds bucket counts, so sketches of any hours or devices combine with no
+    loss beyond that bound, in any order. Size grows with log(max / min),
+    about 350 buckets at 1% for 1 .. 1023, and is independent of the count.
+    """
+
+    def __init__(self, accuracy=0.01):
+        self.accuracy = accuracy
+        self.gamma = (1 + accuracy) / (1 - accuracy)
+        self.log_gamma = math.log(self.gamma)
+        self.buckets = {}
+        self.zeros = 0
+        self.count = 0
+        self.low = None
+        self.high = None
+
+    def add(self, value, count=1):
+        if value < 0:
+            raise ValueError("QuantileSketch holds non-negative values")
+        if value == 0:
+            self.zeros += count
+        else:
+            k = math.ceil(math.log(value) / self.log_gamma)
+            self.buckets[k] = self.buckets.get(k, 0) + count
+        self.count += count
+        self.low = value if self.low is None else min(self.low, value)
+        self.high = value if self.high is None else max(self.high, value)
+
+    def merge(self, other):
+        if other.accuracy != self.accuracy:
+            raise ValueError("sketches of different accuracy do not merge")
+        for k, count in other.buckets.items():
+            self.buckets[k] = self.buckets.get(k, 0) + count
+        self.zeros += other.zeros
+        self.count += other.count
+        if other.count:
+            self.low = other.low if self.low is None else min(self.low, other.low)
+            self.high = other.high if self.high is None else max(self.high, other.high)
+        return self
+
+    def quantile(self, percent):
+        """Value at the percentile (0..100), None when empty"""
+        if self.count == 0:
+            return None
+        rank = (self.count - 1) * percent / 100
+        seen = self.zeros
+        if seen > rank:
+            return 0
+        for k in sorted(self.buckets):
+            seen += self.buckets[k]
+            if seen > rank:
+                value = 2 * self.gamma ** k / (self.gamma + 1)  # Bucket (gamma^(k-1), gamma^k]
+                return min(max(value, self.low), self.high)
+        return self.high
+
+    def to_dict(self):
+        return {"accuracy": self.accuracy, "zeros": self.zeros, "low": self.low, "high": self.high,
+                "buckets": {str(k): c for k, c in sorted(self.buckets.items())}}
+
+    @classmethod
+    def from_dict(cls, data):
+        sketch = cls(data["accuracy"])
+        sketch.buckets = {int(k): c for k, c in data["buckets"].items()}
+        sketch.zeros = data["zeros"]
+        sketch.count = sketch.zeros + sum(sketch.buckets.values())
+        sketch.low = data["low"]
+        sketch.high = data["high"]
+        return sketch
+
+
+def benchmark(windows, samples, seed):
+    rng = random.Random(seed)
+    values = [rng.randrange(1024) for _ in range(samples)]
+    print(f"{'window':>8}{'rescan s':>11}{'deque s':>10}{'speedup':>9}")
+    for window in windows:
+        start = time.perf_counter()
+        recent = deque(maxlen=window)
+        rescanned = []
+        for v in values:
+            recent.append(v)
+            rescanned.append((min(recent), max(recent)))
+        rescan = time.perf_counter() - start
+
+        start = time.perf_counter()
+        sliding = SlidingMinMax(window)
+        streamed = []
+        for v in values:
+            sliding.add(v)
+            streamed.append((sliding.min, sliding.max))
+        stream = time.perf_counter() - start
+        assert streamed == rescanned
+        print(f"{window:>8}{rescan:>11.2f}{stream:>10.2f}{rescan / stream:>8.1f}x")
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark the sliding min/max")
+    parser.add_argument("--window", type=int, nargs="+", default=[50, 500, 5000])
+    parser.add_argument("--samples", type=int, default=200000)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+    benchmark(args.window, args.samples, args.seed)
+
+
+if __name__ == "__main__":
+    main()
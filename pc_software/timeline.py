@@ -0,0 +1,197 @@
+"""All machines' events on one timeline.
+
+Each device counts its own millis(). With "timeline_file" set in its
+config.json, the HMI turns on the device's EVENT_STAMPS, probes the device
+clock with TIME? and writes every stamped line (EVT:/ERR:/E:/SYNC:, and T:
+telemetry) to that file as JSON, its device time mapped onto the PC's
+clock: {"t": <epoch ms>, "device": <name>, "line": <line>, "sync": <+-ms>}.
+
+This tool merges the files of several machines (PCs kept in time by NTP)
+into one ordered stream. It is a streaming k-way merge: a record is
+released once every file has moved past it, or once it is --lateness ms
+old, so a quiet machine holds the others back at most that long. A record
+that arrives after a later one was released (events replayed by SYNC
+after autonomous running) is released at once and marked late.
+
+Usage:
+    python timeline.py line1/timeline.jsonl line2/timeline.jsonl --only EVT ERR
+    python timeline.py //server/hmi/*/timeline.jsonl --follow --lateness 2000 --out merged.jsonl
+"""
+import argparse
+import heapq
+import json
+import sys
+import time
+from collections import deque
+from datetime import datetime
+
+
+def split_stamp(line):
+    """'EVT:PASS:420:35 @123456' -> ('EVT:PASS:420:35', 123456); no stamp -> (line, None)"""
+    head, sep, stamp = line.rpartition(" @")
+    if sep and stamp.isdigit():
+        return head, int(stamp)
+    return line, None
+
+
+class ClockSync:
+    """Device millis() -> PC time in ms, from TIME? round trips.
+
+    The device read its clock between the probe being sent and the reply
+    being read, so PC time = device time + offset within half the round
+    trip. The offset drifts (ceramic resonators are off by up to 0.5%), so
+    PC time = a + b * device time is fitted over the recent probes with
+    the shortest round trips. millis() wraps after 49.7 days; times are
+    unwrapped against the newest probe. A probe going back in time means
+    the device restarted, and the fit starts over.
+    """
+
+    def __init__(self, window=32):
+        self.probes = deque(maxlen=window)  # (device ms, PC ms at the midpoint, round trip ms)
+        self.newest = None  # Unwrapped device time of the newest probe
+        self.a = None
+        self.b = 1.0
+        self.error = None
+
+    def unwrap(self, ms):
+        """The device time nearest the newest probe that reads ms on the device"""
+        if self.newest is None:
+            return ms
+        ms += self.newest - self.newest % 2 ** 32
+        if ms + 2 ** 31 < self.newest:
+            ms += 2 ** 32
+        elif ms - 2 ** 31 > self.newest:
+            ms -= 2 ** 32
+        return ms
+
+    def add(self, sent, device_ms, received):
+        ms = self.unwrap(device_ms)
+        if self.newest is not None and ms < self.newest - 1000:
+            self.probes.clear()
+            self.newest = None
+            ms = device_ms
+        self.newest = ms if self.newest is None else max(self.newest, ms)
+        self.probes.append((ms, (sent + received) / 2, received - sent))
+        best = min(p[2] for p in self.probes)
+        good = [p for p in self.probes if p[2] <= best * 1.5 + 2]
+        self.error = best / 2
+        span = good[-1][0] - good[0][0]
+        if len(good) >= 2 and span >= 10000:
+            mx = sum(p[0] for p in good) / len(good)
+            my = sum(p[1] for p in good) / len(good)
+            self.b = sum((p[0] - mx) * (p[1] - my) for p in good) / sum((p[0] - mx) ** 2 for p in good)
+            self.a = my - self.b * mx
+        else:
+            ms, mid, _ = min(good, key=lambda p: p[2])
+            self.b = 1.0
+            self.a = mid - ms
+
+    def to_pc(self, device_ms):
+        """PC time in ms of a device time, None before the first probe"""
+        return None if self.a is None else self.a + self.b * self.unwrap(device_ms)
+
+
+class KWayMerge:
+    """Time-ordered records of several sources into one ordered stream.
+
+    push() records as they arrive, each source in its own time order;
+    pop(now) returns those that can no longer be overtaken: every source
+    has reached them, or they are older than now - lateness. Memory is
+    bounded by what arrives within the lateness.
+    """
+
+    def __init__(self, lateness_ms, sources=()):
+        self.lateness = lateness_ms
+        self.newest = {source: None for source in sources}
+        self.heap = []
+        self.order = 0
+        self.released = float("-inf")
+        self.late = 0
+
+    def push(self, source, t, record):
+        if self.newest.get(source) is None or t > self.newest[source]:
+            self.newest[source] = t
+        heapq.heappush(self.heap, (t, self.order, source, record))
+        self.order += 1
+
+    def watermark(self, now):
+        mark = now - self.lateness
+        if self.newest and None not in self.newest.values():
+            mark = max(mark, min(self.newest.values()))
+        return mark
+
+    def pop(self, now):
+        """[(t, source, record, late)] in time order"""
+        out = []
+        mark = self.watermark(now)
+        while self.heap and self.heap[0][0] <= mark:
+            t, _, source, record = heapq.heappop(self.heap)
+            late = t < self.released
+            self.late += late
+            self.released = max(self.released, t)
+            out.append((t, source, record, late))
+        return out
+
+    def flush(self):
+        return self.pop(float("inf"))
+
+
+class Tail:
+    """Complete lines appended to a file since the last read"""
+
+    def __init__(self, path):
+        self.file = open(path, 'r', encoding='utf-8')
+        self.partial = ""
+
+    def lines(self):
+        out = []
+        while True:
+            chunk = self.file.readline()
+            if not chunk:
+                return out
+            self.partial += chunk
+            if self.partial.endswith("\n"):
+                out.append(self.partial)
+                self.partial = ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Merge the HMIs' timeline files into one ordered stream")
+    parser.add_argument("files", nargs="+", help="timeline_file of each HMI")
+    parser.add_argument("--follow", action="store_true", help="Keep reading as the files grow")
+    parser.add_argument("--lateness", type=float, default=2000, help="Longest a machine may lag, ms")
+    parser.add_argument("--only", nargs="*", help="Record types to keep, e.g. EVT ERR SYNC")
+    parser.add_argument("--out", help="Also append the merged records to this file (JSON lines)")
+    args = parser.parse_args()
+
+    tails = {path: Tail(path) for path in args.files}
+    merge = KWayMerge(args.lateness, args.files)
+    out = open(args.out, 'a', encoding='utf-8') if args.out else None
+    while True:
+        for path, tail in tails.items():
+            for text in tail.lines():
+                try:
+                    record = json.loads(text)
+                except ValueError:
+                    continue
+                if args.only and record["line"].split(":", 1)[0] not in args.only:
+                    continue
+                merge.push(path, record["t"], record)
+        ready = merge.pop(time.time() * 1000) if args.follow else merge.flush()
+        for t, _, record, late in ready:
+            stamp = datetime.fromtimestamp(t / 1000).strftime("%Y-%m-%d %H:%M:%S.%f")[:-3]
+            print(f"{stamp}  {record['device']:<12} {record['line']}{'  (late)' if late else ''}")
+            if out:
+                out.write(json.dumps(dict(record, late=late)) + "\n")
+        if out:
+            out.flush()
+        if not args.follow:
+            break
+        time.sleep(0.2)
+    if merge.late:
+        print(f"{merge.late} records arrived after later ones were released", file=sys.stderr)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
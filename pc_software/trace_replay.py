@@ -0,0 +1,246 @@
+"""Replay a recorded sensor trace through the detector on the Arduino.
+
+The device is switched into sample injection mode (INJECT command), the
+trace is streamed as binary frames and the EVT:/ERR: verdicts it prints
+are compared against an expected verdict file. The device processes a
+sample slower than a frame arrives at high baud rates, so frames are sent
+against its INJ:<frames> acknowledgements, at most INJECT_WINDOW_FRAMES
+ahead - that fits the 64-byte RX buffer and no frame is dropped.
+
+Trace file: one sample per line, "adc,envelope" (envelope 1 = present).
+Blank lines, '#' comments and a non-numeric header line are ignored.
+Verdict file: one EVT:/ERR: line per envelope, exactly as the device prints it.
+
+The link is switched to --link-baud (default 1 Mbaud) before replaying.
+
+Usage:
+    python trace_replay.py COM6 trace.csv --expect verdicts.txt
+    python trace_replay.py COM6 trace.csv --record verdicts.txt
+"""
+import argparse
+import struct
+import sys
+import threading
+import time
+
+import serial
+
+from link_baud import negotiate_baud
+
+INJECT_SYNC = 0xA5
+INJECT_CTRL_END = 0x8000
+INJECT_CTRL_RESUME = 0x8001
+INJECT_ACK_FRAMES = 8      # Must match the firmware
+INJECT_WINDOW_FRAMES = 16  # 48 bytes in flight, below the device's 64-byte RX buffer
+
+
+def load_trace(path):
+    """Read (adc, envelope) samples from a trace file"""
+    samples = []
+    with open(path, 'r') as f:
+        for line in f:
+            line = line.split('#')[0].strip()
+            if not line:
+                continue
+            parts = line.split(',')
+            try:
+                adc = int(parts[0])
+                envelope = int(parts[1]) if len(parts) > 1 else 0
+            except ValueError:
+                continue  # Header line
+            samples.append((max(0, min(1023, adc)), envelope == 1))
+    return samples
+
+
+def load_verdicts(path):
+    with open(path, 'r') as f:
+        return [line.strip() for line in f if line.strip()]
+
+
+def encode_sample(adc, envelope):
+    return struct.pack('<BH', INJECT_SYNC, (adc & 0x03FF) | (0x0400 if envelope else 0))
+
+
+def encode_control(code):
+    return struct.pack('<BH', INJECT_SYNC, code)
+
+
+def is_verdict(line):
+    return line.startswith("EVT:") or line.startswith("ERR:")
+
+
+class LineReader:
+    """Collects device output lines on a background thread"""
+
+    def __init__(self, ser):
+        self.ser = ser
+        self.lines = []
+        self.acked = 0  # Latest INJ:<frames> acknowledgement, kept out of lines
+        self.cond = threading.Condition()
+        self.running = True
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def run(self):
+        while self.running:
+            try:
+                raw = self.ser.readline()
+            except Exception:
+                break
+            if raw:
+                line = raw.decode('utf-8', errors='ignore').strip()
+                with self.cond:
+                    if line.startswith("INJ:") and line[4:].isdigit():
+                        self.acked = int(line[4:])
+                    else:
+                        self.lines.append(line)
+                    self.cond.notify_all()
+
+    def wait_for(self, prefix, timeout):
+        """Wait for a line starting with prefix, return it or None"""
+        deadline = time.time() + timeout
+        with self.cond:
+            while True:
+                for line in self.lines:
+                    if line.startswith(prefix):
+                        return line
+                remaining = deadline - time.time()
+                if remaining <= 0:
+                    return None
+                self.cond.wait(remaining)
+
+    def wait_acked(self, frames, timeout):
+        """Wait until the device acknowledged at least frames, return False on timeout"""
+        deadline = time.time() + timeout
+        with self.cond:
+            while self.acked < frames:
+                remaining = deadline - time.time()
+                if remaining <= 0:
+                    return False
+                self.cond.wait(remaining)
+            return True
+
+    def stop(self):
+        self.running = False
+
+
+def open_device(port, baud):
+    """Open the port the same way the HMI does (board resets on open)"""
+    ser = serial.Serial(port, baud, timeout=0.1)
+    ser.dtr = False
+    time.sleep(0.1)
+    ser.dtr = True
+    time.sleep(2.0)
+    ser.reset_input_buffer()
+    ser.reset_output_buffer()
+    return ser
+
+
+def replay(ser, samples, sample_ms, auto_resume, timeout):
+    """Stream samples to the device, return (verdicts, frames_seen, seconds)"""
+    reader = LineReader(ser)
+    try:
+        ser.write(b"PING\n")
+        ser.write(b"SUBSCRIBE:EVT,1\n")  # PASS verdicts are part of the comparison
+        ser.write(f"INJECT:{sample_ms}{',1' if auto_resume else ''}\n".encode())
+        if reader.wait_for("MSG:INJECT_READY", 2.0) is None:
+            raise RuntimeError("device did not enter injection mode")
+
+        start = time.time()
+        payload = b"".join(encode_sample(adc, env) for adc, env in samples)
+        sent = 0
+        while sent < len(samples):
+            # Acks come every INJECT_ACK_FRAMES, so the last partial step is sent unacked
+            if not reader.wait_acked(sent + INJECT_ACK_FRAMES - INJECT_WINDOW_FRAMES, timeout):
+                raise RuntimeError(f"device stopped acknowledging frames after {reader.acked}")
+            step = min(INJECT_ACK_FRAMES, len(samples) - sent)
+            ser.write(payload[sent * 3:(sent + step) * 3])
+            sent += step
+        ser.write(encode_control(INJECT_CTRL_END))
+        ser.flush()
+
+        end_line = reader.wait_for("MSG:INJECT_END", timeout)
+        elapsed = time.time() - start
+        if end_line is None:
+            raise RuntimeError("device did not leave injection mode")
+        frames_seen = int(end_line.split(":")[2])
+
+        with reader.cond:
+            verdicts = [line for line in reader.lines if is_verdict(line)]
+        return verdicts, frames_seen, elapsed
+    finally:
+        reader.stop()
+
+
+def compare(expected, actual):
+    """Return a list of human readable mismatch descriptions"""
+    problems = []
+    for i in range(max(len(expected), len(actual))):
+        exp = expected[i] if i < len(expected) else "<none>"
+        got = actual[i] if i < len(actual) else "<none>"
+        if exp != got:
+            problems.append(f"#{i}: expected {exp}, got {got}")
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Replay a sensor trace through the device detector")
+    parser.add_argument("port", help="Serial port of the device (or simulator)")
+    parser.add_argument("trace", help="Trace file with adc,envelope lines")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--link-baud", type=int, default=1000000,
+                        help="Negotiate this rate before replaying (same as --baud to skip)")
+    parser.add_argument("--sample-ms", type=int, default=1, help="Trace sample period in ms")
+    parser.add_argument("--expect", help="Expected verdict file to compare against")
+    parser.add_argument("--record", help="Write the observed verdicts to this file")
+    parser.add_argument("--no-auto-resume", action="store_true",
+                        help="Stop at the first fault like the real machine")
+    parser.add_argument("--no-reset", action="store_true",
+                        help="Do not toggle DTR on open (simulator / virtual port)")
+    parser.add_argument("--timeout", type=float, default=10.0,
+                        help="Seconds to wait for the device after the last frame")
+    args = parser.parse_args()
+
+    samples = load_trace(args.trace)
+    if not samples:
+        print("Trace is empty")
+        return 2
+
+    if args.no_reset:
+        ser = serial.Serial(args.port, args.baud, timeout=0.1)
+    else:
+        ser = open_device(args.port, args.baud)
+    try:
+        rate = negotiate_baud(ser, args.link_baud)
+        if rate != args.link_baud:
+            print(f"Link stays at {rate} baud")
+        verdicts, frames_seen, elapsed = replay(ser, samples, args.sample_ms,
+                                                not args.no_auto_resume, args.timeout)
+    finally:
+        ser.close()
+
+    print(f"Replayed {len(samples)} samples in {elapsed:.2f}s ({len(samples) / elapsed:.0f} samples/s), "
+          f"device saw {frames_seen}, {len(verdicts)} verdicts")
+    status = 0
+    if frames_seen != len(samples):
+        print("WARNING: frames were lost on the link")
+        status = 1
+
+    if args.record:
+        with open(args.record, 'w') as f:
+            f.write("\n".join(verdicts) + "\n")
+
+    if args.expect:
+        problems = compare(load_verdicts(args.expect), verdicts)
+        if problems:
+            print(f"{len(problems)} verdict mismatches:")
+            for p in problems:
+                print("  " + p)
+            status = 1
+        else:
+            print("All verdicts match")
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())